@@ -0,0 +1,115 @@
+// Accounting of block writes, a block fails in the middle of an object,
+// the buffer budget is exhausted
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "src/s3_cmds/zgw_s3_stream.h"
+#include "src/zgw_block_writer.h"
+#include "src/zgw_buffer_pool.h"
+#include "src/zgw_config.h"
+
+ZgwConfig* g_zgw_conf;
+ZgwBlockWriter* g_zgw_block_writer;
+
+static int failures = 0;
+
+static void Expect(const std::string& name, bool ok) {
+  std::cout << name << ": " << (ok ? "ok" : "failed") << std::endl;
+  if (!ok) {
+    failures++;
+  }
+}
+
+static void TestCommittedInOrder() {
+  // Two batches, block ids are not contiguous
+  BlockWriteTracker tracker;
+  uint64_t blocks[] = {10, 11, 12, 40, 41};
+  for (uint64_t b : blocks) {
+    tracker.Add(b);
+  }
+  tracker.Done(11, Status::OK());
+  Expect("Out of order block not committed", tracker.committed_count() == 0);
+  tracker.Done(10, Status::OK());
+  Expect("Committed up to the gap", tracker.committed_count() == 2);
+  tracker.Done(41, Status::OK());
+  tracker.Done(12, Status::OK());
+  tracker.Done(40, Status::OK());
+  Status s = tracker.Wait();
+  Expect("All committed", s.ok() && tracker.committed_count() == 5);
+}
+
+static void TestFailMidObject() {
+  BlockWriteTracker tracker;
+  for (uint64_t b = 0; b < 5; b++) {
+    tracker.Add(b);
+  }
+  tracker.Done(0, Status::OK());
+  tracker.Done(3, Status::OK());
+  tracker.Done(2, Status::IOError("BlockSet failed"));
+  Expect("Error seen before Wait", tracker.status().IsIOError());
+  // Blocks after the failed one are still written
+  tracker.Done(1, Status::OK());
+  tracker.Done(4, Status::OK());
+  Status s = tracker.Wait();
+  Expect("Wait returns the first error", s.IsIOError());
+  Expect("Committed stops at the failed block",
+         tracker.committed_count() == 2);
+
+  // The upload stops dispatching, nothing is written
+  std::shared_ptr<BlockWriteTracker> failed(new BlockWriteTracker());
+  failed->Add(0);
+  failed->Done(0, Status::IOError("BlockSet failed"));
+  s = DispatchBlock(failed, nullptr, nullptr, 1, "a", 1, kCodecNone);
+  Expect("No block dispatched after the error",
+         s.IsIOError() && failed->committed_count() == 0);
+}
+
+static void TestWindow() {
+  BlockWriteTracker tracker;
+  bool ret = tracker.TryAdd(0, 2) && tracker.TryAdd(1, 2);
+  Expect("Within the window", ret);
+  Expect("Window full", !tracker.TryAdd(2, 2));
+  tracker.Done(0, Status::OK());
+  Expect("Window reopened", tracker.TryAdd(2, 2));
+  tracker.Done(1, Status::OK());
+  tracker.Done(2, Status::OK());
+  Expect("Window drained", tracker.Wait().ok() &&
+         tracker.committed_count() == 3);
+
+  // Caller writes the block itself if no writer takes it
+  ZgwBufferPool pool(0);
+  ZgwBlockWriter writer(4, 2, &pool);
+  std::shared_ptr<BlockWriteTracker> upload(new BlockWriteTracker());
+  Expect("Submit without writers",
+         !writer.Submit(upload, 0, "a", 1, kCodecNone) &&
+         upload->committed_count() == 0 && upload->Wait().ok());
+}
+
+static void TestBudget() {
+  // Room for two buffers of the smallest class
+  ZgwBufferPool pool(128 * 1024);
+  ZgwBuffer a, b, c;
+  bool ret = pool.TryAcquire(1024, &a) && pool.TryAdmit() &&
+    pool.TryAcquire(1024, &b);
+  Expect("Within the budget", ret);
+  Expect("Budget exhausted", !pool.TryAcquire(1024, &c) && !pool.TryAdmit());
+  // Requests in progress go over the budget instead of waiting
+  pool.Acquire(1024, &c);
+  Expect("Overcommitted", c.acquired());
+  pool.Release(&c);
+  pool.Release(&b);
+  Expect("Admitted after release", pool.TryAdmit());
+  pool.Release(&a);
+  std::string status = pool.BufferStatus();
+  Expect("Counted", status.find("\"rejects\": \"1\"") != std::string::npos &&
+         status.find("\"overcommits\": \"1\"") != std::string::npos);
+}
+
+int main() {
+  TestCommittedInOrder();
+  TestFailMidObject();
+  TestWindow();
+  TestBudget();
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,171 @@
+// Decoding of aws-chunked bodies, with and without trailers
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/sha.h>
+#include <iostream>
+#include <string>
+
+#include "src/s3_cmds/zgw_s3_stream.h"
+#include "src/zgw_block_writer.h"
+#include "src/zgw_config.h"
+
+ZgwConfig* g_zgw_conf;
+ZgwBlockWriter* g_zgw_block_writer;
+
+static int failures = 0;
+
+static std::string HMAC_SHA256(const std::string& key,
+                               const std::string& value) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len = 0;
+  HMAC(EVP_sha256(), key.data(), key.size(),
+       reinterpret_cast<const unsigned char*>(value.data()), value.size(),
+       digest, &digest_len);
+  return std::string(reinterpret_cast<char*>(digest), digest_len);
+}
+
+static std::string Hex(const std::string& raw) {
+  char buf[3];
+  std::string hex;
+  for (unsigned char c : raw) {
+    snprintf(buf, sizeof(buf), "%02x", c);
+    hex.append(buf);
+  }
+  return hex;
+}
+
+static std::string SHA256Hex(const std::string& value) {
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const unsigned char*>(value.data()), value.size(),
+         digest);
+  return Hex(std::string(reinterpret_cast<char*>(digest),
+                         SHA256_DIGEST_LENGTH));
+}
+
+static void Expect(const std::string& name, bool ok) {
+  std::cout << name << ": " << (ok ? "ok" : "failed") << std::endl;
+  if (!ok) {
+    failures++;
+  }
+}
+
+// Decode body in one piece, then again byte by byte
+static bool Decode(AwsChunkedDecoder* decoder, const std::string& body,
+                   bool byte_by_byte, std::string* output) {
+  if (!byte_by_byte) {
+    return decoder->Decode(body.data(), body.size(), output);
+  }
+  for (char c : body) {
+    if (!decoder->Decode(&c, 1, output)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void TestUnsigned() {
+  for (int byte_by_byte = 0; byte_by_byte < 2; byte_by_byte++) {
+    std::string suffix = byte_by_byte ? " (byte by byte)" : "";
+    AwsChunkedDecoder decoder;
+    std::string output;
+    bool ret = Decode(&decoder, "5\r\nhello\r\n6\r\n world\r\n0\r\n\r\n",
+                      byte_by_byte, &output);
+    Expect("Unsigned chunks" + suffix,
+           ret && decoder.finished() && output == "hello world");
+
+    // STREAMING-UNSIGNED-PAYLOAD-TRAILER
+    decoder.Reset();
+    output.clear();
+    ret = Decode(&decoder, "5\r\nhello\r\n0\r\n"
+                 "x-amz-checksum-crc32:NhCmhg==\r\n\r\n",
+                 byte_by_byte, &output);
+    Expect("Unsigned chunks with trailer" + suffix,
+           ret && decoder.finished() && output == "hello");
+
+    // The trailer is not complete until the empty line
+    decoder.Reset();
+    output.clear();
+    ret = Decode(&decoder, "5\r\nhello\r\n0\r\n"
+                 "x-amz-checksum-crc32:NhCmhg==\r\n",
+                 byte_by_byte, &output);
+    Expect("Unfinished trailer" + suffix, ret && !decoder.finished());
+
+    decoder.Reset();
+    output.clear();
+    ret = Decode(&decoder, "5\r\nhello\r\n0\r\nnot-a-header\r\n\r\n",
+                 byte_by_byte, &output);
+    Expect("Malformed trailer" + suffix, !ret);
+  }
+}
+
+static void TestSigned() {
+  // Example of the AWS documents "Signature Calculations for the
+  // Authorization Header: Transferring Payload in Multiple Chunks"
+  std::string key = HMAC_SHA256("AWS4wJalrXUtnFEMI/K7MDENG/bPxRfiCYEXAMPLEKEY",
+                                "20130524");
+  key = HMAC_SHA256(key, "us-east-1");
+  key = HMAC_SHA256(key, "s3");
+  key = HMAC_SHA256(key, "aws4_request");
+  const std::string scope = "20130524T000000Z\n"
+    "20130524/us-east-1/s3/aws4_request\n";
+  const std::string prefix = "AWS4-HMAC-SHA256-PAYLOAD\n" + scope;
+  const std::string seed_signature =
+    "4f232c4386841ef735655705268965c44a0e4690baa4adea153f7db9fa80a0a9";
+  const std::string last_signature =
+    "b6c6ea8a5354eaf15b3cb7646744f4275b71ea724fed81ceb9323e279d449df9";
+  std::string body = "10000;chunk-signature="
+    "ad80c730a21e5b8d04586a2213dd63b9a0e99e0e2307b0ade35a65485a288648\r\n" +
+    std::string(65536, 'a') + "\r\n400;chunk-signature="
+    "0055627c9e194cb4542bae2aa5492e3c1575bbb81b612b7d234b86a503ef5497\r\n" +
+    std::string(1024, 'a') + "\r\n0;chunk-signature=" + last_signature +
+    "\r\n";
+
+  // STREAMING-AWS4-HMAC-SHA256-PAYLOAD-TRAILER, the trailer is signed
+  // following the last chunk signature
+  const std::string trailer = "x-amz-checksum-crc32c:sOO8/Q==\n";
+  std::string trailer_signature = Hex(HMAC_SHA256(key,
+      "AWS4-HMAC-SHA256-TRAILER\n" + scope + last_signature + "\n" +
+      SHA256Hex(trailer)));
+
+  for (int byte_by_byte = 0; byte_by_byte < 2; byte_by_byte++) {
+    std::string suffix = byte_by_byte ? " (byte by byte)" : "";
+    AwsChunkedDecoder decoder;
+    std::string output;
+    decoder.EnableSignatureCheck(key, prefix, seed_signature);
+    bool ret = Decode(&decoder, body + "\r\n", byte_by_byte, &output);
+    Expect("Signed chunks" + suffix, ret && decoder.finished() &&
+           output == std::string(66560, 'a'));
+
+    decoder.Reset();
+    output.clear();
+    decoder.EnableSignatureCheck(key, prefix, seed_signature);
+    ret = Decode(&decoder, body + "x-amz-checksum-crc32c:sOO8/Q==\r\n"
+                 "x-amz-trailer-signature:" + trailer_signature + "\r\n\r\n",
+                 byte_by_byte, &output);
+    Expect("Signed chunks with trailer" + suffix,
+           ret && decoder.finished() && output == std::string(66560, 'a'));
+
+    decoder.Reset();
+    output.clear();
+    decoder.EnableSignatureCheck(key, prefix, seed_signature);
+    ret = Decode(&decoder, body + "x-amz-checksum-crc32c:AAAAAA==\r\n"
+                 "x-amz-trailer-signature:" + trailer_signature + "\r\n\r\n",
+                 byte_by_byte, &output);
+    Expect("Tampered trailer" + suffix,
+           !ret && decoder.signature_mismatch());
+
+    decoder.Reset();
+    output.clear();
+    decoder.EnableSignatureCheck(key, prefix, seed_signature);
+    ret = Decode(&decoder, body + "x-amz-checksum-crc32c:sOO8/Q==\r\n\r\n",
+                 byte_by_byte, &output);
+    Expect("Unsigned trailer of signed chunks" + suffix,
+           !ret && decoder.signature_mismatch());
+  }
+}
+
+int main() {
+  TestUnsigned();
+  TestSigned();
+  return failures == 0 ? 0 : 1;
+}
@@ -6,10 +6,6 @@
 bool AbortMultiUploadCmd::DoInitial() {
   http_response_xml_.clear();
   upload_id_ = query_params_.at("uploadId");
-  request_id_ = md5(bucket_name_ +
-                    object_name_ +
-                    upload_id_ + 
-                    std::to_string(slash::NowMicros()));
   if (!TryAuth()) {
     DLOG(INFO) << request_id_ << " " <<
       "AbortMultiUpload(DoInitial) - Auth failed: " << client_ip_port_;
@@ -1,50 +1,157 @@
 #include "src/s3_cmds/zgw_s3_authv4.h"
 
+#include <cassert>
 #include <cctype>
+#include <ctime>
+#include <cstring>
 #include <utility>
 #include <map>
-#include <vector>
 
+#include <openssl/evp.h>
 #include <openssl/hmac.h>
-#include "slash/include/slash_string.h"
-#include "slash/include/slash_hash.h"
+#include <openssl/sha.h>
 #include "slash/include/env.h"
 #include "slash/include/slash_status.h"
 #include "src/zgw_utils.h"
+#include "src/zgw_lru_cache.h"
+#include "src/zgw_credential_cache.h"
 
-static std::string HMAC_SHA256(const std::string key, const std::string value, bool raw = true);
+extern ZgwCredentialCache* g_zgw_credential_cache;
 
-// Expire after 5 minutes
-//              access_key              user_name    secret_key 
-static std::map<std::string, std::pair<std::string, std::string>> key_map;
-static uint64_t latest_update_time;
-static const uint64_t kFiveMinutesUs = 5 * 60 * 1e6;
-static std::string last_access_key;
+static const size_t kSHA256Size = SHA256_DIGEST_LENGTH;
 
+// Signing keys derived from the secret key are the same for a credential
+// all the day, keyed by access_key/date/region
+struct SigningKeyEntry {
+  std::string secret_key;
+  std::string signing_key;
+};
+static const size_t kSigningKeyCacheSize = 4096;
+static ZgwLRUCache<SigningKeyEntry> signing_key_cache(kSigningKeyCacheSize);
+
+// The same presigned GET is repeated until it expires, e.g. by CDN, keyed
+// by signature + sha256 of the canonical request once it was verified
+struct PresignedEntry {
+  std::string user_name;
+  int64_t expire_time;
+  // Version of the credentials it was verified with
+  uint64_t credential_version;
+};
+static const size_t kPresignedCacheSize = 10000;
+static ZgwLRUCache<PresignedEntry> presigned_cache(kPresignedCacheSize);
+
+// Buffers are kept by the command of a connection and reused by all its
+// requests, a request verified normally allocates nothing
 struct S3AuthV4::Rep {
 
   std::string user_name_;
   std::string access_key_;
+  bool access_key_found_;
   bool is_presign_url_;
+  int64_t presign_expire_time_;
   std::string encryption_method_;
   std::string date_;
   std::string iso_date_;
   std::string region_;
-  std::vector<std::string> signed_headers_;
   std::string signed_headers_str_;
   std::string signature_;
   std::string signature_received_;
+  std::string signing_key_;
   std::string canonical_request_;
 
+  std::string secret_key_;
+  std::string canonical_request_hash_;
+  std::string string_to_sign_;
+  std::string cache_key_;
+  std::string scratch_;
+  SigningKeyEntry signing_entry_;
+  PresignedEntry presigned_entry_;
+
   void Clear();
-  void UpdateKeyMap(zgwstore::ZgwStore* store);
-  void CalcSignature(const std::string& secret_key);
+  bool LookupPresigned(const std::string& method);
+  void CalcSignature();
   bool ParseHeaderAuthStr(const std::map<std::string, std::string>& headers);
   bool ParseQueryAuthStr(const std::map<std::string, std::string>& query_params);
-  bool ParseCredential(const std::string& credential_str);
-  void CreateCanonicalRequest(const pink::HTTPRequest *req);
+  bool ParseCredential(const std::string& str, size_t begin, size_t end);
+  void CreateCanonicalRequest(
+      const std::string& method, const std::string& path,
+      const std::map<std::string, std::string>& headers,
+      const std::map<std::string, std::string>& query_params);
 };
 
+static void HMAC_SHA256(const std::string& key, const char* data, size_t size,
+                        unsigned char* digest) {
+  unsigned int digest_len = kSHA256Size;
+  HMAC(EVP_sha256(), key.data(), key.size(),
+       reinterpret_cast<const unsigned char*>(data), size,
+       digest, &digest_len);
+}
+
+static std::string HMAC_SHA256(const std::string& key,
+                               const std::string& value) {
+  unsigned char digest[kSHA256Size];
+  HMAC_SHA256(key, value.data(), value.size(), digest);
+  return std::string(reinterpret_cast<char*>(digest), kSHA256Size);
+}
+
+static void AppendHex(const unsigned char* data, size_t size,
+                      std::string* output) {
+  static const char kHexDigits[] = "0123456789abcdef";
+  for (size_t i = 0; i < size; i++) {
+    output->push_back(kHexDigits[data[i] >> 4]);
+    output->push_back(kHexDigits[data[i] & 0x0f]);
+  }
+}
+
+// Trim the spaces of str[*begin, *end)
+static void TrimRange(const std::string& str, size_t* begin, size_t* end) {
+  while (*begin < *end && isspace(str[*begin])) {
+    (*begin)++;
+  }
+  while (*end > *begin && isspace(str[*end - 1])) {
+    (*end)--;
+  }
+}
+
+static bool ParseDigits(const char* p, int n, int* value) {
+  *value = 0;
+  for (int i = 0; i < n; i++) {
+    if (p[i] < '0' || p[i] > '9') {
+      return false;
+    }
+    *value = *value * 10 + (p[i] - '0');
+  }
+  return true;
+}
+
+// Days since 1970-01-01 of the proleptic Gregorian date
+static int64_t DaysFromCivil(int y, int m, int d) {
+  y -= m <= 2;
+  int64_t era = (y >= 0 ? y : y - 399) / 400;
+  int64_t yoe = y - era * 400;
+  int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+static int64_t to_timestamp(const std::string& iso_date) {
+  // e.g. 20170328T093456Z iso_date, 0 if malformed
+  const char* p = iso_date.data();
+  int Y, m, d, H, M, S;
+  if (iso_date.size() != 16 || p[8] != 'T' || p[15] != 'Z' ||
+      !ParseDigits(p, 4, &Y) || !ParseDigits(p + 4, 2, &m) ||
+      !ParseDigits(p + 6, 2, &d) || !ParseDigits(p + 9, 2, &H) ||
+      !ParseDigits(p + 11, 2, &M) || !ParseDigits(p + 13, 2, &S) ||
+      m < 1 || m > 12 || d < 1 || d > 31 || H > 23 || M > 59 || S > 60) {
+    return 0;
+  }
+  return DaysFromCivil(Y, m, d) * 86400 + H * 3600 + M * 60 + S;
+}
+
+static int64_t now_timestamp() {
+  return time(nullptr);
+}
+
 S3AuthV4::S3AuthV4() {
   rep_ = new Rep();
 }
@@ -53,42 +160,46 @@ S3AuthV4::~S3AuthV4() {
   delete rep_;
 }
 
-void S3AuthV4::Initialize(const pink::HTTPRequest* req, zgwstore::ZgwStore* store) {
+void S3AuthV4::Initialize(
+    const std::string& method, const std::string& path,
+    const std::map<std::string, std::string>& headers,
+    const std::map<std::string, std::string>& query_params) {
   rep_->Clear();
-  if (!rep_->ParseHeaderAuthStr(req->headers()) &&
-      !rep_->ParseQueryAuthStr(req->query_params())) {
+  if (!rep_->ParseHeaderAuthStr(headers) &&
+      !rep_->ParseQueryAuthStr(query_params)) {
     return;
   }
   // Task 1: Create a Canonical Request
-  rep_->CreateCanonicalRequest(req);
+  rep_->CreateCanonicalRequest(method, path, headers, query_params);
+  unsigned char digest[kSHA256Size];
+  SHA256(reinterpret_cast<const unsigned char*>(rep_->canonical_request_.data()),
+         rep_->canonical_request_.size(), digest);
+  AppendHex(digest, kSHA256Size, &rep_->canonical_request_hash_);
+  if (rep_->LookupPresigned(method)) {
+    return;
+  }
   // Get secret key
   assert(!rep_->access_key_.empty());
 
-  if (slash::NowMicros() - latest_update_time > kFiveMinutesUs) {
-    key_map.clear();
-  }
-  std::string secret_key;
-  int retry = 2;
-  while (retry--) {
-    if (key_map.count(rep_->access_key_)) {
-      rep_->user_name_.assign(key_map.at(rep_->access_key_).first);
-      secret_key.assign(key_map.at(rep_->access_key_).second);
-      break;
-    }
-    if (!key_map.empty() &&
-        rep_->access_key_ == last_access_key) {
-      if (slash::NowMicros() - latest_update_time > kFiveMinutesUs) {
-        last_access_key.clear();
-      }
-      // Repeated invalid key
-      return;
-    }
-    rep_->UpdateKeyMap(store);
-    last_access_key = rep_->access_key_;
+  // Credentials are refreshed in background, never wait for the store here
+  uint64_t credential_version = g_zgw_credential_cache->version();
+  rep_->access_key_found_ = g_zgw_credential_cache->Lookup(rep_->access_key_,
+                                                           &rep_->user_name_,
+                                                           &rep_->secret_key_);
+  if (!rep_->access_key_found_) {
+    return;
   }
 
   // Task 2-3
-  rep_->CalcSignature(secret_key);
+  rep_->CalcSignature();
+
+  if (rep_->is_presign_url_ && (method == "GET" || method == "HEAD") &&
+      rep_->signature_ == rep_->signature_received_) {
+    rep_->presigned_entry_.user_name.assign(rep_->user_name_);
+    rep_->presigned_entry_.expire_time = rep_->presign_expire_time_;
+    rep_->presigned_entry_.credential_version = credential_version;
+    presigned_cache.Insert(rep_->cache_key_, rep_->presigned_entry_);
+  }
 }
 
 std::string S3AuthV4::ToString() {
@@ -101,7 +212,7 @@ AuthErrorType S3AuthV4::TryAuth() {
   if (rep_->encryption_method_.find("AWS4-HMAC-SHA256") ==
       std::string::npos) {
     return kMaybeAuthV2;
-  } else if (!key_map.count(rep_->access_key_)) {
+  } else if (!rep_->access_key_found_) {
     return kAccessKeyInvalid;
   } else if (rep_->signature_ != rep_->signature_received_) {
     return kSignatureNotMatch;
@@ -113,118 +224,154 @@ std::string S3AuthV4::user_name() {
   return rep_->user_name_;
 }
 
-void S3AuthV4::Rep::UpdateKeyMap(zgwstore::ZgwStore* store) {
-  std::vector<zgwstore::User> all_users;
-  slash::Status s = store->ListUsers(&all_users);
-  if (s.ok()) {
-    for (auto& user : all_users) {
-      for (auto& key_pair : user.key_pairs) {
-        key_map.insert(std::make_pair(key_pair.first,
-                       std::make_pair(user.display_name, key_pair.second)));
-      }
-    }
-    latest_update_time = slash::NowMicros();
-  }
+void S3AuthV4::GetChunkSigner(std::string* signing_key,
+                              std::string* string_to_sign_prefix,
+                              std::string* seed_signature) {
+  signing_key->assign(rep_->signing_key_);
+  string_to_sign_prefix->assign("AWS4-HMAC-SHA256-PAYLOAD\n" +
+                                rep_->iso_date_ + "\n" + rep_->date_ + "/" +
+                                rep_->region_ + "/s3/aws4_request\n");
+  seed_signature->assign(rep_->signature_);
 }
 
 void S3AuthV4::Rep::Clear() {
+  // clear() keeps the capacity for the next request
   user_name_.clear();
   access_key_.clear();
+  access_key_found_ = false;
   is_presign_url_ = false;
+  presign_expire_time_ = 0;
   encryption_method_.clear();
   date_.clear();
   iso_date_.clear();
   region_.clear();
-  signed_headers_.clear();
   signed_headers_str_.clear();
   signature_.clear();
   signature_received_.clear();
-  access_key_.clear();
+  signing_key_.clear();
   canonical_request_.clear();
+  canonical_request_hash_.clear();
+}
+
+bool S3AuthV4::Rep::LookupPresigned(const std::string& method) {
+  if (!is_presign_url_ || (method != "GET" && method != "HEAD")) {
+    return false;
+  }
+  cache_key_.assign(signature_received_);
+  cache_key_.append(canonical_request_hash_);
+  // Expired entries are evicted by new ones, the expiry of the URL itself
+  // was checked while parsing
+  if (!presigned_cache.Lookup(cache_key_, &presigned_entry_) ||
+      presigned_entry_.expire_time != presign_expire_time_ ||
+      presigned_entry_.credential_version !=
+      g_zgw_credential_cache->version()) {
+    return false;
+  }
+  access_key_found_ = true;
+  user_name_.assign(presigned_entry_.user_name);
+  signature_.assign(signature_received_);
+  return true;
 }
 
-void S3AuthV4::Rep::CalcSignature(const std::string& secret_key) {
+void S3AuthV4::Rep::CalcSignature() {
   // Task 2: Create a String to Sign
-  std::string string_to_sign;
-  string_to_sign.append(encryption_method_ + "\n");
-  string_to_sign.append(iso_date_ + "\n");
-  string_to_sign.append(date_ + "/" + region_ + "/s3/aws4_request\n");
-  string_to_sign.append(slash::sha256(canonical_request_));
+  string_to_sign_.assign(encryption_method_);
+  string_to_sign_.push_back('\n');
+  string_to_sign_.append(iso_date_);
+  string_to_sign_.push_back('\n');
+  string_to_sign_.append(date_);
+  string_to_sign_.push_back('/');
+  string_to_sign_.append(region_);
+  string_to_sign_.append("/s3/aws4_request\n");
+  string_to_sign_.append(canonical_request_hash_);
+
   // Task 3: Calculate Signature
-  std::string date_key = HMAC_SHA256("AWS4" + secret_key, date_);
-  std::string date_region_key = HMAC_SHA256(date_key, region_);
-  std::string date_region_service_key = HMAC_SHA256(date_region_key, "s3");
-  std::string signing_key = HMAC_SHA256(date_region_service_key, "aws4_request");
+  scratch_.assign(access_key_);
+  scratch_.push_back('/');
+  scratch_.append(date_);
+  scratch_.push_back('/');
+  scratch_.append(region_);
+  if (!signing_key_cache.Lookup(scratch_, &signing_entry_) ||
+      signing_entry_.secret_key != secret_key_) {
+    std::string date_key = HMAC_SHA256("AWS4" + secret_key_, date_);
+    std::string date_region_key = HMAC_SHA256(date_key, region_);
+    std::string date_region_service_key = HMAC_SHA256(date_region_key, "s3");
+    signing_entry_.secret_key = secret_key_;
+    signing_entry_.signing_key = HMAC_SHA256(date_region_service_key,
+                                             "aws4_request");
+    signing_key_cache.Insert(scratch_, signing_entry_);
+  }
 
-  signature_ = HMAC_SHA256(signing_key, string_to_sign, false);
+  signing_key_.assign(signing_entry_.signing_key);
+  unsigned char digest[kSHA256Size];
+  HMAC_SHA256(signing_key_, string_to_sign_.data(), string_to_sign_.size(),
+              digest);
+  AppendHex(digest, kSHA256Size, &signature_);
 }
 
-bool S3AuthV4::Rep::ParseCredential(const std::string& credential_str) {
+bool S3AuthV4::Rep::ParseCredential(const std::string& str,
+                                    size_t begin, size_t end) {
   // tC22yNVe9FJ9S0vs5OYx/20170306/us-east-1/s3/aws4_request
-  std::vector<std::string> items;
-  slash::StringSplit(credential_str, '/', items);
-  if (items.size() != 5) {
+  size_t pos[4];
+  size_t start = begin;
+  for (int i = 0; i < 4; i++) {
+    pos[i] = str.find('/', start);
+    if (pos[i] == std::string::npos || pos[i] >= end || pos[i] == start) {
+      return false;
+    }
+    start = pos[i] + 1;
+  }
+  size_t last = str.find('/', start);
+  if (start >= end || (last != std::string::npos && last < end)) {
     return false;
   }
 
-  access_key_ = items[0];
-  date_ = items[1];
-  region_ = items[2];
+  access_key_.assign(str, begin, pos[0] - begin);
+  date_.assign(str, pos[0] + 1, pos[1] - pos[0] - 1);
+  region_.assign(str, pos[1] + 1, pos[2] - pos[1] - 1);
   return true;
 }
 
-static int to_timestamp(std::string& iso_date) {
-  // e.g. 20170328T093456Z iso_date
-  int Y, m, d, H, M, S, ret;
-  ret = sscanf(iso_date.c_str(), "%4d%2d%2dT%2d%2d%2dZ",
-         &Y, &m, &d, &H, &M, &S);
-  if (ret != 6) {
-    return 0;
-  }
-  char buf[100];
-  sprintf(buf, "%d/%d/%d/%d/%d/%d", Y, m, d, H, M, S);
-  struct tm _t;
-  strptime(buf, "%Y/%m/%d/%H/%M/%S", &_t);
-  return mktime(&_t);
-}
-
-static int now_timestamp() {
-  time_t t = time(nullptr);
-  return mktime(gmtime(&t));
-}
-
 bool S3AuthV4::Rep::ParseQueryAuthStr(const std::map<std::string,
                                       std::string>& query_params) {
-  if (!query_params.count("X-Amz-Algorithm") ||
-      !query_params.count("X-Amz-Credential") ||
-      !query_params.count("X-Amz-Date") ||
-      !query_params.count("X-Amz-Expires") ||
-      !query_params.count("X-Amz-Signature") ||
-      !query_params.count("X-Amz-SignedHeaders")) {
+  // Values were url decoded
+  auto algorithm = query_params.find("X-Amz-Algorithm");
+  auto credential = query_params.find("X-Amz-Credential");
+  auto date = query_params.find("X-Amz-Date");
+  auto expires = query_params.find("X-Amz-Expires");
+  auto signature = query_params.find("X-Amz-Signature");
+  auto signed_headers = query_params.find("X-Amz-SignedHeaders");
+  if (algorithm == query_params.end() ||
+      credential == query_params.end() ||
+      date == query_params.end() ||
+      expires == query_params.end() ||
+      signature == query_params.end() ||
+      signed_headers == query_params.end()) {
     return false;
   }
 
   // Check Expires
-  iso_date_ = UrlDecode(query_params.at("X-Amz-Date"));
-  int expires = std::atoi(query_params.at("X-Amz-Expires").c_str());
-  int elapse = now_timestamp() - to_timestamp(iso_date_);
-  if (expires < 1 || expires > 604800 /* maximum 7 days */ ||
-      elapse >= expires /* Expire */) {
+  iso_date_.assign(date->second);
+  int64_t expires_sec = std::atoi(expires->second.c_str());
+  int64_t sign_time = to_timestamp(iso_date_);
+  int64_t elapse = now_timestamp() - sign_time;
+  if (expires_sec < 1 || expires_sec > 604800 /* maximum 7 days */ ||
+      elapse >= expires_sec /* Expire */) {
     return false;
   }
+  presign_expire_time_ = sign_time + expires_sec;
 
   // AWS4-HMAC-SHA256
-  encryption_method_ = UrlDecode(query_params.at("X-Amz-Algorithm"));
+  encryption_method_.assign(algorithm->second);
   // Credential=tC22yNVe9FJ9S0vs5OYx/20170306/us-east-1/s3/aws4_request
-  if (!ParseCredential(UrlDecode(query_params.at("X-Amz-Credential")))) {
+  if (!ParseCredential(credential->second, 0, credential->second.size())) {
     return false;
   }
 
   // SignedHeaders=content-type;host;x-amz-content-sha256;x-amz-date
-  signed_headers_str_ = UrlDecode(query_params.at("X-Amz-SignedHeaders"));
-  slash::StringSplit(signed_headers_str_, ';', signed_headers_);
+  signed_headers_str_.assign(signed_headers->second);
 
-  signature_received_ = UrlDecode(query_params.at("X-Amz-Signature"));
+  signature_received_.assign(signature->second);
 
   is_presign_url_ = true;
   return true;
@@ -234,111 +381,132 @@ bool S3AuthV4::Rep::ParseHeaderAuthStr(const std::map<std::string, std::string>&
   /* e.g.
    *Authorization: AWS4-HMAC-SHA256 Credential=tC22yNVe9FJ9S0vs5OYx/20170306/us-east-1/s3/aws4_request, SignedHeaders=content-type;host;x-amz-content-sha256;x-amz-date, Signature=08e2daeba9b8bb552dc584559302f304684dcd31b058534675aa57d911be17ce
    */
-  if (!headers.count("authorization") ||
-      !headers.count("x-amz-date")) {
+  auto authorization = headers.find("authorization");
+  auto date = headers.find("x-amz-date");
+  if (authorization == headers.end() ||
+      date == headers.end()) {
     return false;
   }
 
-  std::vector<std::string> items, items1;
-  slash::StringSplit(headers.at("authorization"), ',', items);
-  if (items.size() != 3) {
+  const std::string& auth_str = authorization->second;
+  size_t comma1 = auth_str.find(',');
+  if (comma1 == std::string::npos) {
+    return false;
+  }
+  size_t comma2 = auth_str.find(',', comma1 + 1);
+  if (comma2 == std::string::npos ||
+      auth_str.find(',', comma2 + 1) != std::string::npos) {
     return false;
   }
 
-  slash::StringSplit(items[0], ' ', items1);
-  if (items1.size() != 2) {
+  size_t begin = 0, end = comma1;
+  TrimRange(auth_str, &begin, &end);
+  size_t space = auth_str.find(' ', begin);
+  if (space == std::string::npos || space >= end) {
     return false;
   }
   // AWS4-HMAC-SHA256
-  encryption_method_ = items1[0];
+  encryption_method_.assign(auth_str, begin, space - begin);
   // Credential=tC22yNVe9FJ9S0vs5OYx/20170306/us-east-1/s3/aws4_request
-  size_t head_len = strlen("Credential=");
-  if (items1[1].size() < head_len ||
-      !ParseCredential(items1[1].substr(head_len))) {
+  static const size_t kCredentialLen = strlen("Credential=");
+  begin = space;
+  TrimRange(auth_str, &begin, &end);
+  if (auth_str.compare(begin, kCredentialLen, "Credential=") != 0 ||
+      !ParseCredential(auth_str, begin + kCredentialLen, end)) {
     return false;
   }
 
   // SignedHeaders=content-type;host;x-amz-content-sha256;x-amz-date
-  std::string signedheaders = slash::StringTrim(items[1]);
-  head_len = strlen("SignedHeaders=");
-  if (signedheaders.size() < head_len) {
+  static const size_t kSignedHeadersLen = strlen("SignedHeaders=");
+  begin = comma1 + 1;
+  end = comma2;
+  TrimRange(auth_str, &begin, &end);
+  if (auth_str.compare(begin, kSignedHeadersLen, "SignedHeaders=") != 0) {
     return false;
   }
-  signed_headers_str_ = signedheaders.substr(head_len);
-  slash::StringSplit(signed_headers_str_, ';', signed_headers_);
-  
+  signed_headers_str_.assign(auth_str, begin + kSignedHeadersLen,
+                             end - begin - kSignedHeadersLen);
+
   // Signature=08e2daeba9b8bb552dc584559302f304684dcd31b058534675aa57d911be17ce
-  std::string signature = slash::StringTrim(items[2]);
-  if (signature.size() != 74) { // 10 + 64;
+  begin = comma2 + 1;
+  end = auth_str.size();
+  TrimRange(auth_str, &begin, &end);
+  if (end - begin != 74 || // 10 + 64;
+      auth_str.compare(begin, 10, "Signature=") != 0) {
     return false;
   }
-  signature_received_ = signature.substr(10, 64);
+  signature_received_.assign(auth_str, begin + 10, 64);
 
   // 20170328T093456Z
-  iso_date_ = headers.at("x-amz-date");
+  iso_date_.assign(date->second);
 
   is_presign_url_ = false;
   return true;
 }
 
-std::string HMAC_SHA256(const std::string key, const std::string value, bool raw) {
-  static unsigned int digest_len = 32;
-  unsigned char digest[digest_len];
-
-  HMAC_CTX ctx;
-  HMAC_CTX_init(&ctx);
-
-  HMAC_Init_ex(&ctx, key.data(), key.size(), EVP_sha256(), NULL);
-  HMAC_Update(&ctx, (unsigned char*)value.data(), value.size());
-  HMAC_Final(&ctx, digest, &digest_len);
-  HMAC_CTX_cleanup(&ctx);
-
-  std::string res;
-  if (raw) {
-    for (unsigned int i = 0; i < digest_len; ++i) {
-      res.append(1, digest[i]);
-    }
-    return res;
-  }
-
-  // Hex
-  char buf[65] = {0};
-  for (unsigned int i = 0; i < digest_len; ++i) {
-    sprintf(buf + i * 2, "%02x", (unsigned int)digest[i]);
-  }
-  return std::string(buf);
-}
-
-void S3AuthV4::Rep::CreateCanonicalRequest(const pink::HTTPRequest *req) {
+void S3AuthV4::Rep::CreateCanonicalRequest(
+    const std::string& method, const std::string& path,
+    const std::map<std::string, std::string>& headers,
+    const std::map<std::string, std::string>& query_params) {
   canonical_request_.clear();
   // <HTTPMethod>\n
-  canonical_request_.append(req->method()+ "\n");
+  canonical_request_.append(method);
+  canonical_request_.push_back('\n');
   // <CanonicalURI>\n
-  std::string ori_path = UrlDecode(req->path());
-  canonical_request_.append(UrlEncode(ori_path) + "\n");
+  scratch_.clear();
+  UrlDecodeTo(path.data(), path.size(), &scratch_);
+  UrlEncodeTo(scratch_.data(), scratch_.size(), &canonical_request_);
+  canonical_request_.push_back('\n');
   // <CanonicalQueryString>\n
-  for (auto &q : req->query_params()) {
+  bool first_param = true;
+  for (auto &q : query_params) {
     if (q.first.compare("X-Amz-Signature") == 0) {
       continue;
     }
-    canonical_request_.append(UrlEncode(UrlDecode(q.first), true) + "=" + UrlEncode(UrlDecode(q.second), true) + "&");
-  }
-  if (!canonical_request_.empty() && canonical_request_.back() == '&') {
-    canonical_request_.pop_back(); // delete last '&'
+    if (!first_param) {
+      canonical_request_.push_back('&');
+    }
+    first_param = false;
+    scratch_.clear();
+    UrlDecodeTo(q.first.data(), q.first.size(), &scratch_);
+    UrlEncodeTo(scratch_.data(), scratch_.size(), &canonical_request_, true);
+    canonical_request_.push_back('=');
+    // Value was url decoded
+    UrlEncodeTo(q.second.data(), q.second.size(), &canonical_request_, true);
   }
-  canonical_request_.append("\n");
+  canonical_request_.push_back('\n');
   // <CanonicalHeaders>\n
-  for (auto &q : signed_headers_) {
-    if (req->headers().count(q)) {
-      canonical_request_.append(slash::StringToLower(q) + ":" + req->headers().at(q) + "\n");
+  size_t begin = 0;
+  while (begin < signed_headers_str_.size()) {
+    size_t end = signed_headers_str_.find(';', begin);
+    if (end == std::string::npos) {
+      end = signed_headers_str_.size();
     }
+    if (end > begin) {
+      scratch_.assign(signed_headers_str_, begin, end - begin);
+      for (auto& c : scratch_) {
+        c = tolower(c);
+      }
+      auto iter = headers.find(scratch_);
+      if (iter != headers.end()) {
+        canonical_request_.append(scratch_);
+        canonical_request_.push_back(':');
+        canonical_request_.append(iter->second);
+        canonical_request_.push_back('\n');
+      }
+    }
+    begin = end + 1;
   }
-  canonical_request_.append("\n");
-  
-  std::string content_sha265;
-  if (req->headers().count("x-amz-content-sha256")) {
-    content_sha265.assign(req->headers().at("x-amz-content-sha256"));
+  canonical_request_.push_back('\n');
+
+  canonical_request_.append(signed_headers_str_);
+  canonical_request_.push_back('\n');
+  if (is_presign_url_) {
+    canonical_request_.append("UNSIGNED-PAYLOAD");
+  } else {
+    auto iter = headers.find("x-amz-content-sha256");
+    if (iter != headers.end()) {
+      canonical_request_.append(iter->second);
+    }
   }
-  canonical_request_.append(signed_headers_str_ + "\n");
-  canonical_request_.append(is_presign_url_ ? "UNSIGNED-PAYLOAD" : content_sha265);
 }
@@ -2,6 +2,7 @@
 #define ZGW_S3_AUTHV4_H
 
 #include <iostream>
+#include <map>
 #include <string>
 
 #include "pink/include/http_conn.h"
@@ -16,10 +17,21 @@ enum AuthErrorType {
 
 class S3AuthV4 {
  public:
-  void Initialize(const pink::HTTPRequest* req, zgwstore::ZgwStore* store);
+  S3AuthV4();
+  ~S3AuthV4();
+
+  // query_params are url decoded values as S3Cmd keeps them
+  void Initialize(const std::string& method, const std::string& path,
+                  const std::map<std::string, std::string>& headers,
+                  const std::map<std::string, std::string>& query_params);
 
   AuthErrorType TryAuth();
   std::string user_name();
+  // Chunk signatures of STREAMING-AWS4-HMAC-SHA256-PAYLOAD are chained
+  // from the signature of the request, valid after kAuthSuccess
+  void GetChunkSigner(std::string* signing_key,
+                      std::string* string_to_sign_prefix,
+                      std::string* seed_signature);
 
   std::string ToString();
 
@@ -29,9 +41,6 @@ class S3AuthV4 {
   struct Rep;
   Rep* rep_;
 
-  S3AuthV4();
-  ~S3AuthV4();
-
   // No copying allowed
   S3AuthV4(const S3AuthV4&);
   S3AuthV4& operator=(const S3AuthV4&);
@@ -4,6 +4,7 @@
 #include "src/s3_cmds/zgw_s3_command.h"
 
 #include "slash/include/slash_status.h"
+#include "src/s3_cmds/zgw_s3_xml.h"
 #include "src/zgwstore/zgw_define.h"
 #include "src/zgw_monitor.h"
 
@@ -40,6 +41,7 @@ class ListObjectsCmd : public S3Cmd {
  private:
   bool SanitizeParams(std::string* invalid_param);
   void GenerateRespXml();
+  bool WriteRespXml(size_t part, S3XmlWriter* writer);
 
   // Common
   std::string delimiter_;
@@ -54,6 +56,15 @@ class ListObjectsCmd : public S3Cmd {
   std::string marker_;
 
   std::vector<std::string> all_objects_name_;
+
+  // Selected entries, written as the response body is sent
+  std::vector<zgwstore::Object> candidate_objects_;
+  std::vector<std::string> commonprefixes_;
+  std::string next_token_;
+  std::string next_marker_;
+  size_t key_count_;
+  bool is_trucated_;
+  S3XmlStream xml_stream_;
 };
 
 class ListMultiPartUploadCmd : public S3Cmd {
@@ -68,6 +79,7 @@ class ListMultiPartUploadCmd : public S3Cmd {
 
  private:
   void GenerateRespXml();
+  bool WriteRespXml(size_t part, S3XmlWriter* writer);
   bool SanitizeParams(std::string* invalid_param);
 
   std::string delimiter_;
@@ -83,6 +95,13 @@ class ListMultiPartUploadCmd : public S3Cmd {
   };
 
   std::set<zgwstore::Bucket, BucketsComparator> all_virtual_bks_;
+
+  // Selected entries, written as the response body is sent
+  std::vector<zgwstore::Bucket> candidate_buckets_;
+  std::string next_key_marker_;
+  std::string next_upload_id_;
+  bool is_trucated_;
+  S3XmlStream xml_stream_;
 };
 
 class PutBucketCmd : public S3Cmd {
@@ -57,65 +57,90 @@ class UnImplementCmd : public S3Cmd {
   };
 };
 
-void InitCmdTable(S3CmdTable* cmd_table) {
-  cmd_table->insert(
-    std::make_pair(kListAllBuckets, new ListAllBucketsCmd(kFlagsRead)));
-  cmd_table->insert(
-    std::make_pair(kDeleteBucket, new DeleteBucketCmd(kFlagsWrite)));
-  cmd_table->insert(
-    std::make_pair(kListObjects, new ListObjectsCmd(kFlagsRead)));
-  cmd_table->insert(
-    std::make_pair(kGetBucketLocation, new GetBucketLocationCmd(kFlagsRead)));
-  cmd_table->insert(
-    std::make_pair(kHeadBucket, new HeadBucketCmd(kFlagsRead)));
-  cmd_table->insert(
-    std::make_pair(kListMultiPartUpload, new ListMultiPartUploadCmd(kFlagsRead)));
-  cmd_table->insert(
-    std::make_pair(kPutBucket, new PutBucketCmd(kFlagsWrite)));
-  cmd_table->insert(
-    std::make_pair(kDeleteObject, new DeleteObjectCmd(kFlagsWrite)));
-  cmd_table->insert(
-    std::make_pair(kDeleteMultiObjects, new DeleteMultiObjectsCmd(kFlagsWrite)));
-  cmd_table->insert(
-    std::make_pair(kGetObject, new GetObjectCmd(kFlagsRead)));
-  cmd_table->insert(
-    std::make_pair(kHeadObject, new HeadObjectCmd(kFlagsRead)));
-  cmd_table->insert(
-    std::make_pair(kPostObject, new PostObjectCmd(kFlagsWrite)));
-  cmd_table->insert(
-    std::make_pair(kPutObject, new PutObjectCmd(kFlagsWrite)));
-  cmd_table->insert(
-    std::make_pair(kPutObjectCopy, new PutObjectCopyCmd(kFlagsWrite)));
-  cmd_table->insert(
-    std::make_pair(kInitMultipartUpload, new InitMultipartUploadCmd(kFlagsWrite)));
-  cmd_table->insert(
-    std::make_pair(kUploadPart, new UploadPartCmd(kFlagsWrite)));
-  cmd_table->insert(
-    std::make_pair(kUploadPartCopy, new UploadPartCopyCmd(kFlagsWrite)));
-  cmd_table->insert(
-    std::make_pair(kUploadPartCopyPartial, new UploadPartCopyPartialCmd(kFlagsWrite)));
-  cmd_table->insert(
-    std::make_pair(kCompleteMultiUpload, new CompleteMultiUploadCmd(kFlagsWrite)));
-  cmd_table->insert(
-    std::make_pair(kAbortMultiUpload, new AbortMultiUploadCmd(kFlagsWrite)));
-  cmd_table->insert(
-    std::make_pair(kListParts, new ListPartsCmd(kFlagsRead)));
-  cmd_table->insert(
-    std::make_pair(kUnImplement, new UnImplementCmd(kFlagsRead)));
-  cmd_table->insert(
-    std::make_pair(kZgwTest, new ZgwTestCmd(kFlagsRead | kFlagsWrite)));
+S3Cmd* NewS3Cmd(S3Commands cmd) {
+  switch (cmd) {
+    case kListAllBuckets:
+      return new ListAllBucketsCmd(kFlagsRead);
+    case kDeleteBucket:
+      return new DeleteBucketCmd(kFlagsWrite);
+    case kListObjects:
+      return new ListObjectsCmd(kFlagsRead);
+    case kGetBucketLocation:
+      return new GetBucketLocationCmd(kFlagsRead);
+    case kHeadBucket:
+      return new HeadBucketCmd(kFlagsRead);
+    case kListMultiPartUpload:
+      return new ListMultiPartUploadCmd(kFlagsRead);
+    case kPutBucket:
+      return new PutBucketCmd(kFlagsWrite);
+    case kDeleteObject:
+      return new DeleteObjectCmd(kFlagsWrite);
+    case kDeleteMultiObjects:
+      return new DeleteMultiObjectsCmd(kFlagsWrite);
+    case kGetObject:
+      return new GetObjectCmd(kFlagsRead);
+    case kHeadObject:
+      return new HeadObjectCmd(kFlagsRead);
+    case kPostObject:
+      return new PostObjectCmd(kFlagsWrite);
+    case kPutObject:
+      return new PutObjectCmd(kFlagsWrite);
+    case kPutObjectCopy:
+      return new PutObjectCopyCmd(kFlagsWrite);
+    case kInitMultipartUpload:
+      return new InitMultipartUploadCmd(kFlagsWrite);
+    case kUploadPart:
+      return new UploadPartCmd(kFlagsWrite);
+    case kUploadPartCopy:
+      return new UploadPartCopyCmd(kFlagsWrite);
+    case kUploadPartCopyPartial:
+      return new UploadPartCopyPartialCmd(kFlagsWrite);
+    case kCompleteMultiUpload:
+      return new CompleteMultiUploadCmd(kFlagsWrite);
+    case kAbortMultiUpload:
+      return new AbortMultiUploadCmd(kFlagsWrite);
+    case kListParts:
+      return new ListPartsCmd(kFlagsRead);
+    case kUnImplement:
+      return new UnImplementCmd(kFlagsRead);
+    case kZgwTest:
+      return new ZgwTestCmd(kFlagsRead | kFlagsWrite);
+    default:
+      return new UnImplementCmd(kFlagsRead);
+  }
+}
+
+S3CmdPool::~S3CmdPool() {
+  for (auto& item : free_cmds_) {
+    for (auto cmd_ptr : item.second) {
+      delete cmd_ptr;
+    }
+  }
 }
 
-void DestroyCmdTable(S3CmdTable* cmd_table) {
-  for (auto& cmd : *cmd_table) {
-    delete cmd.second;
+S3Cmd* S3CmdPool::Get(S3Commands cmd) {
+  std::vector<S3Cmd*>& free_cmds = free_cmds_[cmd];
+  if (free_cmds.empty()) {
+    return NewS3Cmd(cmd);
   }
+  S3Cmd* cmd_ptr = free_cmds.back();
+  free_cmds.pop_back();
+  return cmd_ptr;
+}
+
+void S3CmdPool::Put(S3Commands cmd, S3Cmd* cmd_ptr) {
+  std::vector<S3Cmd*>& free_cmds = free_cmds_[cmd];
+  if (free_cmds.size() >= kMaxIdleCmds) {
+    delete cmd_ptr;
+    return;
+  }
+  free_cmds.push_back(cmd_ptr);
 }
 
 bool S3Cmd::TryAuth() {
   if (flags() == kFlagsRead &&
       !bucket_name_.empty() &&
-      req_headers_.count("authorization") == 0 &&
+      !req_headers_.Has(kHdrAuthorization) &&
       query_params_.count("X-Amz-Signature") == 0) {
     zgwstore::Bucket bkt;
     std::string unuseful_name;
@@ -156,9 +181,10 @@ void S3Cmd::Clear() {
   user_name_.clear();
   bucket_name_.clear();
   object_name_.clear();
-  req_headers_.clear();
-  query_params_.clear();
+  req_headers_.Reset(nullptr);
+  query_params_.Reset(nullptr);
   store_ = nullptr;
+  buffer_cache_ = nullptr;
 
   http_ret_code_ = 200;
   http_request_xml_.clear();
@@ -177,6 +203,23 @@ void S3Cmd::GenerateErrorXml(S3ErrorType type, const std::string& message) {
       doc.AppendToRoot(doc.AllocateNode("Code", "AccessDenied"));
       doc.AppendToRoot(doc.AllocateNode("Message", "Access Denied"));
       break;
+    case kIncompleteBody:
+      doc.AppendToRoot(doc.AllocateNode("Code", "IncompleteBody"));
+      doc.AppendToRoot(doc.AllocateNode("Message", "You did not provide the "
+                                        "number of bytes specified by the "
+                                        "Content-Length HTTP header."));
+      break;
+    case kXAmzContentSHA256Mismatch:
+      doc.AppendToRoot(doc.AllocateNode("Code", "XAmzContentSHA256Mismatch"));
+      doc.AppendToRoot(doc.AllocateNode("Message", "The provided "
+                                        "'x-amz-content-sha256' header does not "
+                                        "match what was computed."));
+      break;
+    case kSlowDown:
+      doc.AppendToRoot(doc.AllocateNode("Code", "SlowDown"));
+      doc.AppendToRoot(doc.AllocateNode("Message", "Please reduce your "
+                                        "request rate."));
+      break;
     case kInvalidRange:
       doc.AppendToRoot(doc.AllocateNode("Code", "InvalidRange"));
       doc.AppendToRoot(doc.AllocateNode("ObjectName", message));
@@ -2,11 +2,14 @@
 #define ZGW_S3_COMMAND_H
 
 #include <map>
+#include <vector>
 
 #include "pink/include/http_conn.h"
 #include "src/zgwstore/zgw_store.h"
 #include "src/s3_cmds/zgw_s3_authv4.h"
+#include "src/s3_cmds/zgw_s3_request.h"
 #include "src/zgw_utils.h"
+#include "src/zgw_buffer_pool.h"
 
 enum S3Commands {
   kListAllBuckets = 0,
@@ -57,19 +60,41 @@ enum S3ErrorType {
   kInvalidRange,
   kInvalidRequest,
   kAccessDenied,
+  kIncompleteBody,
+  kXAmzContentSHA256Mismatch,
+  kSlowDown,
 };
 
 class S3Cmd;
 
-typedef std::map<S3Commands, S3Cmd*> S3CmdTable;
+extern S3Cmd* NewS3Cmd(S3Commands cmd);
 
-extern void InitCmdTable(S3CmdTable* cmd_table);
-extern void DestroyCmdTable(S3CmdTable* cmd_table);
+// Idle command objects of a worker thread, a connection takes one for
+// each request and puts it back when done, not thread safe
+class S3CmdPool {
+ public:
+  S3CmdPool() {}
+  ~S3CmdPool();
+
+  S3Cmd* Get(S3Commands cmd);
+  void Put(S3Commands cmd, S3Cmd* cmd_ptr);
+
+ private:
+  // Idle objects kept for each command
+  static const size_t kMaxIdleCmds = 16;
+
+  std::map<S3Commands, std::vector<S3Cmd*>> free_cmds_;
+
+  // No copying allowed
+  S3CmdPool(const S3CmdPool&);
+  S3CmdPool& operator=(const S3CmdPool&);
+};
 
 class S3Cmd {
  public:
   S3Cmd(int flags)
     : store_(nullptr),
+      buffer_cache_(nullptr),
       http_ret_code_(200),
       s3_cmd_flags_(flags) {
   }
@@ -92,13 +117,12 @@ class S3Cmd {
   virtual void DoConnClosed() {
   }
 
-  void SetReqHeaders(const std::map<std::string, std::string>& req_headers) {
+  // Borrowed from the connection, query values are url decoded
+  void SetReqHeaders(const S3ReqHeaders& req_headers) {
     req_headers_ = req_headers;
   }
-  void SetQueryParams(const std::map<std::string, std::string>& query_params) {
-    for (auto& item : query_params) {
-      query_params_.insert(std::make_pair(item.first, UrlDecode(item.second)));
-    }
+  void SetQueryParams(const S3ParamView& query_params) {
+    query_params_ = query_params;
   }
   void SetBucketName(const std::string& bucket_name) {
     bucket_name_ = UrlDecode(bucket_name);
@@ -109,10 +133,18 @@ class S3Cmd {
   void SetStorePtr(zgwstore::ZgwStore* store) {
     store_ = store;
   }
+  void SetBufferCache(ZgwBufferCache* buffer_cache) {
+    buffer_cache_ = buffer_cache;
+  }
+  // Before DoInitial, so that error replies carry it too
+  void NewRequestId(RequestIdGenerator* id_gen) {
+    id_gen->Next(&request_id_);
+  }
   void InitS3Auth(const pink::HTTPRequest* req) {
     assert(store_ != nullptr);
     client_ip_port_.assign(req->client_ip_port());
-    s3_auth_.Initialize(req, store_);
+    s3_auth_.Initialize(req->method(), req->path(), req_headers_.map(),
+                        query_params_.map());
   }
   std::string request_id() {
     return request_id_;
@@ -128,9 +160,11 @@ class S3Cmd {
   std::string user_name_;
   std::string bucket_name_;
   std::string object_name_;
-  std::map<std::string, std::string> req_headers_;
-  std::map<std::string, std::string> query_params_;
+  S3ReqHeaders req_headers_;
+  S3ParamView query_params_;
   zgwstore::ZgwStore* store_;
+  // Block buffers of the worker thread
+  ZgwBufferCache* buffer_cache_;
 
   S3AuthV4 s3_auth_; // Authorize in DoInitial()
   std::string request_id_; // Specify command
@@ -12,10 +12,6 @@ bool CompleteMultiUploadCmd::DoInitial() {
   received_parts_info_.clear();
   upload_id_ = query_params_.at("uploadId");
   md5_ctx_.Init();
-  request_id_ = md5(bucket_name_ +
-                    object_name_ +
-                    upload_id_ + 
-                    std::to_string(slash::NowMicros()));
 
   if (!TryAuth()) {
     DLOG(INFO) << request_id_ << " " <<
@@ -133,6 +129,15 @@ void CompleteMultiUploadCmd::DoAndResponse(pink::HTTPResponse* resp) {
                 GenerateErrorXml(kInvalidPart);
                 break;
               }
+              if (stored_parts[i].codec != stored_parts[0].codec) {
+                // Bucket compression changed during the upload
+                LOG(WARNING) << request_id_ << " " <<
+                  "CompleteMultiUpload(DoAndResponse) - Part codec mismatch: " <<
+                  virtual_bucket << "/" << stored_parts[i].object_name;
+                http_ret_code_ = 400;
+                GenerateErrorXml(kInvalidPart);
+                break;
+              }
               md5_ctx_.Update(stored_parts[i].etag);
               data_size += stored_parts[i].size;
 
@@ -164,6 +169,8 @@ void CompleteMultiUploadCmd::DoAndResponse(pink::HTTPResponse* resp) {
         new_object_.owner = user_name_;
         new_object_.last_modified = slash::NowMicros();
         new_object_.storage_class = 0; // Unused
+        new_object_.codec = stored_parts.empty() ?
+          zgwstore::kObjectBlockRaw : stored_parts[0].codec;
         new_object_.acl = "FULL_CONTROL";
         new_object_.upload_id = upload_id_;
         new_object_.data_block = upload_id_ + bucket_name_ + "|" + object_name_;
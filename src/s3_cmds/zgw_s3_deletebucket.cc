@@ -6,8 +6,6 @@
 
 bool DeleteBucketCmd::DoInitial() {
   http_response_xml_.clear();
-  request_id_ = md5(bucket_name_ +
-                    std::to_string(slash::NowMicros()));
 
   if (!TryAuth()) {
     DLOG(INFO) << request_id_ << " " <<
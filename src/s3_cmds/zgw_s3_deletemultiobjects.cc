@@ -7,8 +7,6 @@
 bool DeleteMultiObjectsCmd::DoInitial() {
   http_request_xml_.clear();
   http_response_xml_.clear();
-  request_id_ = md5(bucket_name_ +
-                    std::to_string(slash::NowMicros()));
   if (!TryAuth()) {
     DLOG(INFO) << request_id_ << " " <<
       "DeleteMultiObjects(DoInitial) - Auth failed: " << client_ip_port_;
@@ -5,9 +5,6 @@
 
 bool DeleteObjectCmd::DoInitial() {
   http_response_xml_.clear();
-  request_id_ = md5(bucket_name_ +
-                    object_name_ +
-                    std::to_string(slash::NowMicros()));
   if (!TryAuth()) {
     DLOG(INFO) << request_id_ << " " <<
       "DeleteObject(DoInitial) - Auth failed: " << client_ip_port_;
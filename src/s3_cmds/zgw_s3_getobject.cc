@@ -2,6 +2,7 @@
 
 #include <vector>
 #include <algorithm>
+#include <cctype>
 
 #include <glog/logging.h>
 #include "src/zgw_config.h"
@@ -11,15 +12,18 @@
 extern ZgwConfig* g_zgw_conf;
 
 bool GetObjectCmd::DoInitial() {
-  block_buffer_.clear();
+  buffer_cache_->Release(&block_buffer_);
   data_size_ = 0;
   range_result_.clear();
   std::queue<std::tuple<uint64_t, uint64_t, uint64_t>> empty;
   std::swap(blocks_, empty);
-  need_partial_ = req_headers_.count("range");
-  request_id_ = md5(bucket_name_ +
-                    object_name_ +
-                    std::to_string(slash::NowMicros()));
+  std::queue<std::pair<uint64_t, std::string>> empty_delimiters;
+  std::swap(part_delimiters_, empty_delimiters);
+  ranges_.clear();
+  data_written_ = 0;
+  block_offset_ = 0;
+  block_loaded_ = false;
+  need_partial_ = req_headers_.Has(kHdrRange);
   user_name_.clear();
   // TODO(replace server's public read with authority management)
   if (!TryAuth()) {
@@ -28,73 +32,157 @@ bool GetObjectCmd::DoInitial() {
     g_zgw_monitor->AddAuthFailed();
     return false;
   }
+  if (!buffer_cache_->TryAdmit()) {
+    // Block buffers are used up, the worker thread can't wait for them
+    http_ret_code_ = 503;
+    GenerateErrorXml(kSlowDown);
+    return false;
+  }
 
   // DLOG(INFO) << request_id_ << " " <<
   //   "GetObject(DoInitial) - " << bucket_name_ << "/" << object_name_;
   return true;
 }
 
+static bool ParseRangeNumber(const std::string& str, uint64_t* num) {
+  if (str.empty() || str.size() > 19) {
+    return false;
+  }
+  uint64_t n = 0;
+  for (char c : str) {
+    if (!isdigit(c)) {
+      return false;
+    }
+    n = n * 10 + (c - '0');
+  }
+  *num = n;
+  return true;
+}
+
 int GetObjectCmd::ParseRange(const std::string& range, uint64_t data_size,
-                             uint64_t* range_start, uint64_t* range_end) {
-  // Check whether range is valid
-  // Support sigle range for only
-  if (range.find("bytes=") == std::string::npos) {
-    return 400;
+                             std::vector<std::pair<uint64_t, uint64_t>>* ranges) {
+  // e.g. bytes=0-99,200-299,-50,1000-
+  // A malformed header is ignored as RFC 7233 says, the whole object is
+  // served with 200. 416 only if none of the ranges is satisfiable
+  ranges->clear();
+  if (range.compare(0, 6, "bytes=") != 0) {
+    return 200;
   }
-  std::string range_header = range.substr(6);
-  int64_t start = 0;
-  int64_t end = INT64_MAX;
-  int res = sscanf(range_header.c_str(), "%ld-%ld", &start, &end);
-  end = std::min(data_size - 1, static_cast<uint64_t>(end));
-  if (res == 1 && start < 0) {
-    start = data_size + start;
-    end = data_size - 1;
+  std::vector<std::string> range_specs;
+  slash::StringSplit(range.substr(6), ',', range_specs);
+  if (range_specs.empty()) {
+    return 200;
+  }
+  for (auto& spec : range_specs) {
+    std::string range_spec = slash::StringTrim(spec);
+    size_t pos = range_spec.find('-');
+    if (pos == std::string::npos) {
+      return 200;
+    }
+    std::string first = range_spec.substr(0, pos);
+    std::string last = range_spec.substr(pos + 1);
+    uint64_t start, end;
+    if (first.empty()) {
+      // Suffix range, the last N bytes
+      uint64_t suffix_len;
+      if (!ParseRangeNumber(last, &suffix_len)) {
+        return 200;
+      }
+      if (suffix_len == 0 || data_size == 0) {
+        // Unsatisfiable
+        continue;
+      }
+      start = suffix_len >= data_size ? 0 : data_size - suffix_len;
+      end = data_size - 1;
+    } else {
+      if (!ParseRangeNumber(first, &start)) {
+        return 200;
+      }
+      end = UINT64_MAX;
+      if (!last.empty() &&
+          (!ParseRangeNumber(last, &end) || end < start)) {
+        return 200;
+      }
+      if (start >= data_size) {
+        // Unsatisfiable
+        continue;
+      }
+      end = std::min(data_size - 1, end);
+    }
+    ranges->push_back(std::make_pair(start, end));
+  }
+  if (ranges->empty()) {
+    return 416;
   }
 
-  if (res > 0 &&
-      start <= end) {
-    // Valid range
-    // DLOG(INFO) << request_id_ << " " <<
-    //   "Get " << bucket_name_ << "/" << object_name_  <<
-    //   "range: " << start << "-" << end;
-    *range_start = start;
-    *range_end = end;
-    return 206;
+  // Coalesce overlapping or adjacent ranges
+  std::sort(ranges->begin(), ranges->end());
+  std::vector<std::pair<uint64_t, uint64_t>> merged;
+  for (auto& r : *ranges) {
+    if (!merged.empty() && r.first <= merged.back().second + 1) {
+      merged.back().second = std::max(merged.back().second, r.second);
+    } else {
+      merged.push_back(r);
+    }
   }
-  return 416;
+  ranges->swap(merged);
+  return 206;
 }
 
 void GetObjectCmd::ParseBlocksFrom(const std::vector<std::string>& block_indexes) {
-  if (data_size_ == 0) {
-    if (need_partial_) {
-      http_ret_code_ = 416;
+  if (need_partial_) {
+    http_ret_code_ = ParseRange(*req_headers_.Get(kHdrRange), data_size_,
+                                &ranges_);
+    if (http_ret_code_ == 416) {
       GenerateErrorXml(kInvalidRange, object_name_);
       return;
-    } else {
-      return;
     }
   }
-  assert(data_size_ > 0);
-  uint64_t range_start = 0;
-  uint64_t range_end = data_size_ - 1;
-  if (need_partial_) {
-    http_ret_code_ = ParseRange(req_headers_.at("range"), data_size_,
-                                &range_start, &range_end);
-    if (http_ret_code_ == 400) {
-      GenerateErrorXml(kInvalidArgument, "range");
-    } else if (http_ret_code_ == 416) {
-      GenerateErrorXml(kInvalidRange, object_name_);
-    } else if (http_ret_code_ == 206) {
-      // Success partial
-      char buf[100];
-      sprintf(buf, "bytes %lu-%lu/%lu", range_start, range_end, object_.size);
-      http_ret_code_ = 206;
-      range_result_.assign(buf);
-      data_size_ = range_end - range_start + 1;
-    } else {
-      // Can't reach here
+  if (http_ret_code_ == 200) {
+    // No Range header, or a malformed one which is ignored
+    ranges_.clear();
+    if (data_size_ > 0) {
+      ParseBlocksFrom(block_indexes, 0, data_size_ - 1);
     }
+    return;
+  }
+  assert(http_ret_code_ == 206);
+
+  char buf[100];
+  if (ranges_.size() == 1) {
+    // Success partial
+    uint64_t range_start = ranges_[0].first;
+    uint64_t range_end = ranges_[0].second;
+    sprintf(buf, "bytes %lu-%lu/%lu", range_start, range_end, object_.size);
+    range_result_.assign(buf);
+    data_size_ = range_end - range_start + 1;
+    ParseBlocksFrom(block_indexes, range_start, range_end);
+    return;
   }
+
+  // Multi-range, response multipart/byteranges body
+  data_size_ = 0;
+  uint64_t data_offset = 0;
+  for (auto& r : ranges_) {
+    std::string delimiter = data_offset == 0 ? "--" : "\r\n--";
+    delimiter.append(request_id_);
+    delimiter.append("\r\nContent-Type: application/octet-stream\r\n");
+    sprintf(buf, "Content-Range: bytes %lu-%lu/%lu\r\n\r\n",
+            r.first, r.second, object_.size);
+    delimiter.append(buf);
+    data_size_ += delimiter.size();
+    part_delimiters_.push(std::make_pair(data_offset, delimiter));
+
+    data_offset += r.second - r.first + 1;
+    ParseBlocksFrom(block_indexes, r.first, r.second);
+  }
+  std::string close_delimiter = "\r\n--" + request_id_ + "--\r\n";
+  data_size_ += data_offset + close_delimiter.size();
+  part_delimiters_.push(std::make_pair(data_offset, close_delimiter));
+}
+
+void GetObjectCmd::ParseBlocksFrom(const std::vector<std::string>& block_indexes,
+                                   uint64_t range_start, uint64_t range_end) {
   uint64_t needed_size = range_end - range_start + 1;
   for (size_t i = 0; i < block_indexes.size(); i++) {
     // Parse all block needed
@@ -112,17 +200,16 @@ void GetObjectCmd::ParseBlocksFrom(const std::vector<std::string>& block_indexes
     uint64_t passed_dsize = 0;
     for (uint64_t b = start_block; b <= end_block; b++) {
       uint64_t cur_bsize = std::min(data_size - passed_dsize, zgwstore::kZgwBlockSize - start_byte);
+      passed_dsize += cur_bsize;
       // Select block
       if (range_start >= cur_bsize) {
         range_start -= cur_bsize;
-        passed_dsize += cur_bsize;
         start_byte = 0;
         // Next block
         continue;
       }
 
-      uint64_t remain = std::min(std::min(needed_size, cur_bsize),
-                                 zgwstore::kZgwBlockSize - range_start);
+      uint64_t remain = std::min(needed_size, cur_bsize - range_start);
 
       // First block choosed, start_byte maybe not zero
       blocks_.push(std::make_tuple(b, start_byte + range_start, remain));
@@ -197,16 +284,21 @@ void GetObjectCmd::DoAndResponse(pink::HTTPResponse* resp) {
         // Sort block indexes load from redis set
         SortBlockIndexes(&sorted_block_indexes);
       } else {
-        // Sigle block index needn't sorting
-        sorted_block_indexes.push_back(object_.data_block);
+        // Block groups of single object needn't sorting
+        slash::StringSplit(object_.data_block, '|', sorted_block_indexes);
+      }
+      if (http_ret_code_ == 200) {
+        ParseBlocksFrom(sorted_block_indexes);
       }
-      ParseBlocksFrom(sorted_block_indexes);
     }
 
     if (http_ret_code_ == 200 ||
         http_ret_code_ == 206) {
       // Success
-      if (http_ret_code_ == 206) {
+      if (http_ret_code_ == 206 && ranges_.size() > 1) {
+        resp->SetHeaders("Content-Type",
+                         "multipart/byteranges; boundary=" + request_id_);
+      } else if (http_ret_code_ == 206) {
         resp->SetHeaders("Content-Range", range_result_);
       }
       resp->SetHeaders("ETag", "\"" + object_.etag + "\"");
@@ -246,30 +338,108 @@ int GetObjectCmd::DoResponseBody(char* buf, size_t max_size) {
     return 0;
   }
 
-  uint64_t block_size = std::get<2>(blocks_.front());
-  if (block_size > max_size) {
-    // Waiting for enough buffer
+  if (max_size == 0) {
     return 0;
   }
-  std::string block_index = std::to_string(std::get<0>(blocks_.front()));
+
+  if (!part_delimiters_.empty() &&
+      part_delimiters_.front().first == data_written_) {
+    // Multi-range part header or the closing delimiter
+    std::string& delimiter = part_delimiters_.front().second;
+    size_t nwritten = std::min(max_size, delimiter.size());
+    memcpy(buf, delimiter.data(), nwritten);
+    delimiter.erase(0, nwritten);
+    if (delimiter.empty()) {
+      part_delimiters_.pop();
+    }
+    data_size_ -= nwritten;
+    if (data_size_ == 0) {
+      // The closing delimiter follows the last block
+      ReleaseBlockBuffer();
+    }
+    return nwritten;
+  }
+
+  if (blocks_.empty()) {
+    return 0;
+  }
+
+  uint64_t block_num = std::get<0>(blocks_.front());
   uint64_t start_byte = std::get<1>(blocks_.front());
-  blocks_.pop();
-  Status s = store_->BlockGet(block_index, &block_buffer_);
-  if (!s.ok()) {
-    // Zeppelin error, close the http connection
+  uint64_t block_size = std::get<2>(blocks_.front());
+  if (block_offset_ == 0 &&
+      (!block_loaded_ || loaded_block_ != block_num)) {
+    // Load next block, keep it until all of it has been written
+    std::string block_index = std::to_string(block_num);
+    block_loaded_ = false;
+    Status s;
+    if (!block_buffer_.acquired()) {
+      // May wait for the memory budget
+      buffer_cache_->Acquire(zgwstore::kZgwBlockSize, &block_buffer_);
+    }
+    if (object_.codec == zgwstore::kObjectBlockFramed) {
+      // Decompress the whole block, ranges are offsets of raw data
+      ZgwBuffer encoded_block;
+      buffer_cache_->Acquire(zgwstore::kZgwBlockSize + 1, &encoded_block);
+      s = store_->BlockGet(block_index, encoded_block.str());
+      if (s.ok()) {
+        s = DecodeBlock(*encoded_block.str(), block_buffer_.str());
+      }
+      buffer_cache_->Release(&encoded_block);
+    } else {
+      s = store_->BlockGet(block_index, block_buffer_.str());
+    }
+    if (!s.ok()) {
+      // Zeppelin error, close the http connection
+      LOG(ERROR) << request_id_ << " " <<
+        "GetObject(DoResponseBody) - BlockGet: " << block_index << " :" <<
+        s.ToString();
+      http_ret_code_ = 500;
+      return -1;
+    }
+    block_loaded_ = true;
+    loaded_block_ = block_num;
+  }
+  if (block_buffer_.str()->size() < start_byte + block_size) {
     LOG(ERROR) << request_id_ << " " <<
-      "GetObject(DoResponseBody) - BlockGet: " << block_index << " :" <<
-      s.ToString();
+      "GetObject(DoResponseBody) - BlockGet: " << block_num <<
+      " size: " << block_buffer_.str()->size() << " expect: " <<
+      start_byte + block_size;
     http_ret_code_ = 500;
     return -1;
   }
-  memcpy(buf, block_buffer_.data() + start_byte, block_size);
-  g_zgw_monitor->AddBucketTraffic(bucket_name_, block_size);
-  data_size_ -= block_size; // Has written
+
+  // Write as much as the buffer can hold
+  uint64_t nwritten = std::min(static_cast<uint64_t>(max_size),
+                               block_size - block_offset_);
+  memcpy(buf, block_buffer_.str()->data() + start_byte + block_offset_,
+         nwritten);
+  block_offset_ += nwritten;
+  if (block_offset_ == block_size) {
+    blocks_.pop();
+    block_offset_ = 0;
+  }
+  g_zgw_monitor->AddBucketTraffic(bucket_name_, nwritten);
+  data_written_ += nwritten;
+  data_size_ -= nwritten; // Has written
+  if (data_size_ == 0) {
+    ReleaseBlockBuffer();
+  }
   // if (data_size_ == 0) {
   //   DLOG(INFO) << request_id_ << " " <<
   //     "GetObject(DoResponseBody) - Complete " << bucket_name_ << "/"
   //     << object_name_ << " Size: " << object_.size;
   // }
-  return block_size;
+  return nwritten;
+}
+
+void GetObjectCmd::DoConnClosed() {
+  // Closed before the whole body written
+  ReleaseBlockBuffer();
+}
+
+void GetObjectCmd::ReleaseBlockBuffer() {
+  // Don't hold a block for the idle connection
+  buffer_cache_->Release(&block_buffer_);
+  block_loaded_ = false;
 }
@@ -4,8 +4,6 @@
 #include "src/zgw_utils.h"
 
 bool HeadBucketCmd::DoInitial() {
-  request_id_ = md5(bucket_name_ +
-                    std::to_string(slash::NowMicros()));
   if (!TryAuth()) {
     DLOG(INFO) << request_id_ << " " <<
       "HeadBucket(DoInitial) - Auth failed: " << client_ip_port_;
@@ -4,9 +4,6 @@
 #include "src/zgwstore/zgw_define.h"
 
 bool HeadObjectCmd::DoInitial() {
-  request_id_ = md5(bucket_name_ +
-                    object_name_ +
-                    std::to_string(slash::NowMicros()));
   if (!TryAuth()) {
     DLOG(INFO) << request_id_ << " " <<
       "HeadObject(DoInitial) - Auth failed: " << client_ip_port_;
@@ -13,10 +13,6 @@ bool InitMultipartUploadCmd::DoInitial() {
   upload_id_ = md5(bucket_name_ + "|" + object_name_ + hostname() +
                    std::to_string(g_zgw_conf->server_port) +
                    std::to_string(slash::NowMicros()));
-  request_id_ = md5(bucket_name_ +
-                    object_name_ +
-                    upload_id_ + 
-                    std::to_string(slash::NowMicros()));
   if (!TryAuth()) {
     DLOG(INFO) << request_id_ << " " <<
       "InitMultipartUpload(DoInitial) - Auth failed: " << client_ip_port_;
@@ -8,7 +8,6 @@
 bool ListAllBucketsCmd::DoInitial() {
   all_buckets_.clear();
   http_response_xml_.clear();
-  request_id_ = md5(std::to_string(slash::NowMicros()));
   if (!TryAuth()) {
     DLOG(INFO) << request_id_ << " " <<
       "ListAllBuckets(DoInitial) - Auth failed: " << client_ip_port_;
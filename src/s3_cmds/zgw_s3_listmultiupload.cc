@@ -7,7 +7,12 @@
 
 bool ListMultiPartUploadCmd::DoInitial() {
   all_virtual_bks_.clear();
+  candidate_buckets_.clear();
+  next_key_marker_.clear();
+  next_upload_id_.clear();
+  is_trucated_ = false;
   http_response_xml_.clear();
+  xml_stream_.Clear();
 
   if (!TryAuth()) {
     DLOG(INFO) << "ListMultiPartUpload(DoInitial) - Auth failed: " <<
@@ -23,14 +28,6 @@ bool ListMultiPartUploadCmd::DoInitial() {
     return false;
   }
 
-  request_id_ = md5(bucket_name_ +
-                    delimiter_ +
-                    prefix_ +
-                    std::to_string(max_uploads_) +
-                    upload_id_marker_ +
-                    key_marker_ +
-                    std::to_string(slash::NowMicros()));
-
   DLOG(INFO) << request_id_ << " " <<
     "ListMultiPartUpload(DoInitial) - " << bucket_name_;
   return true;
@@ -109,25 +106,28 @@ void ListMultiPartUploadCmd::DoAndResponse(pink::HTTPResponse* resp) {
     GenerateRespXml();
   }
 
+  size_t content_length;
+  if (http_ret_code_ == 200) {
+    content_length = xml_stream_.Reset(
+        [this](size_t part, S3XmlWriter* writer) {
+          return WriteRespXml(part, writer);
+        });
+  } else {
+    content_length = xml_stream_.Reset(&http_response_xml_);
+  }
+
   g_zgw_monitor->AddApiRequest(kListMultiPartUpload, http_ret_code_);
   resp->SetStatusCode(http_ret_code_);
-  resp->SetContentLength(http_response_xml_.size());
+  resp->SetContentLength(content_length);
 }
 
 int ListMultiPartUploadCmd::DoResponseBody(char* buf, size_t max_size) {
-  if (max_size < http_response_xml_.size()) {
-    memcpy(buf, http_response_xml_.data(), max_size);
-    http_response_xml_.assign(http_response_xml_.substr(max_size));
-  } else {
-    memcpy(buf, http_response_xml_.data(), http_response_xml_.size());
-  }
-  return std::min(max_size, http_response_xml_.size());
+  return xml_stream_.Read(buf, max_size);
 }
 
 void ListMultiPartUploadCmd::GenerateRespXml() {
   // object_name = bucketname.substr(prefix size + upload id size);
 
-  std::vector<zgwstore::Bucket> candidate_buckets;
   std::set<std::string> commonprefixes;
 
   for (auto& b : all_virtual_bks_) {
@@ -164,10 +164,10 @@ void ListMultiPartUploadCmd::GenerateRespXml() {
       }
     }
 
-    candidate_buckets.push_back(b);
+    candidate_buckets_.push_back(b);
   }
 
-  int diff = commonprefixes.size() + candidate_buckets.size()
+  int diff = commonprefixes.size() + candidate_buckets_.size()
     - static_cast<size_t>(max_uploads_);
   bool is_trucated = diff > 0;
   if (is_trucated) {
@@ -180,65 +180,70 @@ void ListMultiPartUploadCmd::GenerateRespXml() {
     } else {
       extra_num -= commonprefixes.size();
       commonprefixes.clear();
-      if (candidate_buckets.size() <= extra_num) {
-        candidate_buckets.clear();
+      if (candidate_buckets_.size() <= extra_num) {
+        candidate_buckets_.clear();
       } else {
         while (extra_num--)
-          candidate_buckets.pop_back();
+          candidate_buckets_.pop_back();
       }
     }
   }
 
-  is_trucated = is_trucated && max_uploads_ > 0;
-  std::string next_key_marker, next_upload_id;
-  if (is_trucated) {
+  is_trucated_ = is_trucated && max_uploads_ > 0;
+  if (is_trucated_) {
     if (!commonprefixes.empty()) {
-      next_key_marker = *commonprefixes.rbegin();
-    } else if (!candidate_buckets.empty()) {
-      auto& vir_b_name = candidate_buckets.back().bucket_name;
+      next_key_marker_ = *commonprefixes.rbegin();
+    } else if (!candidate_buckets_.empty()) {
+      auto& vir_b_name = candidate_buckets_.back().bucket_name;
       size_t pos = vir_b_name.find("|");
-      next_key_marker = vir_b_name.substr(pos + 1);
-      next_upload_id = vir_b_name.substr(6, 32);
+      next_key_marker_ = vir_b_name.substr(pos + 1);
+      next_upload_id_ = vir_b_name.substr(6, 32);
     }
   }
+}
 
-  S3XmlDoc doc("ListMultipartUploadsResult");
-  
-  doc.AppendToRoot(doc.AllocateNode("Bucket", bucket_name_));
-  doc.AppendToRoot(doc.AllocateNode("KeyMarker", key_marker_));
-  doc.AppendToRoot(doc.AllocateNode("UploadIdMarker", upload_id_marker_));
-  if (!next_key_marker.empty()) {
-    doc.AppendToRoot(doc.AllocateNode("NextKeyMarker", next_key_marker));
-  }
-  if (!next_upload_id.empty()) {
-    doc.AppendToRoot(doc.AllocateNode("NextUploadIdMarker", next_upload_id));
-  }
-  doc.AppendToRoot(doc.AllocateNode("MaxUploads", std::to_string(max_uploads_)));
-  doc.AppendToRoot(doc.AllocateNode("IsTruncated", is_trucated ? "true" : "false"));
-
-  for (auto& b : candidate_buckets) {
+bool ListMultiPartUploadCmd::WriteRespXml(size_t part,
+                                          S3XmlWriter* writer) {
+  // Part 0 is the head, then one part for each upload, then the tail
+  size_t uploads_end = 1 + candidate_buckets_.size();
+  if (part == 0) {
+    writer->Declaration();
+    writer->StartRoot("ListMultipartUploadsResult");
+    writer->Element("Bucket", bucket_name_);
+    writer->Element("KeyMarker", key_marker_);
+    writer->Element("UploadIdMarker", upload_id_marker_);
+    if (!next_key_marker_.empty()) {
+      writer->Element("NextKeyMarker", next_key_marker_);
+    }
+    if (!next_upload_id_.empty()) {
+      writer->Element("NextUploadIdMarker", next_upload_id_);
+    }
+    writer->Element("MaxUploads", std::to_string(max_uploads_));
+    writer->Element("IsTruncated", is_trucated_ ? "true" : "false");
+  } else if (part < uploads_end) {
+    const zgwstore::Bucket& b = candidate_buckets_[part - 1];
     auto& vir_b_name = b.bucket_name;
     size_t pos = vir_b_name.find("|");
-    std::string key = vir_b_name.substr(pos + 1);
-    std::string upload_id = vir_b_name.substr(6, 32);
-
-    S3XmlNode* upload_node = doc.AllocateNode("Upload");
-    doc.AppendToRoot(upload_node);
-    upload_node->AppendNode(doc.AllocateNode("Key", key));
-    upload_node->AppendNode(doc.AllocateNode("UploadId", upload_id));
-
-    S3XmlNode* owner_node = doc.AllocateNode("Onwer");
-    owner_node->AppendNode("ID", slash::sha256(b.owner));
-    owner_node->AppendNode("DisplayName", b.owner);
-    upload_node->AppendNode(owner_node);
-    S3XmlNode* initialtor_node = doc.AllocateNode("Initiator");
-    initialtor_node->AppendNode("ID", slash::sha256(b.owner));
-    initialtor_node->AppendNode("DisplayName", b.owner);
-    upload_node->AppendNode(initialtor_node);
-
-    upload_node->AppendNode("StorageClass", "STANDARD");
-    upload_node->AppendNode("Initiated", iso8601_time(b.create_time));
+    std::string owner_id = slash::sha256(b.owner);
+
+    writer->Start("Upload");
+    writer->Element("Key", vir_b_name.substr(pos + 1));
+    writer->Element("UploadId", vir_b_name.substr(6, 32));
+    writer->Start("Onwer");
+    writer->Element("ID", owner_id);
+    writer->Element("DisplayName", b.owner);
+    writer->End("Onwer");
+    writer->Start("Initiator");
+    writer->Element("ID", owner_id);
+    writer->Element("DisplayName", b.owner);
+    writer->End("Initiator");
+    writer->Element("StorageClass", "STANDARD");
+    writer->Element("Initiated", iso8601_time(b.create_time));
+    writer->End("Upload");
+  } else if (part == uploads_end) {
+    writer->End("ListMultipartUploadsResult");
+  } else {
+    return false;
   }
-
-  doc.ToString(&http_response_xml_);
+  return true;
 }
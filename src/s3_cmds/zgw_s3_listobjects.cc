@@ -9,7 +9,14 @@
 
 bool ListObjectsCmd::DoInitial() {
   all_objects_name_.clear();
+  candidate_objects_.clear();
+  commonprefixes_.clear();
+  next_token_.clear();
+  next_marker_.clear();
+  is_trucated_ = false;
+  key_count_ = 0;
   http_response_xml_.clear();
+  xml_stream_.Clear();
 
   if (!TryAuth()) {
     DLOG(INFO) <<
@@ -26,12 +33,6 @@ bool ListObjectsCmd::DoInitial() {
     return false;
   }
 
-  request_id_ = md5(bucket_name_ +
-                    delimiter_ +
-                    prefix_ +
-                    std::to_string(max_keys_) +
-                    std::to_string(slash::NowMicros()));
-
   DLOG(INFO) << request_id_ << " " <<
     "ListObjects(DoInitial) - " << bucket_name_;
   return true;
@@ -55,25 +56,28 @@ void ListObjectsCmd::DoAndResponse(pink::HTTPResponse* resp) {
     }
   }
 
+  size_t content_length;
+  if (http_ret_code_ == 200) {
+    content_length = xml_stream_.Reset(
+        [this](size_t part, S3XmlWriter* writer) {
+          return WriteRespXml(part, writer);
+        });
+  } else {
+    content_length = xml_stream_.Reset(&http_response_xml_);
+  }
+
   g_zgw_monitor->AddApiRequest(kListObjects, http_ret_code_);
   resp->SetStatusCode(http_ret_code_);
-  resp->SetContentLength(http_response_xml_.size());
+  resp->SetContentLength(content_length);
 }
 
 int ListObjectsCmd::DoResponseBody(char* buf, size_t max_size) {
-  if (max_size < http_response_xml_.size()) {
-    memcpy(buf, http_response_xml_.data(), max_size);
-    http_response_xml_.assign(http_response_xml_.substr(max_size));
-  } else {
-    memcpy(buf, http_response_xml_.data(), http_response_xml_.size());
-  }
-  return std::min(max_size, http_response_xml_.size());
+  return xml_stream_.Read(buf, max_size);
 }
 
 void ListObjectsCmd::GenerateRespXml() {
   // Select objects according to request params
 
-  std::vector<zgwstore::Object> candidate_objects;
   std::vector<std::string> candidate_obj_names;
   std::set<std::string> commonprefixes;
 
@@ -143,23 +147,24 @@ void ListObjectsCmd::GenerateRespXml() {
   }
   // Is not trucated if max keys equal zero
   is_trucated = is_trucated && max_keys_ > 0;
-  std::string next_marker;
   if (is_trucated &&
       !delimiter_.empty()) {
     if (!commonprefixes.empty()) {
-      next_marker = *commonprefixes.rbegin();
+      next_marker_ = *commonprefixes.rbegin();
     } else if (!candidate_obj_names.empty()) {
-      next_marker = candidate_obj_names.back();
+      next_marker_ = candidate_obj_names.back();
     }
   }
 
-  if (!is_trucated) {
-    next_token.clear();
+  if (is_trucated) {
+    next_token_ = next_token;
   }
-  size_t key_count = candidate_obj_names.size() + commonprefixes.size();
+  is_trucated_ = is_trucated;
+  key_count_ = candidate_obj_names.size() + commonprefixes.size();
+  commonprefixes_.assign(commonprefixes.begin(), commonprefixes.end());
 
   Status s = store_->MGetObjects(user_name_, bucket_name_,
-                         candidate_obj_names, &candidate_objects);
+                         candidate_obj_names, &candidate_objects_);
   if (s.IsIOError()) {
     http_ret_code_ = 500;
     LOG(ERROR) << request_id_ << " " <<
@@ -167,64 +172,69 @@ void ListObjectsCmd::GenerateRespXml() {
       bucket_name_ << " " << s.ToString();
     return;
   }
-  if (candidate_obj_names.size() != candidate_objects.size()) {
+  if (candidate_obj_names.size() != candidate_objects_.size()) {
     LOG(WARNING) << request_id_ << " " <<
       "ListObjects(DoAndResponse) - MGetObjects some object doestn't exist: " <<
       bucket_name_ << " " << s.ToString();
   }
+}
 
-  // Build response XML
-  S3XmlDoc doc("ListBucketResult");
-  
-  doc.AppendToRoot(doc.AllocateNode("Name", bucket_name_));
-  doc.AppendToRoot(doc.AllocateNode("Prefix", prefix_));
-  doc.AppendToRoot(doc.AllocateNode("MaxKeys", std::to_string(max_keys_)));
-  if (!delimiter_.empty()) {
-    doc.AppendToRoot(doc.AllocateNode("Delimiter", delimiter_));
-  }
-  if (list_typeV2_) {
-    if (!continuation_token_.empty()) {
-      doc.AppendToRoot(doc.AllocateNode("ContinuationToken", continuation_token_));
-    }
-    if (!next_token.empty()) {
-      doc.AppendToRoot(doc.AllocateNode("NextContinuationToken", next_token));
-    }
-    if (!start_after_.empty()) {
-      doc.AppendToRoot(doc.AllocateNode("StartAfter", start_after_));
+bool ListObjectsCmd::WriteRespXml(size_t part, S3XmlWriter* writer) {
+  // Part 0 is the head, then one part for each entry, then the tail
+  size_t objects_end = 1 + candidate_objects_.size();
+  size_t prefixes_end = objects_end + commonprefixes_.size();
+  if (part == 0) {
+    writer->Declaration();
+    writer->StartRoot("ListBucketResult");
+    writer->Element("Name", bucket_name_);
+    writer->Element("Prefix", prefix_);
+    writer->Element("MaxKeys", std::to_string(max_keys_));
+    if (!delimiter_.empty()) {
+      writer->Element("Delimiter", delimiter_);
     }
-    doc.AppendToRoot(doc.AllocateNode("KeyCount", std::to_string(key_count)));
-  } else {
-    doc.AppendToRoot(doc.AllocateNode("Marker", marker_));
-    if (is_trucated) {
-      doc.AppendToRoot(doc.AllocateNode("NextMarker", next_marker));
+    if (list_typeV2_) {
+      if (!continuation_token_.empty()) {
+        writer->Element("ContinuationToken", continuation_token_);
+      }
+      if (!next_token_.empty()) {
+        writer->Element("NextContinuationToken", next_token_);
+      }
+      if (!start_after_.empty()) {
+        writer->Element("StartAfter", start_after_);
+      }
+      writer->Element("KeyCount", std::to_string(key_count_));
+    } else {
+      writer->Element("Marker", marker_);
+      if (is_trucated_) {
+        writer->Element("NextMarker", next_marker_);
+      }
     }
-  }
-  doc.AppendToRoot(doc.AllocateNode("IsTruncated",
-                                    is_trucated ? "true" : "false"));
-
-  for (auto& o : candidate_objects) {
-    S3XmlNode* contents = doc.AllocateNode("Contents");
-    contents->AppendNode(doc.AllocateNode("Key", o.object_name));
-    contents->AppendNode(doc.AllocateNode("LastModified",
-                                          iso8601_time(o.last_modified)));
-    contents->AppendNode(doc.AllocateNode("ETag", "\"" + o.etag + "\""));
-    contents->AppendNode(doc.AllocateNode("Size", std::to_string(o.size)));
-    contents->AppendNode(doc.AllocateNode("StorageClass", "STANDARD"));
+    writer->Element("IsTruncated", is_trucated_ ? "true" : "false");
+  } else if (part < objects_end) {
+    const zgwstore::Object& o = candidate_objects_[part - 1];
+    writer->Start("Contents");
+    writer->Element("Key", o.object_name);
+    writer->Element("LastModified", iso8601_time(o.last_modified));
+    writer->Element("ETag", "\"" + o.etag + "\"");
+    writer->Element("Size", std::to_string(o.size));
+    writer->Element("StorageClass", "STANDARD");
     if (!list_typeV2_ || fetch_owner_) {
-      S3XmlNode* owner = doc.AllocateNode("Owner");
-      owner->AppendNode(doc.AllocateNode("ID", slash::sha256(o.owner)));
-      owner->AppendNode(doc.AllocateNode("DisplayName", o.owner));
-      contents->AppendNode(owner);
+      writer->Start("Owner");
+      writer->Element("ID", slash::sha256(o.owner));
+      writer->Element("DisplayName", o.owner);
+      writer->End("Owner");
     }
-    doc.AppendToRoot(contents);
-  }
-  for (auto& p : commonprefixes) {
-    S3XmlNode* comprefixes = doc.AllocateNode("CommonPrefixes");
-    comprefixes->AppendNode(doc.AllocateNode("Prefix", p));
-    doc.AppendToRoot(comprefixes);
+    writer->End("Contents");
+  } else if (part < prefixes_end) {
+    writer->Start("CommonPrefixes");
+    writer->Element("Prefix", commonprefixes_[part - objects_end]);
+    writer->End("CommonPrefixes");
+  } else if (part == prefixes_end) {
+    writer->End("ListBucketResult");
+  } else {
+    return false;
   }
-
-  doc.ToString(&http_response_xml_);
+  return true;
 }
 
 bool ListObjectsCmd::SanitizeParams(std::string* invalid_param) {
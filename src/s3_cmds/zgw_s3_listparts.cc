@@ -7,7 +7,11 @@
 
 bool ListPartsCmd::DoInitial() {
   all_candicate_parts_.clear();
+  candidate_parts_.clear();
+  next_marker_.clear();
+  is_trucated_ = false;
   http_response_xml_.clear();
+  xml_stream_.Clear();
   upload_id_ = query_params_.at("uploadId");
   max_parts_ = 1000;
   part_num_marker_ = "0";
@@ -35,13 +39,6 @@ bool ListPartsCmd::DoInitial() {
     part_num_marker_.assign(query_params_.at("part-number-marker"));
   }
 
-  request_id_ = md5(bucket_name_ +
-                    object_name_ +
-                    upload_id_ + 
-                    part_num_marker_ +
-                    std::to_string(max_parts_) +
-                    std::to_string(slash::NowMicros()));
-
   DLOG(INFO) << request_id_ << " " <<
     "ListParts(DoInitial) - " << bucket_name_ << "/" << object_name_ <<
     ", uploadId: " << upload_id_;
@@ -73,51 +70,31 @@ void ListPartsCmd::DoAndResponse(pink::HTTPResponse* resp) {
     }
   }
 
+  size_t content_length;
+  if (http_ret_code_ == 200) {
+    content_length = xml_stream_.Reset(
+        [this](size_t part, S3XmlWriter* writer) {
+          return WriteRespXml(part, writer);
+        });
+  } else {
+    content_length = xml_stream_.Reset(&http_response_xml_);
+  }
+
   g_zgw_monitor->AddApiRequest(kListParts, http_ret_code_);
   resp->SetStatusCode(http_ret_code_);
-  resp->SetContentLength(http_response_xml_.size());
+  resp->SetContentLength(content_length);
 }
 
 int ListPartsCmd::DoResponseBody(char* buf, size_t max_size) {
-  if (max_size < http_response_xml_.size()) {
-    memcpy(buf, http_response_xml_.data(), max_size);
-    http_response_xml_.assign(http_response_xml_.substr(max_size));
-  } else {
-    memcpy(buf, http_response_xml_.data(), http_response_xml_.size());
-  }
-  return std::min(max_size, http_response_xml_.size());
+  return xml_stream_.Read(buf, max_size);
 }
 
 void ListPartsCmd::GenerateRespXml() {
-  // Build response XML
-  S3XmlDoc doc("ListPartsResult");
-
-  doc.AppendToRoot("Bucket", bucket_name_);
-  doc.AppendToRoot("Key", object_name_);
-  doc.AppendToRoot("UploadId", upload_id_);
-
-  S3XmlNode* init_node = doc.AllocateNode("Initiator");
-  init_node->AppendNode("ID", slash::sha256(user_name_));
-  init_node->AppendNode("DisplayName", user_name_);
-  doc.AppendToRoot(init_node);
-
-  S3XmlNode* owner_node = doc.AllocateNode("Owner");
-  owner_node->AppendNode("ID", slash::sha256(user_name_));
-  owner_node->AppendNode("DisplayName", user_name_);
-  doc.AppendToRoot(owner_node);
-
-  doc.AppendToRoot("StorageClass", "STANDARD");
-  doc.AppendToRoot("PartNumberMarker", part_num_marker_);
-  doc.AppendToRoot("MaxParts", std::to_string(max_parts_));
-
-  bool is_trucated = false;
   int count = 0;
-  std::string next_marker;
-
   for (auto& part : all_candicate_parts_) {
     if (count >= max_parts_) {
       if (max_parts_ > 0) {
-        is_trucated = true;
+        is_trucated_ = true;
       }
       break;
     }
@@ -125,20 +102,49 @@ void ListPartsCmd::GenerateRespXml() {
         part.object_name < part_num_marker_) {
       continue;
     }
-    S3XmlNode* part_node = doc.AllocateNode("Part");
-    part_node->AppendNode("PartNumber", part.object_name);
-    part_node->AppendNode("LastModified", iso8601_time(part.last_modified));
-    part_node->AppendNode("ETag", "\"" + part.etag + "\"");
-    part_node->AppendNode("Size", std::to_string(part.size));
-    doc.AppendToRoot(part_node);
-
-    next_marker = part.object_name;
+    candidate_parts_.push_back(&part);
+    next_marker_ = part.object_name;
     count++;
   }
+}
 
-  doc.AppendToRoot("IsTruncated", is_trucated ? "true" : "false");
-  doc.AppendToRoot("NextPartNumberMarker", (!is_trucated || count == 0) ? "0" :
-                   next_marker);
-
-  doc.ToString(&http_response_xml_);
+bool ListPartsCmd::WriteRespXml(size_t part, S3XmlWriter* writer) {
+  // Part 0 is the head, then one part for each upload part, then the tail
+  size_t parts_end = 1 + candidate_parts_.size();
+  if (part == 0) {
+    std::string user_id = slash::sha256(user_name_);
+    writer->Declaration();
+    writer->StartRoot("ListPartsResult");
+    writer->Element("Bucket", bucket_name_);
+    writer->Element("Key", object_name_);
+    writer->Element("UploadId", upload_id_);
+    writer->Start("Initiator");
+    writer->Element("ID", user_id);
+    writer->Element("DisplayName", user_name_);
+    writer->End("Initiator");
+    writer->Start("Owner");
+    writer->Element("ID", user_id);
+    writer->Element("DisplayName", user_name_);
+    writer->End("Owner");
+    writer->Element("StorageClass", "STANDARD");
+    writer->Element("PartNumberMarker", part_num_marker_);
+    writer->Element("MaxParts", std::to_string(max_parts_));
+  } else if (part < parts_end) {
+    const zgwstore::Object& p = *candidate_parts_[part - 1];
+    writer->Start("Part");
+    writer->Element("PartNumber", p.object_name);
+    writer->Element("LastModified", iso8601_time(p.last_modified));
+    writer->Element("ETag", "\"" + p.etag + "\"");
+    writer->Element("Size", std::to_string(p.size));
+    writer->End("Part");
+  } else if (part == parts_end) {
+    writer->Element("IsTruncated", is_trucated_ ? "true" : "false");
+    writer->Element("NextPartNumberMarker",
+                    (!is_trucated_ || candidate_parts_.empty()) ? "0" :
+                    next_marker_);
+    writer->End("ListPartsResult");
+  } else {
+    return false;
+  }
+  return true;
 }
@@ -4,13 +4,20 @@
 
 #include <queue>
 #include <tuple>
+#include <memory>
 
 #include "slash/include/slash_status.h"
 #include "src/zgwstore/zgw_define.h"
 #include "src/zgw_monitor.h"
 #include "src/zgw_utils.h"
+#include "src/zgw_block_writer.h"
+#include "src/zgw_meta_committer.h"
+#include "src/s3_cmds/zgw_s3_stream.h"
+#include "src/s3_cmds/zgw_s3_xml.h"
 
 extern ZgwMonitor* g_zgw_monitor;
+extern ZgwBlockWriter* g_zgw_block_writer;
+extern ZgwMetaCommitter* g_zgw_meta_committer;
 
 using slash::Status;
 
@@ -18,28 +25,51 @@ class GetObjectCmd : public S3Cmd {
  public:
   GetObjectCmd(int flags)
       : S3Cmd(flags),
-        need_partial_(false) {
-    block_buffer_.resize(zgwstore::kZgwBlockSize);
+        need_partial_(false),
+        data_written_(0),
+        block_offset_(0),
+        block_loaded_(false),
+        loaded_block_(0) {
   }
 
   virtual bool DoInitial() override;
   virtual void DoAndResponse(pink::HTTPResponse* resp) override;
   virtual int DoResponseBody(char* buf, size_t max_size) override;
+  virtual void DoConnClosed() override;
 
  private:
   int ParseRange(const std::string& range, uint64_t data_size,
-                 uint64_t* range_start, uint64_t* range_end);
+                 std::vector<std::pair<uint64_t, uint64_t>>* ranges);
   void SortBlockIndexes(std::vector<std::string>* block_indexes);
   void ParseBlocksFrom(const std::vector<std::string>& block_indexes);
+  void ParseBlocksFrom(const std::vector<std::string>& block_indexes,
+                       uint64_t range_start, uint64_t range_end);
+  void ReleaseBlockBuffer();
 
   zgwstore::Object object_;
 
+  // Response body size, include part delimiters of multi-range response
   uint64_t data_size_;
   bool need_partial_;
   std::string range_result_;
+  //            range_start range_end, sorted and coalesced
+  std::vector<std::pair<uint64_t, uint64_t>> ranges_;
+  // Multi-range response: delimiter written when data_written_ reaches
+  // the offset, the last one closes the multipart body
+  //                     data offset  delimiter
+  std::queue<std::pair<uint64_t, std::string>> part_delimiters_;
+  uint64_t data_written_;
   //                 block_index start_bytes  size
   std::queue<std::tuple<uint64_t, uint64_t, uint64_t>> blocks_;
-  std::string block_buffer_;
+  // Acquired when the first block is loaded, released once the body is
+  // written, so idle connections hold no block
+  ZgwBuffer block_buffer_;
+  // Bytes of blocks_.front() already written
+  uint64_t block_offset_;
+  // Block held in block_buffer_, ranges touching the same block
+  // fetch it only once
+  bool block_loaded_;
+  uint64_t loaded_block_;
 };
 
 class HeadObjectCmd : public S3Cmd {
@@ -101,29 +131,74 @@ class PutObjectCopyCmd : public S3Cmd {
   zgwstore::Object new_object_;
 };
 
-class PutObjectCmd : public S3Cmd {
+// Body of PutObject and UploadPart: Content-Length or streaming, plain or
+// aws-chunked, written block by block as it arrives and verified against
+// x-amz-content-sha256 before the meta is committed
+class S3UploadCmd : public S3Cmd {
  public:
-  PutObjectCmd(int flags)
+  S3UploadCmd(int flags, const char* cmd_name)
     : S3Cmd(flags),
       block_count_(0),
+      block_end_(0),
+      block_codec_(kCodecNone),
+      cmd_name_(cmd_name),
       block_start_(0),
-      block_end_(0) {
+      streaming_(false),
+      aws_chunked_(false) {
   }
 
-  virtual bool DoInitial() override;
   virtual void DoReceiveBody(const char* data, size_t data_size) override;
-  virtual void DoAndResponse(pink::HTTPResponse* resp) override;
-  virtual int DoResponseBody(char* buf, size_t max_size) override;
 
- private:
-  zgwstore::Object new_object_;
-
-  Status status_;
+ protected:
+  // Before TryAuth, count the block ids to allocate in block_count_,
+  // data_size is 0 for the streaming body
+  bool InitBody(uint64_t* data_size);
+  // After AllocateId of block_count_ ids ending at block_end_, data_block
+  // is recorded here unless the body is streaming
+  void StartBody(const std::string& bucket_name,
+                 const std::string& object_name, uint64_t data_size,
+                 std::string* data_block);
+  // Wait for all blocks written, return false if the body can't be
+  // committed and http_ret_code_ is set. Size and data_block of the
+  // streaming body are known only now
+  bool FinishBody(uint64_t* data_size, std::string* data_block);
 
   MD5Ctx md5_ctx_;
   size_t block_count_;
-  uint64_t block_start_;
   uint64_t block_end_;
+  BlockCodec block_codec_;
+
+ private:
+  const char* cmd_name_;
+  Status status_;
+  uint64_t block_start_;
+  // Not null while blocks are striped across block writers
+  std::shared_ptr<BlockWriteTracker> block_tracker_;
+
+  // Body size is unknown until all received
+  bool streaming_;
+  bool aws_chunked_;
+  AwsChunkedDecoder chunked_decoder_;
+  std::string decoded_body_;
+  S3BlockStream block_stream_;
+
+  // Not empty if the body is verified against x-amz-content-sha256
+  std::string payload_hash_;
+  SHA256Ctx sha256_ctx_;
+};
+
+class PutObjectCmd : public S3UploadCmd {
+ public:
+  PutObjectCmd(int flags)
+    : S3UploadCmd(flags, "PutObject") {
+  }
+
+  virtual bool DoInitial() override;
+  virtual void DoAndResponse(pink::HTTPResponse* resp) override;
+  virtual int DoResponseBody(char* buf, size_t max_size) override;
+
+ private:
+  zgwstore::Object new_object_;
 };
 
 class DeleteObjectCmd : public S3Cmd {
@@ -169,29 +244,18 @@ class AbortMultiUploadCmd : public S3Cmd {
   std::string upload_id_;
 };
 
-class UploadPartCmd : public S3Cmd {
+class UploadPartCmd : public S3UploadCmd {
  public:
   UploadPartCmd(int flags)
-    : S3Cmd(flags),
-      block_count_(0),
-      block_start_(0),
-      block_end_(0) {
+    : S3UploadCmd(flags, "UploadPart") {
   }
 
   virtual bool DoInitial() override;
-  virtual void DoReceiveBody(const char* data, size_t data_size) override;
   virtual void DoAndResponse(pink::HTTPResponse* resp) override;
   virtual int DoResponseBody(char* buf, size_t max_size) override;
 
  private:
   zgwstore::Object new_object_part_;
-
-  Status status_;
-
-  MD5Ctx md5_ctx_;
-  size_t block_count_;
-  uint64_t block_start_;
-  uint64_t block_end_;
 };
 
 class UploadPartCopyCmd : public S3Cmd {
@@ -270,11 +334,18 @@ class ListPartsCmd: public S3Cmd {
   };
 
   void GenerateRespXml();
+  bool WriteRespXml(size_t part, S3XmlWriter* writer);
 
   std::string upload_id_;
   int max_parts_;
   std::string part_num_marker_;
   std::set<zgwstore::Object, ObjectsComparator> all_candicate_parts_;
+
+  // Selected parts, written as the response body is sent
+  std::vector<const zgwstore::Object*> candidate_parts_;
+  std::string next_marker_;
+  bool is_trucated_;
+  S3XmlStream xml_stream_;
 };
 
 class CompleteMultiUploadCmd : public S3Cmd {
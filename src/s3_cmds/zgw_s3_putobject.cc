@@ -6,18 +6,11 @@
 
 bool PutObjectCmd::DoInitial() {
   http_response_xml_.clear();
-  md5_ctx_.Init();
-  status_ = Status::OK();
-  block_start_ = 0;
-  block_end_ = 0;
 
-  request_id_ = md5(bucket_name_ +
-                    object_name_ +
-                    std::to_string(slash::NowMicros()));
-
-  size_t data_size = std::stoul(req_headers_["content-length"]);
-  size_t m = data_size % zgwstore::kZgwBlockSize;
-  block_count_ = data_size / zgwstore::kZgwBlockSize + (m > 0 ? 1 : 0);
+  uint64_t data_size = 0;
+  if (!InitBody(&data_size)) {
+    return false;
+  }
 
   if (!TryAuth()) {
     DLOG(INFO) << request_id_ << " " <<
@@ -25,7 +18,6 @@ bool PutObjectCmd::DoInitial() {
     g_zgw_monitor->AddAuthFailed();
     return false;
   }
-
   DLOG(INFO) << request_id_ << " " <<
     "PutObject(DoInitial) - " << bucket_name_ << "/" << object_name_;
 
@@ -37,6 +29,9 @@ bool PutObjectCmd::DoInitial() {
   new_object_.owner = user_name_;
   new_object_.last_modified = 0; // Postpone
   new_object_.storage_class = 0; // Unused
+  block_codec_ = BucketBlockCodec(bucket_name_);
+  new_object_.codec = block_codec_ != kCodecNone ?
+    zgwstore::kObjectBlockFramed : zgwstore::kObjectBlockRaw;
   new_object_.acl = "_";
   new_object_.upload_id = "_"; // Doesn't need
   new_object_.data_block = ""; // Postpone
@@ -45,14 +40,12 @@ bool PutObjectCmd::DoInitial() {
   Status s = store_->AllocateId(user_name_, bucket_name_, object_name_,
                                 block_count_, &block_end_);
   if (s.ok()) {
-    block_start_ = block_end_ - block_count_;
     http_ret_code_ = 200;
-    char buf[100];
-    sprintf(buf, "%lu-%lu(0,%lu)", block_start_, block_end_ - 1, data_size);
-    new_object_.data_block = std::string(buf);
+    StartBody(bucket_name_, object_name_, data_size, &new_object_.data_block);
     DLOG(INFO) << request_id_ << " " <<
       "PutObject(DoInitial) - " << bucket_name_ << "/" <<
-      object_name_ << "AllocateId: " << block_start_ << "-" << block_end_ - 1;
+      object_name_ << "AllocateId: " << block_end_ - block_count_ << "-" <<
+      block_end_ - 1;
   } else if (s.ToString().find("Bucket NOT Exists") != std::string::npos ||
              s.ToString().find("Bucket Doesn't Belong To This User") !=
              std::string::npos) {
@@ -70,67 +63,31 @@ bool PutObjectCmd::DoInitial() {
   return true;
 }
 
-// Data size from HTTP is 8MB per invocation, or smaller as the last
-void PutObjectCmd::DoReceiveBody(const char* data, size_t data_size) {
-  if (http_ret_code_ != 200) {
-    return;
-  }
-
-  char* buf_pos = const_cast<char*>(data);
-  size_t remain_size = data_size;
-  DLOG(INFO) << request_id_ << " " <<
-    bucket_name_ << "/" << object_name_ << " Remain size: " << remain_size;
-
-  while (remain_size > 0) {
-    if (block_start_ >= block_end_) {
-      // LOG WARNING
-      LOG(WARNING) << request_id_ << " " <<
-        "PutObject Block error, block_start_: " << block_start_ <<
-        " block_end_: " << block_end_;
-      return;
+void PutObjectCmd::DoAndResponse(pink::HTTPResponse* resp) {
+  uint64_t data_size = new_object_.size;
+  if (FinishBody(&data_size, &new_object_.data_block)) {
+    // Write meta
+    new_object_.size = data_size;
+    new_object_.etag = md5_ctx_.ToString();
+    LOG(INFO) << "MD5: " << new_object_.etag;
+    if (new_object_.etag.empty()) {
+      new_object_.etag = "_";
     }
-    size_t nwritten = std::min(remain_size, zgwstore::kZgwBlockSize);
-    status_ = store_->BlockSet(std::to_string(block_start_++),
-                               std::string(buf_pos, nwritten));
-    if (status_.ok()) {
-      md5_ctx_.Update(buf_pos, nwritten);
-      g_zgw_monitor->AddBucketTraffic(bucket_name_, nwritten);
+    new_object_.last_modified = slash::NowMicros();
+
+    Status s;
+    if (g_zgw_meta_committer != nullptr) {
+      // Committed in batch with concurrent uploads
+      s = g_zgw_meta_committer->AddObject(new_object_);
     } else {
-      http_ret_code_ = 500;
-      LOG(ERROR) << request_id_ << " " <<
-        "PutObject(DoReceiveBody) - BlockSet: " << block_start_ - 1 << " :" <<
-        status_.ToString();
+      s = store_->AddObject(new_object_);
     }
-
-    remain_size -= nwritten;
-    buf_pos += nwritten;
-  }
-}
-
-void PutObjectCmd::DoAndResponse(pink::HTTPResponse* resp) {
-  if (http_ret_code_ == 200) {
-    if (!status_.ok()) {
+    if (!s.ok()) {
       http_ret_code_ = 500;
-      // Error happend while transmiting to zeppelin
       LOG(ERROR) << request_id_ << " " <<
-        "PutObject(DoAndResponse) - writing to zp error" << status_.ToString();
-    } else {
-      // Write meta
-      new_object_.etag = md5_ctx_.ToString();
-      LOG(INFO) << "MD5: " << new_object_.etag;
-      if (new_object_.etag.empty()) {
-        new_object_.etag = "_";
-      }
-      new_object_.last_modified = slash::NowMicros();
-
-      status_ = store_->AddObject(new_object_);
-      if (!status_.ok()) {
-        http_ret_code_ = 500;
-        LOG(ERROR) << request_id_ << " " <<
-          "PutObject(DoAndResponse) - AddObject error" << status_.ToString();
-      }
-      DLOG(INFO) << "AddObject: " << bucket_name_ + "/" + object_name_ + " Success";
+        "PutObject(DoAndResponse) - AddObject error" << s.ToString();
     }
+    DLOG(INFO) << "AddObject: " << bucket_name_ + "/" + object_name_ + " Success";
     resp->SetHeaders("Last-Modified", http_nowtime(new_object_.last_modified));
     resp->SetHeaders("ETag", "\"" + new_object_.etag + "\"");
   }
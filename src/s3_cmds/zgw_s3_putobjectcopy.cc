@@ -7,7 +7,7 @@
 #include "src/zgw_utils.h"
 
 bool PutObjectCopyCmd::DoInitial() {
-  std::string source_path = req_headers_.at("x-amz-copy-source");
+  std::string source_path = *req_headers_.Get(kHdrXAmzCopySource);
 
   if (!TryAuth()) {
     DLOG(INFO) <<
@@ -25,12 +25,6 @@ bool PutObjectCopyCmd::DoInitial() {
     return false;
   }
 
-  request_id_ = md5(bucket_name_ +
-                    object_name_ +
-                    src_bucket_name_ +
-                    src_object_name_ +
-                    std::to_string(slash::NowMicros()));
-
   DLOG(INFO) << request_id_ << " " <<
     "PutObjectCopy(DoInitial) - " << src_bucket_name_ << "/" << src_object_name_ <<
     " -> " << bucket_name_ << "/" << object_name_;
@@ -66,31 +60,24 @@ Status PutObjectCopyCmd::AddBlocksRef(const std::string& upload_id,
       }
     }
   } else {
-    // Sigle block index needn't sorting
-    block_indexes.push_back(data_blocks);
+    // Block groups of single object needn't sorting
+    slash::StringSplit(data_blocks, '|', block_indexes);
   }
 
-  s = store_->Lock();
-  if (!s.ok()) {
-    return s;
-  }
   for (auto& blockg : block_indexes) {
     uint64_t start_block, end_block, start_byte, data_size;
     int ret = sscanf(blockg.c_str(), "%lu-%lu(%lu,%lu)",
                      &start_block, &end_block, &start_byte, &data_size);
-    for (uint64_t b = start_block; b <= end_block; b++) {
-      s = store_->BlockRef(std::to_string(b));
-      if (!s.ok()) {
+    if (ret != 4) {
+      continue;
+    }
+    s = store_->BlockRef(start_block, end_block);
+    if (!s.ok()) {
       LOG(ERROR) << request_id_ << " " <<
-        "PutObjectCopy(DoAndResponse) - BlockRef Error: " << data_blocks;
-        return s;
-      }
+        "PutObjectCopy(DoAndResponse) - BlockRef Error: " << blockg;
+      return s;
     }
   }
-  s = store_->UnLock();
-  if (!s.ok()) {
-    return s;
-  }
 
   return Status::OK();
 }
@@ -111,6 +98,7 @@ void PutObjectCopyCmd::DoAndResponse(pink::HTTPResponse* resp) {
       new_object_.owner = user_name_;
       new_object_.last_modified = slash::NowMicros();
       new_object_.storage_class = 0; // Unused
+      new_object_.codec = src_object_.codec;
       new_object_.acl = "FULL_CONTROL";
       new_object_.upload_id = src_object_.upload_id;
       new_object_.data_block = src_object_.data_block;
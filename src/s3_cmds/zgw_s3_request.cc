@@ -0,0 +1,94 @@
+#include "src/s3_cmds/zgw_s3_request.h"
+
+#include <strings.h>
+
+const S3ParamMap S3ParamView::empty_map_;
+
+static const char* kHotHeaderNames[kNumHotHeaders] = {
+  "authorization",
+  "content-length",
+  "content-encoding",
+  "range",
+  "expect",
+  "x-amz-date",
+  "x-amz-content-sha256",
+  "x-amz-decoded-content-length",
+  "x-amz-copy-source",
+  "x-amz-copy-source-range",
+};
+
+// kNumHotHeaders if name is not a hot header, duplicate case labels fail
+// the build if two hot headers share a slot
+static S3HotHeader HotHeaderOf(const std::string& name) {
+  S3HotHeader header = kNumHotHeaders;
+  switch (HotHeaderSlot(name.data(), name.size())) {
+    case HotHeaderSlot("authorization"):
+      header = kHdrAuthorization;
+      break;
+    case HotHeaderSlot("content-length"):
+      header = kHdrContentLength;
+      break;
+    case HotHeaderSlot("content-encoding"):
+      header = kHdrContentEncoding;
+      break;
+    case HotHeaderSlot("range"):
+      header = kHdrRange;
+      break;
+    case HotHeaderSlot("expect"):
+      header = kHdrExpect;
+      break;
+    case HotHeaderSlot("x-amz-date"):
+      header = kHdrXAmzDate;
+      break;
+    case HotHeaderSlot("x-amz-content-sha256"):
+      header = kHdrXAmzContentSHA256;
+      break;
+    case HotHeaderSlot("x-amz-decoded-content-length"):
+      header = kHdrXAmzDecodedContentLength;
+      break;
+    case HotHeaderSlot("x-amz-copy-source"):
+      header = kHdrXAmzCopySource;
+      break;
+    case HotHeaderSlot("x-amz-copy-source-range"):
+      header = kHdrXAmzCopySourceRange;
+      break;
+    default:
+      return kNumHotHeaders;
+  }
+  return name == kHotHeaderNames[header] ? header : kNumHotHeaders;
+}
+
+void S3ReqHeaders::Reset(const S3ParamMap* headers) {
+  S3ParamView::Reset(headers);
+  for (int i = 0; i < kNumHotHeaders; i++) {
+    hot_[i] = nullptr;
+  }
+  for (auto& item : map()) {
+    S3HotHeader header = HotHeaderOf(item.first);
+    if (header != kNumHotHeaders) {
+      hot_[header] = &item.second;
+    }
+  }
+}
+
+bool S3ReqHeaders::ExpectContinue() const {
+  const std::string* expect = hot_[kHdrExpect];
+  return expect != nullptr && strcasecmp(expect->c_str(), "100-continue") == 0;
+}
+
+bool S3ReqHeaders::ContentLength(uint64_t* length) const {
+  const std::string* value = hot_[kHdrContentLength];
+  // At most 19 digits, not overflowed
+  if (value == nullptr || value->empty() || value->size() > 19) {
+    return false;
+  }
+  uint64_t n = 0;
+  for (char c : *value) {
+    if (c < '0' || c > '9') {
+      return false;
+    }
+    n = n * 10 + (c - '0');
+  }
+  *length = n;
+  return true;
+}
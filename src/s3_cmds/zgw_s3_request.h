@@ -0,0 +1,109 @@
+#ifndef ZGW_S3_REQUEST_H
+#define ZGW_S3_REQUEST_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+
+typedef std::map<std::string, std::string> S3ParamMap;
+
+// Headers looked up by most requests, resolved once for each request
+enum S3HotHeader {
+  kHdrAuthorization = 0,
+  kHdrContentLength,
+  kHdrContentEncoding,
+  kHdrRange,
+  kHdrExpect,
+  kHdrXAmzDate,
+  kHdrXAmzContentSHA256,
+  kHdrXAmzDecodedContentLength,
+  kHdrXAmzCopySource,
+  kHdrXAmzCopySourceRange,
+  kNumHotHeaders,
+};
+
+// FNV-1a of the header name, slots of the hot headers are distinct,
+// which the switch in S3ReqHeaders::Reset checks at compile time
+const size_t kHotHeaderSlots = 64;
+
+constexpr uint32_t HotHeaderHash(const char* name, uint32_t h = 2166136261u) {
+  return *name == '\0' ? h :
+    HotHeaderHash(name + 1, (h ^ static_cast<uint8_t>(*name)) * 16777619u);
+}
+
+constexpr size_t HotHeaderSlot(const char* name) {
+  return HotHeaderHash(name) % kHotHeaderSlots;
+}
+
+inline size_t HotHeaderSlot(const char* name, size_t size) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < size; i++) {
+    h = (h ^ static_cast<uint8_t>(name[i])) * 16777619u;
+  }
+  return h % kHotHeaderSlots;
+}
+
+// Parameters owned by the connection, borrowed by the command until the
+// next request of the connection
+class S3ParamView {
+ public:
+  S3ParamView()
+      : map_(&empty_map_) {
+  }
+
+  void Reset(const S3ParamMap* map) {
+    map_ = map != nullptr ? map : &empty_map_;
+  }
+
+  size_t count(const std::string& key) const {
+    return map_->count(key);
+  }
+  const std::string& at(const std::string& key) const {
+    return map_->at(key);
+  }
+  S3ParamMap::const_iterator find(const std::string& key) const {
+    return map_->find(key);
+  }
+  S3ParamMap::const_iterator begin() const {
+    return map_->begin();
+  }
+  S3ParamMap::const_iterator end() const {
+    return map_->end();
+  }
+  const S3ParamMap& map() const {
+    return *map_;
+  }
+
+ private:
+  static const S3ParamMap empty_map_;
+
+  const S3ParamMap* map_;
+};
+
+class S3ReqHeaders : public S3ParamView {
+ public:
+  S3ReqHeaders() {
+    Reset(nullptr);
+  }
+
+  // Resolve the hot headers in one pass over headers
+  void Reset(const S3ParamMap* headers);
+
+  // nullptr if the request has no such header
+  const std::string* Get(S3HotHeader header) const {
+    return hot_[header];
+  }
+  bool Has(S3HotHeader header) const {
+    return hot_[header] != nullptr;
+  }
+  // Expect: 100-continue, the client waits for the final status or
+  // 100 Continue before sending the body
+  bool ExpectContinue() const;
+  // Content-Length of a body, false if absent or malformed
+  bool ContentLength(uint64_t* length) const;
+
+ private:
+  const std::string* hot_[kNumHotHeaders];
+};
+
+#endif
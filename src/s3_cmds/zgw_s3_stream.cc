@@ -0,0 +1,433 @@
+#include "src/s3_cmds/zgw_s3_stream.h"
+
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <glog/logging.h>
+#include "src/zgwstore/zgw_define.h"
+
+extern ZgwBlockWriter* g_zgw_block_writer;
+
+static const size_t kMaxChunkHeaderSize = 4096;
+static const char* kEmptySHA256 =
+  "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855";
+
+bool IsStreamingBody(const S3ReqHeaders& headers, bool* aws_chunked) {
+  *aws_chunked = false;
+  const std::string* value = headers.Get(kHdrXAmzContentSHA256);
+  if (value != nullptr && value->compare(0, 10, "STREAMING-") == 0) {
+    *aws_chunked = true;
+  }
+  value = headers.Get(kHdrContentEncoding);
+  if (value != nullptr && value->find("aws-chunked") != std::string::npos) {
+    *aws_chunked = true;
+  }
+  return *aws_chunked || !headers.Has(kHdrContentLength);
+}
+
+bool IsSignedPayload(const S3ReqHeaders& headers, std::string* payload_hash) {
+  const std::string* value = headers.Get(kHdrXAmzContentSHA256);
+  if (value == nullptr || value->size() != 64) {
+    // UNSIGNED-PAYLOAD, STREAMING-AWS4-HMAC-SHA256-PAYLOAD...
+    return false;
+  }
+  std::string hash;
+  for (char c : *value) {
+    if (!isxdigit(c)) {
+      return false;
+    }
+    hash.push_back(tolower(c));
+  }
+  payload_hash->swap(hash);
+  return true;
+}
+
+bool IsSignedChunks(const S3ReqHeaders& headers) {
+  static const std::string kSignedChunks = "STREAMING-AWS4-HMAC-SHA256-PAYLOAD";
+  const std::string* value = headers.Get(kHdrXAmzContentSHA256);
+  // Or STREAMING-AWS4-HMAC-SHA256-PAYLOAD-TRAILER
+  return value != nullptr &&
+    value->compare(0, kSignedChunks.size(), kSignedChunks) == 0;
+}
+
+Status SetBlock(zgwstore::ZgwStore* store, ZgwBufferCache* buffer_cache,
+                uint64_t block_id, const char* data, size_t size,
+                BlockCodec codec) {
+  ZgwBuffer block;
+  if (codec != kCodecNone) {
+    // Above the compress bound of both lz4 and zstd
+    buffer_cache->Acquire(1 + size + size / 128 + 1024, &block);
+    EncodeBlock(codec, data, size, block.str());
+  } else {
+    buffer_cache->Acquire(size, &block);
+    block.str()->assign(data, size);
+  }
+  Status s = store->BlockSet(std::to_string(block_id), *block.str());
+  buffer_cache->Release(&block);
+  return s;
+}
+
+Status DispatchBlock(const std::shared_ptr<BlockWriteTracker>& tracker,
+                     zgwstore::ZgwStore* store, ZgwBufferCache* buffer_cache,
+                     uint64_t block_id, const char* data, size_t size,
+                     BlockCodec codec) {
+  if (!tracker) {
+    return SetBlock(store, buffer_cache, block_id, data, size, codec);
+  }
+  Status s = tracker->status();
+  if (!s.ok()) {
+    // A block failed, the object won't be committed
+    return s;
+  }
+  if (g_zgw_block_writer->Submit(tracker, block_id, data, size, codec)) {
+    return Status::OK();
+  }
+  // Window of the upload is full, write in place, keep committed_count
+  // in upload order
+  tracker->Add(block_id);
+  s = SetBlock(store, buffer_cache, block_id, data, size, codec);
+  tracker->Done(block_id, s);
+  return s;
+}
+
+void AwsChunkedDecoder::Reset() {
+  state_ = kChunkHeader;
+  line_.clear();
+  chunk_remain_ = 0;
+  last_chunk_ = false;
+  check_signature_ = false;
+  signature_mismatch_ = false;
+  trailer_.clear();
+  trailer_signature_.clear();
+}
+
+void AwsChunkedDecoder::EnableSignatureCheck(
+    const std::string& signing_key,
+    const std::string& string_to_sign_prefix,
+    const std::string& seed_signature) {
+  check_signature_ = true;
+  signing_key_ = signing_key;
+  string_to_sign_prefix_ = string_to_sign_prefix;
+  prev_signature_ = seed_signature;
+}
+
+std::string AwsChunkedDecoder::Sign(const std::string& string_to_sign) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len = 0;
+  HMAC(EVP_sha256(), signing_key_.data(), signing_key_.size(),
+       reinterpret_cast<const unsigned char*>(string_to_sign.data()),
+       string_to_sign.size(), digest, &digest_len);
+  char buf[EVP_MAX_MD_SIZE * 2 + 1];
+  for (unsigned int i = 0; i < digest_len; i++) {
+    sprintf(buf + i * 2, "%02x", digest[i]);
+  }
+  return std::string(buf, digest_len * 2);
+}
+
+bool AwsChunkedDecoder::VerifyChunkSignature() {
+  // AWS4-HMAC-SHA256-PAYLOAD\n<iso_date>\n<scope>\n<previous-signature>\n
+  // <sha256 of "">\n<sha256 of chunk data>
+  std::string string_to_sign(string_to_sign_prefix_);
+  string_to_sign.append(prev_signature_ + "\n");
+  string_to_sign.append(kEmptySHA256);
+  string_to_sign.append("\n");
+  string_to_sign.append(chunk_sha256_.ToString());
+
+  prev_signature_ = Sign(string_to_sign);
+  return prev_signature_ == chunk_signature_;
+}
+
+bool AwsChunkedDecoder::VerifyTrailerSignature() {
+  // AWS4-HMAC-SHA256-TRAILER\n<iso_date>\n<scope>\n<previous-signature>\n
+  // <sha256 of trailer lines>
+  size_t pos = string_to_sign_prefix_.find('\n');
+  if (pos == std::string::npos) {
+    return false;
+  }
+  std::string string_to_sign("AWS4-HMAC-SHA256-TRAILER");
+  string_to_sign.append(string_to_sign_prefix_, pos, std::string::npos);
+  string_to_sign.append(prev_signature_ + "\n");
+  SHA256Ctx trailer_sha256;
+  trailer_sha256.Init();
+  trailer_sha256.Update(trailer_.data(), trailer_.size());
+  string_to_sign.append(trailer_sha256.ToString());
+
+  return Sign(string_to_sign) == trailer_signature_;
+}
+
+bool AwsChunkedDecoder::ParseChunkHeader() {
+  // 10000;chunk-signature=ad80c730a21e5b8d04586a2213dd63b9a0e99e0e2307b0ade35a65485a288648
+  size_t pos = line_.find(';');
+  if (check_signature_) {
+    static const std::string kSignatureTag = ";chunk-signature=";
+    if (pos == std::string::npos ||
+        line_.compare(pos, kSignatureTag.size(), kSignatureTag) != 0) {
+      return false;
+    }
+    chunk_signature_ = line_.substr(pos + kSignatureTag.size());
+    chunk_sha256_.Init();
+  }
+  std::string hex_size = line_.substr(0, pos);
+  if (hex_size.empty() || hex_size.size() > 15) {
+    return false;
+  }
+  uint64_t size = 0;
+  for (char c : hex_size) {
+    size <<= 4;
+    if (c >= '0' && c <= '9') {
+      size |= c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      size |= c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      size |= c - 'A' + 10;
+    } else {
+      return false;
+    }
+  }
+  chunk_remain_ = size;
+  last_chunk_ = (size == 0);
+  return true;
+}
+
+bool AwsChunkedDecoder::ParseTrailerLine() {
+  if (line_.empty()) {
+    // End of the trailer, none if the last chunk is followed by \r\n
+    if (check_signature_ && !trailer_.empty() &&
+        (trailer_signature_.empty() || !VerifyTrailerSignature())) {
+      signature_mismatch_ = true;
+      return false;
+    }
+    state_ = kFinished;
+    return true;
+  }
+  static const std::string kSignatureTag = "x-amz-trailer-signature:";
+  if (line_.compare(0, kSignatureTag.size(), kSignatureTag) == 0) {
+    trailer_signature_ = line_.substr(kSignatureTag.size());
+    return true;
+  }
+  if (line_.find(':') == std::string::npos) {
+    return false;
+  }
+  trailer_.append(line_);
+  trailer_.push_back('\n');
+  return trailer_.size() <= kMaxChunkHeaderSize;
+}
+
+bool AwsChunkedDecoder::Decode(const char* data, size_t size,
+                               std::string* output) {
+  const char* pos = data;
+  const char* end = data + size;
+  while (pos < end) {
+    switch (state_) {
+      case kChunkHeader:
+      case kTrailer: {
+        const char* lf = static_cast<const char*>(memchr(pos, '\n', end - pos));
+        if (lf == nullptr) {
+          line_.append(pos, end - pos);
+          pos = end;
+          if (line_.size() > kMaxChunkHeaderSize) {
+            return false;
+          }
+          break;
+        }
+        line_.append(pos, lf - pos);
+        pos = lf + 1;
+        if (line_.empty() || line_.back() != '\r') {
+          return false;
+        }
+        line_.pop_back();
+        if (state_ == kTrailer) {
+          if (!ParseTrailerLine()) {
+            return false;
+          }
+          line_.clear();
+          break;
+        }
+        if (!ParseChunkHeader()) {
+          return false;
+        }
+        line_.clear();
+        if (last_chunk_) {
+          // The last chunk has no data, the trailer or \r\n follows
+          if (check_signature_ && !VerifyChunkSignature()) {
+            signature_mismatch_ = true;
+            return false;
+          }
+          state_ = kTrailer;
+        } else {
+          state_ = kChunkData;
+        }
+        break;
+      }
+      case kChunkData: {
+        size_t n = std::min(chunk_remain_, static_cast<uint64_t>(end - pos));
+        output->append(pos, n);
+        if (check_signature_) {
+          chunk_sha256_.Update(pos, n);
+        }
+        pos += n;
+        chunk_remain_ -= n;
+        if (chunk_remain_ == 0) {
+          state_ = kChunkDataEnd;
+        }
+        break;
+      }
+      case kChunkDataEnd: {
+        // Expect \r\n after chunk data
+        line_.push_back(*pos++);
+        if (line_.size() < 2) {
+          break;
+        }
+        if (line_ != "\r\n") {
+          return false;
+        }
+        if (check_signature_ && !VerifyChunkSignature()) {
+          signature_mismatch_ = true;
+          return false;
+        }
+        line_.clear();
+        state_ = kChunkHeader;
+        break;
+      }
+      case kFinished:
+        // Ignore anything after the body
+        pos = end;
+        break;
+    }
+  }
+  return true;
+}
+
+void S3BlockStream::Reset(zgwstore::ZgwStore* store,
+                          ZgwBufferCache* buffer_cache,
+                          const std::string& bucket_name,
+                          const std::string& object_name,
+                          uint64_t block_start, uint64_t block_end,
+                          bool striped, BlockCodec codec) {
+  if (buffer_cache_ != nullptr) {
+    buffer_cache_->Release(&block_buffer_);
+  }
+  store_ = store;
+  buffer_cache_ = buffer_cache;
+  bucket_name_ = bucket_name;
+  object_name_ = object_name;
+  codec_ = codec;
+  block_tracker_.reset();
+  if (striped && g_zgw_block_writer != nullptr) {
+    block_tracker_.reset(new BlockWriteTracker());
+  }
+  group_start_ = block_start;
+  block_start_ = block_start;
+  block_end_ = block_end;
+  group_size_ = 0;
+  total_size_ = 0;
+  data_block_.clear();
+}
+
+Status S3BlockStream::Append(const char* data, size_t size) {
+  std::string* block_buffer = block_buffer_.str();
+  while (size > 0) {
+    if (block_buffer->empty() && size >= zgwstore::kZgwBlockSize) {
+      // Write directly, needn't copy to block_buffer_
+      Status s = WriteBlock(data, zgwstore::kZgwBlockSize);
+      if (!s.ok()) {
+        return s;
+      }
+      data += zgwstore::kZgwBlockSize;
+      size -= zgwstore::kZgwBlockSize;
+      continue;
+    }
+    if (!block_buffer_.acquired()) {
+      buffer_cache_->Acquire(zgwstore::kZgwBlockSize, &block_buffer_);
+    }
+    size_t n = std::min(size, zgwstore::kZgwBlockSize - block_buffer->size());
+    block_buffer->append(data, n);
+    data += n;
+    size -= n;
+    if (block_buffer->size() == zgwstore::kZgwBlockSize) {
+      Status s = WriteBlock(block_buffer->data(), block_buffer->size());
+      if (!s.ok()) {
+        return s;
+      }
+      block_buffer->clear();
+    }
+  }
+  return Status::OK();
+}
+
+Status S3BlockStream::WriteBlock(const char* data, size_t size) {
+  Status s;
+  if (block_start_ >= block_end_) {
+    // Current batch used up
+    CloseGroup();
+    s = store_->AllocateMoreId(bucket_name_, object_name_,
+                               kZgwStreamBlockBatch, &block_end_);
+    if (!s.ok()) {
+      return s;
+    }
+    block_start_ = block_end_ - kZgwStreamBlockBatch;
+    group_start_ = block_start_;
+  }
+
+  s = DispatchBlock(block_tracker_, store_, buffer_cache_, block_start_,
+                    data, size, codec_);
+  if (!s.ok()) {
+    return s;
+  }
+  block_start_++;
+  group_size_ += size;
+  total_size_ += size;
+  return Status::OK();
+}
+
+void S3BlockStream::CloseGroup() {
+  if (block_start_ == group_start_) {
+    // Nothing written in this group
+    return;
+  }
+  char buf[100];
+  sprintf(buf, "%lu-%lu(0,%lu)", group_start_, block_start_ - 1, group_size_);
+  if (!data_block_.empty()) {
+    data_block_.append("|");
+  }
+  data_block_.append(buf);
+  group_start_ = block_start_;
+  group_size_ = 0;
+}
+
+Status S3BlockStream::Finish(uint64_t* data_size, std::string* data_block) {
+  Status s;
+  if (!block_buffer_.str()->empty()) {
+    s = WriteBlock(block_buffer_.str()->data(), block_buffer_.str()->size());
+  }
+  buffer_cache_->Release(&block_buffer_);
+  if (block_tracker_) {
+    // Wait even if failed, blocks are still in flight
+    Status ws = block_tracker_->Wait();
+    if (s.ok()) {
+      s = ws;
+    }
+    if (!ws.ok()) {
+      LOG(ERROR) << "S3BlockStream - BlockWriter error, blocks written in order: "
+        << block_tracker_->committed_count();
+    }
+    block_tracker_.reset();
+  }
+  if (!s.ok()) {
+    return s;
+  }
+
+  CloseGroup();
+  if (data_block_.empty()) {
+    // Empty body, the same as Content-Length: 0
+    char buf[100];
+    sprintf(buf, "%lu-%lu(0,0)", group_start_, group_start_ - 1);
+    data_block_.assign(buf);
+  }
+  *data_size = total_size_;
+  *data_block = data_block_;
+  return Status::OK();
+}
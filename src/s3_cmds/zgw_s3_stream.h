@@ -0,0 +1,157 @@
+#ifndef ZGW_S3_STREAM_H
+#define ZGW_S3_STREAM_H
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "slash/include/slash_status.h"
+#include "src/zgwstore/zgw_store.h"
+#include "src/zgw_block_writer.h"
+#include "src/zgw_buffer_pool.h"
+#include "src/zgw_utils.h"
+#include "src/s3_cmds/zgw_s3_request.h"
+
+using slash::Status;
+
+// Block ids allocated per batch for the body of unknown length
+const int kZgwStreamBlockBatch = 16;
+
+// Body size is unknown until the last byte arrives: no Content-Length,
+// or Content-Length counts the aws-chunked framing
+extern bool IsStreamingBody(const S3ReqHeaders& headers, bool* aws_chunked);
+
+// The body is signed by x-amz-content-sha256 of 64 hex digits, lowercased
+// to payload_hash
+extern bool IsSignedPayload(const S3ReqHeaders& headers,
+                            std::string* payload_hash);
+
+// Chunks of the aws-chunked body are signed, so is the trailer if any
+extern bool IsSignedChunks(const S3ReqHeaders& headers);
+
+// Write one block through a buffer of buffer_cache, framed by codec
+// unless it is kCodecNone
+extern Status SetBlock(zgwstore::ZgwStore* store, ZgwBufferCache* buffer_cache,
+                       uint64_t block_id, const char* data, size_t size,
+                       BlockCodec codec);
+
+// Hand the block to g_zgw_block_writer if tracker is set, write it by
+// SetBlock when the writers are busy or tracker is null. Return the first
+// error of the upload so far, the caller stops writing blocks then
+extern Status DispatchBlock(const std::shared_ptr<BlockWriteTracker>& tracker,
+                            zgwstore::ZgwStore* store,
+                            ZgwBufferCache* buffer_cache, uint64_t block_id,
+                            const char* data, size_t size, BlockCodec codec);
+
+// Strip the aws-chunked framing:
+//   hex-size;chunk-signature=signature\r\n
+//   data\r\n
+//   ...
+//   0;chunk-signature=signature\r\n
+//   trailer-name:value\r\n          (*-TRAILER payloads)
+//   x-amz-trailer-signature:signature\r\n
+//   \r\n
+// Checksums in the trailer are not verified
+class AwsChunkedDecoder {
+ public:
+  AwsChunkedDecoder() {
+    Reset();
+  }
+
+  void Reset();
+  // Verify the signature of every chunk as its data is decoded
+  void EnableSignatureCheck(const std::string& signing_key,
+                            const std::string& string_to_sign_prefix,
+                            const std::string& seed_signature);
+  // Append chunk data to output, return false if body is malformed or
+  // a chunk signature does not match
+  bool Decode(const char* data, size_t size, std::string* output);
+  bool finished() const {
+    return state_ == kFinished;
+  }
+  bool signature_mismatch() const {
+    return signature_mismatch_;
+  }
+
+ private:
+  enum State {
+    kChunkHeader,
+    kChunkData,
+    kChunkDataEnd,
+    kTrailer,
+    kFinished,
+  };
+
+  bool ParseChunkHeader();
+  bool ParseTrailerLine();
+  bool VerifyChunkSignature();
+  bool VerifyTrailerSignature();
+  // Lowercase hex HMAC of string_to_sign by signing_key_
+  std::string Sign(const std::string& string_to_sign);
+
+  State state_;
+  std::string line_;
+  uint64_t chunk_remain_;
+  bool last_chunk_;
+
+  bool check_signature_;
+  bool signature_mismatch_;
+  std::string signing_key_;
+  std::string string_to_sign_prefix_;
+  std::string prev_signature_;
+  std::string chunk_signature_;
+  SHA256Ctx chunk_sha256_;
+  // Trailer lines but the signature, each ends with \n
+  std::string trailer_;
+  std::string trailer_signature_;
+};
+
+// Write a body of unknown length block by block, block ids are allocated
+// in batches as data arrives, each batch becomes a block group of
+// data_block
+class S3BlockStream {
+ public:
+  S3BlockStream()
+      : store_(nullptr),
+        buffer_cache_(nullptr),
+        codec_(kCodecNone),
+        group_start_(0),
+        block_start_(0),
+        block_end_(0),
+        group_size_(0),
+        total_size_(0) {
+  }
+
+  // [block_start, block_end) were allocated by AllocateId for
+  // bucket_name/object_name, so are the batches allocated later
+  void Reset(zgwstore::ZgwStore* store, ZgwBufferCache* buffer_cache,
+             const std::string& bucket_name, const std::string& object_name,
+             uint64_t block_start, uint64_t block_end, bool striped,
+             BlockCodec codec);
+  Status Append(const char* data, size_t size);
+  // Write the last block, wait for all blocks written, and return the
+  // data size and data_block of the object
+  Status Finish(uint64_t* data_size, std::string* data_block);
+
+ private:
+  Status WriteBlock(const char* data, size_t size);
+  void CloseGroup();
+
+  zgwstore::ZgwStore* store_;
+  ZgwBufferCache* buffer_cache_;
+  std::string bucket_name_;
+  std::string object_name_;
+  std::shared_ptr<BlockWriteTracker> block_tracker_;
+  // Partial block, acquired when the first partial block arrives
+  ZgwBuffer block_buffer_;
+  BlockCodec codec_;
+
+  uint64_t group_start_;
+  uint64_t block_start_;
+  uint64_t block_end_;
+  uint64_t group_size_;
+  uint64_t total_size_;
+  std::string data_block_;
+};
+
+#endif
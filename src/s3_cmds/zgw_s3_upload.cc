@@ -0,0 +1,180 @@
+#include "src/s3_cmds/zgw_s3_object.h"
+
+#include <glog/logging.h>
+#include "src/zgwstore/zgw_define.h"
+
+bool S3UploadCmd::InitBody(uint64_t* data_size) {
+  md5_ctx_.Init();
+  block_tracker_.reset();
+  status_ = Status::OK();
+  block_start_ = 0;
+  block_end_ = 0;
+  *data_size = 0;
+
+  if (!buffer_cache_->TryAdmit()) {
+    // Block buffers are used up, the worker thread can't wait for them
+    http_ret_code_ = 503;
+    GenerateErrorXml(kSlowDown);
+    return false;
+  }
+
+  streaming_ = IsStreamingBody(req_headers_, &aws_chunked_);
+  if (streaming_) {
+    // Size is recorded at commit, allocate ids as data arrives
+    block_count_ = kZgwStreamBlockBatch;
+  } else if (!req_headers_.ContentLength(data_size)) {
+    http_ret_code_ = 400;
+    GenerateErrorXml(kInvalidRequest, "Invalid Content-Length.");
+    return false;
+  } else {
+    size_t m = *data_size % zgwstore::kZgwBlockSize;
+    block_count_ = *data_size / zgwstore::kZgwBlockSize + (m > 0 ? 1 : 0);
+  }
+
+  payload_hash_.clear();
+  if (!aws_chunked_ && IsSignedPayload(req_headers_, &payload_hash_)) {
+    // Hashed as the body arrives, checked before commit
+    sha256_ctx_.Init();
+  }
+  return true;
+}
+
+void S3UploadCmd::StartBody(const std::string& bucket_name,
+                            const std::string& object_name,
+                            uint64_t data_size, std::string* data_block) {
+  block_start_ = block_end_ - block_count_;
+  if (streaming_) {
+    chunked_decoder_.Reset();
+    if (IsSignedChunks(req_headers_)) {
+      std::string signing_key, string_to_sign_prefix, seed_signature;
+      s3_auth_.GetChunkSigner(&signing_key, &string_to_sign_prefix,
+                              &seed_signature);
+      chunked_decoder_.EnableSignatureCheck(signing_key,
+                                            string_to_sign_prefix,
+                                            seed_signature);
+    }
+    block_stream_.Reset(store_, buffer_cache_, bucket_name, object_name,
+                        block_start_, block_end_, true, block_codec_);
+    return;
+  }
+  if (g_zgw_block_writer != nullptr && block_count_ > 1) {
+    block_tracker_.reset(new BlockWriteTracker());
+  }
+  char buf[100];
+  sprintf(buf, "%lu-%lu(0,%lu)", block_start_, block_end_ - 1, data_size);
+  data_block->assign(buf);
+}
+
+// Data size from HTTP is 8MB per invocation, or smaller as the last
+void S3UploadCmd::DoReceiveBody(const char* data, size_t data_size) {
+  if (http_ret_code_ != 200) {
+    return;
+  }
+  if (!payload_hash_.empty()) {
+    sha256_ctx_.Update(data, data_size);
+  }
+
+  if (streaming_) {
+    const char* body = data;
+    size_t body_size = data_size;
+    if (aws_chunked_) {
+      decoded_body_.clear();
+      if (!chunked_decoder_.Decode(data, data_size, &decoded_body_)) {
+        if (chunked_decoder_.signature_mismatch()) {
+          http_ret_code_ = 403;
+          GenerateErrorXml(kSignatureDoesNotMatch);
+        } else {
+          http_ret_code_ = 400;
+          GenerateErrorXml(kIncompleteBody);
+        }
+        return;
+      }
+      body = decoded_body_.data();
+      body_size = decoded_body_.size();
+    }
+    md5_ctx_.Update(body, body_size);
+    status_ = block_stream_.Append(body, body_size);
+    if (status_.ok()) {
+      g_zgw_monitor->AddBucketTraffic(bucket_name_, body_size);
+    } else {
+      http_ret_code_ = 500;
+      LOG(ERROR) << request_id_ << " " << cmd_name_ <<
+        "(DoReceiveBody) - BlockStream: " << status_.ToString();
+    }
+    return;
+  }
+
+  char* buf_pos = const_cast<char*>(data);
+  size_t remain_size = data_size;
+  DLOG(INFO) << request_id_ << " " <<
+    bucket_name_ << "/" << object_name_ << " Remain size: " << remain_size;
+
+  while (remain_size > 0) {
+    if (block_start_ >= block_end_) {
+      LOG(WARNING) << request_id_ << " " << cmd_name_ <<
+        " Block error, block_start_: " << block_start_ <<
+        " block_end_: " << block_end_;
+      return;
+    }
+    size_t nwritten = std::min(remain_size, zgwstore::kZgwBlockSize);
+    // Errors of blocks in flight are collected in FinishBody
+    status_ = DispatchBlock(block_tracker_, store_, buffer_cache_,
+                            block_start_++, buf_pos, nwritten, block_codec_);
+    if (status_.ok()) {
+      md5_ctx_.Update(buf_pos, nwritten);
+      g_zgw_monitor->AddBucketTraffic(bucket_name_, nwritten);
+    } else {
+      // Blocks written are reclaimed with the lease of the upload
+      http_ret_code_ = 500;
+      LOG(ERROR) << request_id_ << " " << cmd_name_ <<
+        "(DoReceiveBody) - BlockSet: " << block_start_ - 1 << " :" <<
+        status_.ToString();
+      return;
+    }
+
+    remain_size -= nwritten;
+    buf_pos += nwritten;
+  }
+}
+
+bool S3UploadCmd::FinishBody(uint64_t* data_size, std::string* data_block) {
+  if (streaming_ && http_ret_code_ == 200) {
+    if (aws_chunked_ && !chunked_decoder_.finished()) {
+      http_ret_code_ = 400;
+      GenerateErrorXml(kIncompleteBody);
+    } else {
+      // Record the final size and block groups
+      status_ = block_stream_.Finish(data_size, data_block);
+      if (status_.ok() && req_headers_.Has(kHdrXAmzDecodedContentLength) &&
+          std::to_string(*data_size) !=
+          *req_headers_.Get(kHdrXAmzDecodedContentLength)) {
+        http_ret_code_ = 400;
+        GenerateErrorXml(kIncompleteBody);
+      }
+    }
+  }
+  if (http_ret_code_ == 200 && !payload_hash_.empty() &&
+      sha256_ctx_.ToString() != payload_hash_) {
+    // Blocks written are reclaimed with the lease of uncommitted upload
+    http_ret_code_ = 400;
+    GenerateErrorXml(kXAmzContentSHA256Mismatch);
+  }
+  if (block_tracker_) {
+    // All blocks must be written before the meta is committed
+    Status s = block_tracker_->Wait();
+    if (!s.ok()) {
+      status_ = s;
+      LOG(ERROR) << request_id_ << " " << cmd_name_ <<
+        "(DoAndResponse) - BlockWriter error, blocks written in order: " <<
+        block_tracker_->committed_count();
+    }
+    block_tracker_.reset();
+  }
+  if (http_ret_code_ == 200 && !status_.ok()) {
+    // Error happend while transmiting to zeppelin
+    http_ret_code_ = 500;
+    LOG(ERROR) << request_id_ << " " << cmd_name_ <<
+      "(DoAndResponse) - writing to zp error: " << status_.ToString();
+  }
+  return http_ret_code_ == 200;
+}
@@ -6,22 +6,16 @@
 
 bool UploadPartCmd::DoInitial() {
   http_response_xml_.clear();
-  md5_ctx_.Init();
-
-  size_t data_size = std::stoul(req_headers_["content-length"]);
-  size_t m = data_size % zgwstore::kZgwBlockSize;
-  block_count_ = data_size / zgwstore::kZgwBlockSize + (m > 0 ? 1 : 0);
 
   std::string upload_id = query_params_.at("uploadId");
   std::string part_number = query_params_.at("partNumber");
   std::string virtual_bucket = "__TMPB" + upload_id +
     bucket_name_ + "|" + object_name_;
 
-  request_id_ = md5(bucket_name_ +
-                    object_name_ +
-                    upload_id + 
-                    part_number +
-                    std::to_string(slash::NowMicros()));
+  uint64_t data_size = 0;
+  if (!InitBody(&data_size)) {
+    return false;
+  }
 
   if (!TryAuth()) {
     DLOG(INFO) << request_id_ << " " <<
@@ -29,7 +23,6 @@ bool UploadPartCmd::DoInitial() {
     g_zgw_monitor->AddAuthFailed();
     return false;
   }
-
   DLOG(INFO) << request_id_ << " " <<
     "UploadPart(DoInitial) - " << virtual_bucket <<
     " part_number: " << part_number;
@@ -42,6 +35,9 @@ bool UploadPartCmd::DoInitial() {
   new_object_part_.owner = user_name_;
   new_object_part_.last_modified = 0; // Postpone
   new_object_part_.storage_class = 0; // Unused
+  block_codec_ = BucketBlockCodec(bucket_name_);
+  new_object_part_.codec = block_codec_ != kCodecNone ?
+    zgwstore::kObjectBlockFramed : zgwstore::kObjectBlockRaw;
   new_object_part_.acl = "FULL_CONTROL";
   new_object_part_.upload_id = upload_id;
   new_object_part_.data_block = ""; // Postpone
@@ -50,13 +46,11 @@ bool UploadPartCmd::DoInitial() {
   Status s = store_->AllocateId(user_name_, virtual_bucket, part_number,
                                 block_count_, &block_end_);
   if (s.ok()) {
-    block_start_ = block_end_ - block_count_;
     http_ret_code_ = 200;
-    char buf[100];
-    sprintf(buf, "%lu-%lu(0,%lu)", block_start_, block_end_ - 1, data_size);
-    new_object_part_.data_block.assign(buf);
+    StartBody(virtual_bucket, part_number, data_size,
+              &new_object_part_.data_block);
     DLOG(INFO) << request_id_ << " " <<
-      "UploadPart(DoInitial) - AllocateId: " << buf;
+      "UploadPart(DoInitial) - AllocateId: " << new_object_part_.data_block;
   } else if (s.ToString().find("Bucket NOT Exists") != std::string::npos ||
              s.ToString().find("Bucket Doesn't Belong To This User") !=
              std::string::npos) {
@@ -73,69 +67,33 @@ bool UploadPartCmd::DoInitial() {
   return true;
 }
 
-// Data size from HTTP is 8MB per invocation, or smaller as the last
-void UploadPartCmd::DoReceiveBody(const char* data, size_t data_size) {
-  if (http_ret_code_ != 200) {
-    return;
-  }
-
-  char* buf_pos = const_cast<char*>(data);
-  size_t remain_size = data_size;
-
-  while (remain_size > 0) {
-    if (block_start_ >= block_end_) {
-      // LOG WARNING
-      LOG(WARNING) << "PutObject Block error";
-      return;
+void UploadPartCmd::DoAndResponse(pink::HTTPResponse* resp) {
+  uint64_t data_size = new_object_part_.size;
+  if (FinishBody(&data_size, &new_object_part_.data_block)) {
+    // Write meta
+    new_object_part_.size = data_size;
+    new_object_part_.etag = md5_ctx_.ToString();
+    DLOG(INFO) << request_id_ << " " <<
+      "UploadPart(DoAndResponse) - MD5: " << new_object_part_.etag;
+    if (new_object_part_.etag.empty()) {
+      new_object_part_.etag = "_";
     }
-    size_t nwritten = std::min(remain_size, zgwstore::kZgwBlockSize);
-    status_ = store_->BlockSet(std::to_string(block_start_++),
-                               std::string(buf_pos, nwritten));
-    if (status_.ok()) {
-      md5_ctx_.Update(buf_pos, nwritten);
-      g_zgw_monitor->AddBucketTraffic(bucket_name_, nwritten);
+    new_object_part_.last_modified = slash::NowMicros();
+
+    Status s;
+    if (g_zgw_meta_committer != nullptr) {
+      // Committed in batch with concurrent uploads
+      s = g_zgw_meta_committer->AddObject(new_object_part_);
     } else {
-      http_ret_code_ = 500;
-      LOG(ERROR) << request_id_ << " " <<
-        "UploadPart(DoReceiveBody) - BlockSet error: " << status_.ToString();
-      // TODO (gaodq) delete data already saved
+      s = store_->AddObject(new_object_part_);
     }
-
-    remain_size -= nwritten;
-    buf_pos += nwritten;
-  }
-}
-
-void UploadPartCmd::DoAndResponse(pink::HTTPResponse* resp) {
-  if (http_ret_code_ == 200) {
-    if (!status_.ok()) {
-      // Error happend while transmiting to zeppelin
+    if (!s.ok()) {
       http_ret_code_ = 500;
       LOG(ERROR) << request_id_ << " " <<
-        "UploadPart(DoAndResponse) - BlockSet error: " << status_.ToString();
+        "UploadPart(DoAndResponse) - AddObject error: " << s.ToString();
     } else {
-      // Write meta
-      new_object_part_.etag = md5_ctx_.ToString();
-      DLOG(INFO) << request_id_ << " " <<
-        "UploadPart(DoAndResponse) - MD5: " << new_object_part_.etag;
-      if (new_object_part_.etag.empty()) {
-        new_object_part_.etag = "_";
-      }
-      new_object_part_.last_modified = slash::NowMicros();
-
-      DLOG(INFO) << request_id_ << " " <<
-        "UploadPart(DoAndResponse) - Lock success";
-      status_ = store_->AddObject(new_object_part_);
-      if (!status_.ok()) {
-        http_ret_code_ = 500;
-        LOG(ERROR) << request_id_ << " " <<
-          "UploadPart(DoAndResponse) - AddObject error: " << status_.ToString();
-      } else {
-        DLOG(INFO) << request_id_ << " " <<
-          "UploadPart(DoAndResponse) - UnLock success";
-        resp->SetHeaders("Last-Modified", http_nowtime(new_object_part_.last_modified));
-        resp->SetHeaders("ETag", "\"" + new_object_part_.etag + "\"");
-      }
+      resp->SetHeaders("Last-Modified", http_nowtime(new_object_part_.last_modified));
+      resp->SetHeaders("ETag", "\"" + new_object_part_.etag + "\"");
     }
   }
 
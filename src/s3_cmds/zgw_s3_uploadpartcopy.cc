@@ -15,7 +15,7 @@ bool UploadPartCopyCmd::DoInitial() {
     return false;
   }
 
-  std::string source_path = req_headers_.at("x-amz-copy-source");
+  std::string source_path = *req_headers_.Get(kHdrXAmzCopySource);
   SplitBySecondSlash(source_path, &src_bucket_name_, &src_object_name_);
   if (src_bucket_name_.empty() || src_object_name_.empty()) {
     http_ret_code_ = 400;
@@ -26,12 +26,6 @@ bool UploadPartCopyCmd::DoInitial() {
   upload_id_ = query_params_.at("uploadId");
   part_number_ = query_params_.at("partNumber");
 
-  request_id_ = md5(bucket_name_ +
-                    object_name_ +
-                    upload_id_ + 
-                    part_number_ +
-                    std::to_string(slash::NowMicros()));
-
   DLOG(INFO) << request_id_ << " " <<
     "UploadPartCopy(DoInitial) - " << bucket_name_ << "/" << object_name_ <<
     ", uploadId: " << upload_id_ << " part_number: " << part_number_;
@@ -69,6 +63,7 @@ void UploadPartCopyCmd::DoAndResponse(pink::HTTPResponse* resp) {
       new_object_.owner = user_name_;
       new_object_.last_modified = slash::NowMicros();
       new_object_.storage_class = 0; // Unused
+      new_object_.codec = src_object_.codec;
       new_object_.acl = "FULL_CONTROL";
       new_object_.upload_id = upload_id_;
       new_object_.data_block = src_object_.data_block;
@@ -165,31 +160,24 @@ Status UploadPartCopyCmd::AddBlocksRef(const std::string& upload_id,
       }
     }
   } else {
-    // Sigle block index needn't sorting
-    block_indexes.push_back(data_blocks);
+    // Block groups of single object needn't sorting
+    slash::StringSplit(data_blocks, '|', block_indexes);
   }
 
-  s = store_->Lock();
-  if (!s.ok()) {
-    return s;
-  }
   for (auto& blockg : block_indexes) {
     uint64_t start_block, end_block, start_byte, data_size;
     int ret = sscanf(blockg.c_str(), "%lu-%lu(%lu,%lu)",
                      &start_block, &end_block, &start_byte, &data_size);
-    for (uint64_t b = start_block; b <= end_block; b++) {
-      Status s = store_->BlockRef(std::to_string(b));
-      if (!s.ok()) {
+    if (ret != 4) {
+      continue;
+    }
+    s = store_->BlockRef(start_block, end_block);
+    if (!s.ok()) {
       LOG(ERROR) << request_id_ << " " <<
-        "PutObjectCopy(DoAndResponse) - BlockRef Error: " << data_blocks;
-        return s;
-      }
+        "PutObjectCopy(DoAndResponse) - BlockRef Error: " << blockg;
+      return s;
     }
   }
-  s = store_->UnLock();
-  if (!s.ok()) {
-    return s;
-  }
 
   return Status::OK();
 }
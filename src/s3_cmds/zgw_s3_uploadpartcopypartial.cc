@@ -9,7 +9,7 @@
 
 bool UploadPartCopyPartialCmd::DoInitial() {
   DLOG(INFO) << "UploadPartCopyPartial(DoInitial) - " <<
-    req_headers_.at("x-amz-copy-source-range");
+    *req_headers_.Get(kHdrXAmzCopySourceRange);
   http_response_xml_.clear();
   src_data_block_.clear();
   data_size_ = 0;
@@ -24,7 +24,7 @@ bool UploadPartCopyPartialCmd::DoInitial() {
     return false;
   }
 
-  std::string source_path = req_headers_.at("x-amz-copy-source");
+  std::string source_path = *req_headers_.Get(kHdrXAmzCopySource);
   SplitBySecondSlash(source_path, &src_bucket_name_, &src_object_name_);
   if (src_bucket_name_.empty() || src_object_name_.empty()) {
     http_ret_code_ = 400;
@@ -32,14 +32,6 @@ bool UploadPartCopyPartialCmd::DoInitial() {
     return false;
   }
 
-  request_id_ = md5(bucket_name_ +
-                    object_name_ +
-                    upload_id_ + 
-                    part_number_ +
-                    source_path +
-                    req_headers_.at("x-amz-copy-source-range") +
-                    std::to_string(slash::NowMicros()));
-
   DLOG(INFO) << request_id_ << " " <<
     "UploadPartCopyPartial(DoInitial) - " << bucket_name_ << "/" << object_name_ <<
     ", uploadId: " << upload_id_ << " part_number: " << part_number_;
@@ -84,7 +76,7 @@ void UploadPartCopyPartialCmd::ParseBlocksFrom(const std::vector<std::string>& b
   uint64_t range_start = 0;
   uint64_t range_end = data_size_ - 1;
 
-  http_ret_code_ = ParseRange(req_headers_.at("x-amz-copy-source-range"), data_size_,
+  http_ret_code_ = ParseRange(*req_headers_.Get(kHdrXAmzCopySourceRange), data_size_,
                               &range_start, &range_end);
   if (http_ret_code_ == 400) {
     GenerateErrorXml(kInvalidArgument, "range");
@@ -234,8 +226,8 @@ void UploadPartCopyPartialCmd::DoAndResponse(pink::HTTPResponse* resp) {
           // Sort block indexes load from redis set
           SortBlockIndexes(&sorted_block_indexes);
         } else {
-          // Sigle block index needn't sorting
-          sorted_block_indexes.push_back(src_object_.data_block);
+          // Block groups of single object needn't sorting
+          slash::StringSplit(src_object_.data_block, '|', sorted_block_indexes);
         }
         if (http_ret_code_ == 200) {
           ParseBlocksFrom(sorted_block_indexes);
@@ -254,6 +246,7 @@ void UploadPartCopyPartialCmd::DoAndResponse(pink::HTTPResponse* resp) {
     new_object_.owner = user_name_;
     new_object_.last_modified = 0; // Postpone
     new_object_.storage_class = 0; // Unused
+    new_object_.codec = src_object_.codec;
     new_object_.acl = "FULL_CONTROL";
     new_object_.upload_id = upload_id_;
     new_object_.data_block.clear();
@@ -263,13 +256,24 @@ void UploadPartCopyPartialCmd::DoAndResponse(pink::HTTPResponse* resp) {
     }
 
     // Calc blocks MD5 from blocks_ queue
-    std::string block_buffer(zgwstore::kZgwBlockSize, 0);
+    ZgwBuffer block_buffer, encoded_block;
+    buffer_cache_->Acquire(zgwstore::kZgwBlockSize, &block_buffer);
+    if (src_object_.codec == zgwstore::kObjectBlockFramed) {
+      buffer_cache_->Acquire(zgwstore::kZgwBlockSize + 1, &encoded_block);
+    }
     while (!blocks_.empty() && status_.ok()) {
       std::string block_num = std::to_string(std::get<0>(blocks_.front()));
       uint64_t start_byte = std::get<1>(blocks_.front());
       uint64_t size = std::get<2>(blocks_.front());
       blocks_.pop();
-      status_ = store_->BlockGet(block_num, &block_buffer);
+      if (src_object_.codec == zgwstore::kObjectBlockFramed) {
+        status_ = store_->BlockGet(block_num, encoded_block.str());
+        if (status_.ok()) {
+          status_ = DecodeBlock(*encoded_block.str(), block_buffer.str());
+        }
+      } else {
+        status_ = store_->BlockGet(block_num, block_buffer.str());
+      }
       if (!status_.ok()) {
         LOG(ERROR) << request_id_ << " " <<
           "UploadPartCopyPartial(DoAndResponse) - BlockGet failed: " <<
@@ -277,9 +281,11 @@ void UploadPartCopyPartialCmd::DoAndResponse(pink::HTTPResponse* resp) {
         http_ret_code_ = 500;
         break;
       }
-      md5_ctx_.Update(block_buffer.data() + start_byte, size);
+      md5_ctx_.Update(block_buffer.str()->data() + start_byte, size);
       g_zgw_monitor->AddBucketTraffic(src_bucket_name_, size);
     }
+    buffer_cache_->Release(&encoded_block);
+    buffer_cache_->Release(&block_buffer);
     if (status_.ok()) {
       status_ = AddBlocksRef();
     }
@@ -331,27 +337,21 @@ int UploadPartCopyPartialCmd::DoResponseBody(char* buf, size_t max_size) {
 }
 
 Status UploadPartCopyPartialCmd::AddBlocksRef() {
-  Status s = store_->Lock();
-  if (!s.ok()) {
-    return s;
-  }
+  Status s;
   for (auto& blockg : src_data_block_) {
     uint64_t start_block, end_block, start_byte, data_size;
     int ret = sscanf(blockg.c_str(), "%lu-%lu(%lu,%lu)",
                      &start_block, &end_block, &start_byte, &data_size);
-    for (uint64_t b = start_block; b <= end_block; b++) {
-      s = store_->BlockRef(std::to_string(b));
-      if (!s.ok()) {
+    if (ret != 4) {
+      continue;
+    }
+    s = store_->BlockRef(start_block, end_block);
+    if (!s.ok()) {
       LOG(ERROR) << request_id_ << " " <<
-        "UploadPartCopyPartial(DoAndResponse) - BlockRef Error: " << b;
-        return s;
-      }
+        "UploadPartCopyPartial(DoAndResponse) - BlockRef Error: " << blockg;
+      return s;
     }
   }
-  s = store_->UnLock();
-  if (!s.ok()) {
-    return s;
-  }
 
   return Status::OK();
 }
@@ -1,5 +1,7 @@
 #include "src/s3_cmds/zgw_s3_xml.h"
 
+#include <cstring>
+#include <algorithm>
 #include <exception>
 #include <memory>
 #include <vector>
@@ -160,3 +162,117 @@ void S3XmlDoc::ToString(std::string* res_xml) {
   res_xml->clear();
   print(std::back_inserter(*res_xml), rep_->doc_, 0);
 }
+
+void S3XmlWriter::Append(const char* data, size_t size) {
+  if (out_ != nullptr) {
+    out_->append(data, size);
+  }
+  size_ += size;
+}
+
+void S3XmlWriter::AppendEscaped(const std::string& value) {
+  // Escape the same characters as rapidxml does
+  size_t start = 0;
+  for (size_t i = 0; i < value.size(); i++) {
+    const char* ref;
+    switch (value[i]) {
+      case '<': ref = "&lt;"; break;
+      case '>': ref = "&gt;"; break;
+      case '&': ref = "&amp;"; break;
+      case '\'': ref = "&apos;"; break;
+      case '"': ref = "&quot;"; break;
+      default: continue;
+    }
+    Append(value.data() + start, i - start);
+    Append(ref, strlen(ref));
+    start = i + 1;
+  }
+  Append(value.data() + start, value.size() - start);
+}
+
+void S3XmlWriter::Declaration() {
+  Append("<?", 2);
+  Append(xml_header.data(), xml_header.size());
+  Append("?>", 2);
+}
+
+void S3XmlWriter::StartRoot(const char* name) {
+  Append("<", 1);
+  Append(name, strlen(name));
+  Append(" xmlns=\"", 8);
+  Append(xml_ns.data(), xml_ns.size());
+  Append("\">", 2);
+}
+
+void S3XmlWriter::Start(const char* name) {
+  Append("<", 1);
+  Append(name, strlen(name));
+  Append(">", 1);
+}
+
+void S3XmlWriter::End(const char* name) {
+  Append("</", 2);
+  Append(name, strlen(name));
+  Append(">", 1);
+}
+
+void S3XmlWriter::Element(const char* name, const std::string& value) {
+  Start(name);
+  AppendEscaped(value);
+  End(name);
+}
+
+size_t S3XmlStream::Reset(const PartWriter& part_writer) {
+  S3XmlWriter counter(nullptr);
+  for (size_t i = 0; part_writer(i, &counter); i++) {
+  }
+  part_writer_ = part_writer;
+  data_ = &chunk_;
+  chunk_.clear();
+  part_ = 0;
+  offset_ = 0;
+  return counter.size();
+}
+
+size_t S3XmlStream::Reset(const std::string* xml) {
+  part_writer_ = nullptr;
+  data_ = xml;
+  chunk_.clear();
+  part_ = 0;
+  offset_ = 0;
+  return xml->size();
+}
+
+void S3XmlStream::Clear() {
+  part_writer_ = nullptr;
+  data_ = &chunk_;
+  chunk_.clear();
+  part_ = 0;
+  offset_ = 0;
+}
+
+size_t S3XmlStream::Read(char* buf, size_t max_size) {
+  size_t n = 0;
+  while (n < max_size) {
+    if (offset_ == data_->size()) {
+      if (!part_writer_) {
+        break;
+      }
+      // Write the next part in place of the one sent
+      chunk_.clear();
+      offset_ = 0;
+      S3XmlWriter writer(&chunk_);
+      if (!part_writer_(part_, &writer)) {
+        part_writer_ = nullptr;
+        break;
+      }
+      part_++;
+      continue;
+    }
+    size_t len = std::min(max_size - n, data_->size() - offset_);
+    memcpy(buf + n, data_->data() + offset_, len);
+    offset_ += len;
+    n += len;
+  }
+  return n;
+}
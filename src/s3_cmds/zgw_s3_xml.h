@@ -1,6 +1,7 @@
 #ifndef ZGW_S3_XMLH
 #define ZGW_S3_XMLH
 
+#include <functional>
 #include <string>
 
 class S3XmlDoc;
@@ -43,4 +44,67 @@ class S3XmlDoc {
   Rep* rep_;
 };
 
+// Writes XML text directly, without building a document. A writer
+// without output only counts the bytes that would be written
+class S3XmlWriter {
+ public:
+  explicit S3XmlWriter(std::string* out)
+      : out_(out),
+        size_(0) {
+  }
+
+  void Declaration();
+  // Root element in the S3 namespace
+  void StartRoot(const char* name);
+  void Start(const char* name);
+  void End(const char* name);
+  void Element(const char* name, const std::string& value);
+
+  size_t size() const {
+    return size_;
+  }
+
+ private:
+  void Append(const char* data, size_t size);
+  void AppendEscaped(const std::string& value);
+
+  std::string* out_;
+  size_t size_;
+};
+
+// Response body of a listing, written one part at a time as the body is
+// sent rather than held as a whole. part_writer(i, writer) writes part i
+// and returns false past the last part, it must write the same bytes
+// every time, as the size is taken by a dry run before the first byte
+class S3XmlStream {
+ public:
+  typedef std::function<bool(size_t, S3XmlWriter*)> PartWriter;
+
+  S3XmlStream()
+      : data_(&chunk_),
+        part_(0),
+        offset_(0) {
+  }
+
+  // Start over with the document of part_writer, returns its size
+  size_t Reset(const PartWriter& part_writer);
+  // Start over with xml, borrowed until the next Reset
+  size_t Reset(const std::string* xml);
+  void Clear();
+
+  // Copy the next bytes of the document to buf, 0 at the end
+  size_t Read(char* buf, size_t max_size);
+
+ private:
+  PartWriter part_writer_;
+  const std::string* data_;
+  std::string chunk_;
+  size_t part_;
+  size_t offset_;
+
+  // No copying allowed
+  S3XmlStream(const S3XmlStream&);
+  S3XmlStream& operator=(const S3XmlStream&);
+};
+
 #endif
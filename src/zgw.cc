@@ -18,11 +18,20 @@
 #include "src/zgw_server.h"
 #include "src/zgw_config.h"
 #include "src/zgw_monitor.h"
+#include "src/zgw_block_writer.h"
+#include "src/zgw_meta_committer.h"
+#include "src/zgw_credential_cache.h"
+#include "src/zgw_buffer_pool.h"
 #include "src/zgw_const.h"
 
 ZgwServer* g_zgw_server;
 ZgwConfig* g_zgw_conf;
 ZgwMonitor* g_zgw_monitor;
+ZgwBlockWriter* g_zgw_block_writer = nullptr;
+ZgwMetaCommitter* g_zgw_meta_committer = nullptr;
+zgwstore::GCThread* g_zgw_gc_thread = nullptr;
+ZgwCredentialCache* g_zgw_credential_cache = nullptr;
+ZgwBufferPool* g_zgw_buffer_pool = nullptr;
 
 static void GlogInit() {
   std::string log_path = g_zgw_conf->log_path;
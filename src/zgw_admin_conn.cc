@@ -6,14 +6,21 @@
 #include "slash/include/slash_hash.h"
 #include "src/zgwstore/zgw_define.h"
 #include "src/zgwstore/zgw_store.h"
+#include "src/zgwstore/zgw_store_gc.h"
 #include "src/s3_cmds/zgw_s3_command.h"
 #include "src/zgw_monitor.h"
 #include "src/zgw_utils.h"
 #include "src/zgw_const.h"
 #include "src/zgw_config.h"
+#include "src/zgw_s3_rest.h"
+#include "src/zgw_credential_cache.h"
+#include "src/zgw_buffer_pool.h"
 
 extern ZgwMonitor* g_zgw_monitor;
 extern ZgwConfig* g_zgw_conf;
+extern zgwstore::GCThread* g_zgw_gc_thread;
+extern ZgwCredentialCache* g_zgw_credential_cache;
+extern ZgwBufferPool* g_zgw_buffer_pool;
 
 static const char* S3CommandsToString(S3Commands cmd_type);
 
@@ -68,6 +75,7 @@ bool ZgwAdminHandles::HandleRequest(const pink::HTTPRequest* req) {
                http_ret_code_, s.ToString().c_str());
       result_.assign(buf);
     } else {
+      g_zgw_credential_cache->RequestRefresh();
       http_ret_code_ = 200;
       snprintf(buf, BUFSIZE, "{\"errno\": \"%d\", \"errmsg\": \"\", "
                "\"access_key\": \"%s\", \"secret_key\": \"%s\"}",
@@ -92,6 +100,7 @@ bool ZgwAdminHandles::HandleRequest(const pink::HTTPRequest* req) {
                http_ret_code_, s.ToString().c_str());
       result_.assign(buf);
     } else {
+      g_zgw_credential_cache->RequestRefresh();
       http_ret_code_ = 200;
       snprintf(buf, BUFSIZE, "{\"errno\": \"%d\", \"errmsg\": \"\","
                "\"access_key\": \"%s\", \"secret_key\": \"%s\"}",
@@ -114,6 +123,7 @@ bool ZgwAdminHandles::HandleRequest(const pink::HTTPRequest* req) {
                  s.ToString().c_str());
         result_.assign(buf);
       } else {
+        g_zgw_credential_cache->RequestRefresh();
         http_ret_code_ = 200;
         snprintf(buf, BUFSIZE, "{\"errno\": \"0\", \"errmsg\": \"\"}");
         result_.assign(buf);
@@ -221,7 +231,21 @@ std::string ZgwAdminHandles::GetZgwStatus(bool force) {
   result.append(GenBucketInfo(force));
   result.append("], \"commands_info\": [");
   result.append(GenCommandsInfo());
-  result.append("]}");
+  result.append("]");
+  if (g_zgw_gc_thread != nullptr) {
+    result.append(", \"gc_info\": ");
+    result.append(g_zgw_gc_thread->GCStatus());
+  }
+  if (g_zgw_buffer_pool != nullptr) {
+    result.append(", \"buffer_pool\": ");
+    result.append(g_zgw_buffer_pool->BufferStatus());
+  }
+  if (g_zgw_credential_cache != nullptr) {
+    result.append(", \"rejected_access_keys\": \"");
+    result.append(std::to_string(g_zgw_credential_cache->rejected_keys()));
+    result.append("\"");
+  }
+  result.append("}");
 
   return result;
 }
@@ -231,7 +255,7 @@ void ZgwAdminHandles::Initialize() {
   params_.clear();
   result_.clear();
   http_ret_code_ = 200;
-  store_ = reinterpret_cast<zgwstore::ZgwStore*>(worker_specific_data_);
+  store_ = reinterpret_cast<ZgwWorkerData*>(worker_specific_data_)->store;
 }
 
 static std::string GenRandomStr(int width) {
@@ -0,0 +1,194 @@
+#include "src/zgw_block_writer.h"
+
+#include <glog/logging.h>
+
+static const uint32_t kWriterWaitMs = 100;
+
+void BlockWriteTracker::Add(uint64_t block_id) {
+  slash::MutexLock l(&mu_);
+  pending_++;
+  uncommitted_.push_back(block_id);
+}
+
+bool BlockWriteTracker::TryAdd(uint64_t block_id, uint64_t max_pending) {
+  slash::MutexLock l(&mu_);
+  if (pending_ >= max_pending) {
+    return false;
+  }
+  pending_++;
+  uncommitted_.push_back(block_id);
+  return true;
+}
+
+void BlockWriteTracker::Done(uint64_t block_id, const Status& s) {
+  slash::MutexLock l(&mu_);
+  if (!s.ok() && status_.ok()) {
+    status_ = s;
+  }
+  if (s.ok()) {
+    out_of_order_.insert(block_id);
+    while (!uncommitted_.empty() &&
+           out_of_order_.count(uncommitted_.front())) {
+      out_of_order_.erase(uncommitted_.front());
+      uncommitted_.pop_front();
+      committed_++;
+    }
+  }
+  if (--pending_ == 0) {
+    cond_.SignalAll();
+  }
+}
+
+Status BlockWriteTracker::Wait() {
+  slash::MutexLock l(&mu_);
+  while (pending_ > 0) {
+    cond_.Wait();
+  }
+  return status_;
+}
+
+Status BlockWriteTracker::status() {
+  slash::MutexLock l(&mu_);
+  return status_;
+}
+
+uint64_t BlockWriteTracker::committed_count() {
+  slash::MutexLock l(&mu_);
+  return committed_;
+}
+
+ZgwBlockWriter::WriterThread::~WriterThread() {
+  delete store_;
+}
+
+void* ZgwBlockWriter::WriterThread::ThreadMain() {
+  while (!should_stop()) {
+    BlockTask* task = writer_->NextTask();
+    if (task == nullptr) {
+      continue;
+    }
+
+    const std::string* content = task->content.str();
+    if (task->codec != kCodecNone) {
+      EncodeBlock(task->codec, content->data(), content->size(),
+                  &encoded_block_);
+      content = &encoded_block_;
+    }
+    Status s = store_->BlockSet(std::to_string(task->block_id), *content);
+    if (!s.ok()) {
+      LOG(ERROR) << "BlockWriter - BlockSet: " << task->block_id <<
+        " :" << s.ToString();
+    }
+    task->tracker->Done(task->block_id, s);
+    writer_->FinishTask(task);
+  }
+  return nullptr;
+}
+
+ZgwBlockWriter::ZgwBlockWriter(int max_pending_blocks, int max_upload_blocks,
+                               ZgwBufferPool* buffer_pool)
+    : max_pending_blocks_(max_pending_blocks),
+      max_upload_blocks_(max_upload_blocks),
+      buffer_pool_(buffer_pool),
+      not_empty_(&mu_),
+      pending_blocks_(0) {
+  if (max_pending_blocks_ <= 0) {
+    max_pending_blocks_ = 1;
+  }
+  if (max_upload_blocks_ <= 0) {
+    max_upload_blocks_ = 1;
+  }
+}
+
+ZgwBlockWriter::~ZgwBlockWriter() {
+  Stop();
+  for (auto w : writers_) {
+    delete w;
+  }
+  while (!tasks_.empty()) {
+    BlockTask* task = tasks_.front();
+    tasks_.pop();
+    task->tracker->Done(task->block_id,
+                        Status::IOError("BlockWriter stopped"));
+    delete task;
+  }
+}
+
+int ZgwBlockWriter::StartWriter(zgwstore::ZgwStore* store) {
+  WriterThread* writer = new WriterThread(this, store);
+  int ret = writer->StartThread();
+  if (ret != 0) {
+    delete writer;
+    return ret;
+  }
+  writers_.push_back(writer);
+  return 0;
+}
+
+void ZgwBlockWriter::Stop() {
+  for (auto w : writers_) {
+    if (w->is_running()) {
+      w->StopThread();
+    }
+  }
+}
+
+bool ZgwBlockWriter::Submit(const std::shared_ptr<BlockWriteTracker>& tracker,
+                            uint64_t block_id, const char* data, size_t size,
+                            BlockCodec codec) {
+  if (writers_.empty()) {
+    return false;
+  }
+  BlockTask* task = new BlockTask;
+  if (!buffer_pool_->TryAcquire(size, &task->content)) {
+    // Budget exhausted, the caller writes the block in place
+    delete task;
+    return false;
+  }
+  bool accepted = false;
+  {
+    // Bound the memory of buffered blocks
+    slash::MutexLock l(&mu_);
+    if (pending_blocks_ < max_pending_blocks_ &&
+        tracker->TryAdd(block_id, max_upload_blocks_)) {
+      pending_blocks_++;
+      accepted = true;
+    }
+  }
+  if (!accepted) {
+    // Buffer of the block goes back to the pool
+    delete task;
+    return false;
+  }
+
+  task->tracker = tracker;
+  task->block_id = block_id;
+  task->content.str()->assign(data, size);
+  task->codec = codec;
+
+  // In submit order, whichever writer is idle takes it
+  slash::MutexLock l(&mu_);
+  tasks_.push(task);
+  not_empty_.Signal();
+  return true;
+}
+
+ZgwBlockWriter::BlockTask* ZgwBlockWriter::NextTask() {
+  slash::MutexLock l(&mu_);
+  if (tasks_.empty()) {
+    not_empty_.TimedWait(kWriterWaitMs);
+    if (tasks_.empty()) {
+      return nullptr;
+    }
+  }
+  BlockTask* task = tasks_.front();
+  tasks_.pop();
+  return task;
+}
+
+void ZgwBlockWriter::FinishTask(BlockTask* task) {
+  // Buffer of the block goes back to the pool
+  delete task;
+  slash::MutexLock l(&mu_);
+  pending_blocks_--;
+}
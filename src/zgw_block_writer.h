@@ -0,0 +1,126 @@
+#ifndef ZGW_BLOCK_WRITER_H
+#define ZGW_BLOCK_WRITER_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <queue>
+#include <deque>
+#include <memory>
+
+#include "pink/include/pink_thread.h"
+#include "slash/include/slash_status.h"
+#include "slash/include/slash_mutex.h"
+
+#include "src/zgwstore/zgw_store.h"
+#include "src/zgw_compress.h"
+#include "src/zgw_buffer_pool.h"
+
+using slash::Status;
+
+// Completion accounting of the blocks of one upload, shared by the
+// request and the writers which may outlive it.
+// If a block fails in the middle of an object, blocks dispatched after it
+// are still written, Wait returns the first error and the object is not
+// committed, its blocks are reclaimed with the allocation lease
+class BlockWriteTracker {
+ public:
+  BlockWriteTracker()
+      : cond_(&mu_),
+        pending_(0),
+        committed_(0) {
+  }
+
+  void Add(uint64_t block_id);
+  // Add unless max_pending blocks of the upload are in flight
+  bool TryAdd(uint64_t block_id, uint64_t max_pending);
+  void Done(uint64_t block_id, const Status& s);
+
+  // Wait until all dispatched blocks finished, return the first error,
+  // committed_count() is the number of blocks written in upload order.
+  // Only blocks of this upload are waited for, at most the window of
+  // ZgwBlockWriter, so the wait is about one BlockSet
+  Status Wait();
+  // The first error so far, the upload stops dispatching blocks
+  Status status();
+  uint64_t committed_count();
+
+ private:
+  slash::Mutex mu_;
+  slash::CondVar cond_;
+  uint64_t pending_;
+  uint64_t committed_;
+  // Dispatched but not committed blocks in upload order, block ids are
+  // not contiguous when allocated in batches
+  std::deque<uint64_t> uncommitted_;
+  std::set<uint64_t> out_of_order_;
+  Status status_;
+};
+
+// Write blocks of large uploads by several writer threads, each of them
+// owns a zeppelin client. Blocks of all uploads go through one FIFO queue
+// taken by whichever writer is idle
+class ZgwBlockWriter {
+ public:
+  // Blocks are copied to the buffers of buffer_pool, at most
+  // max_upload_blocks of one upload are buffered
+  ZgwBlockWriter(int max_pending_blocks, int max_upload_blocks,
+                 ZgwBufferPool* buffer_pool);
+  ~ZgwBlockWriter();
+
+  // Launch one more writer thread, take the ownership of store
+  int StartWriter(zgwstore::ZgwStore* store);
+  void Stop();
+
+  // Never blocks: return false if max_upload_blocks of this upload or
+  // max_pending_blocks of all are buffered, or the buffer budget is
+  // exhausted, then the caller writes the block itself, so a fast client
+  // is slowed down by its own writes only.
+  // Blocks are framed and compressed by the writer unless codec is
+  // kCodecNone
+  bool Submit(const std::shared_ptr<BlockWriteTracker>& tracker,
+              uint64_t block_id, const char* data, size_t size,
+              BlockCodec codec = kCodecNone);
+
+ private:
+  struct BlockTask {
+    std::shared_ptr<BlockWriteTracker> tracker;
+    uint64_t block_id;
+    ZgwBuffer content;
+    BlockCodec codec;
+  };
+
+  class WriterThread : public pink::Thread {
+   public:
+    WriterThread(ZgwBlockWriter* writer, zgwstore::ZgwStore* store)
+        : writer_(writer),
+          store_(store) {
+      set_thread_name("BlockWriter");
+    }
+    virtual ~WriterThread();
+
+   private:
+    virtual void* ThreadMain() override;
+
+    ZgwBlockWriter* writer_;
+    zgwstore::ZgwStore* store_;
+    std::string encoded_block_;
+  };
+
+  // Wait a while for the next block, nullptr if none
+  BlockTask* NextTask();
+  void FinishTask(BlockTask* task);
+
+  int max_pending_blocks_;
+  int max_upload_blocks_;
+  ZgwBufferPool* buffer_pool_;
+  std::vector<WriterThread*> writers_;
+
+  slash::Mutex mu_;
+  slash::CondVar not_empty_;
+  std::queue<BlockTask*> tasks_;
+  // Queued and being written
+  int pending_blocks_;
+};
+
+#endif
@@ -0,0 +1,239 @@
+#include "src/zgw_buffer_pool.h"
+
+#include <algorithm>
+#include <map>
+
+#include <glog/logging.h>
+
+#include "src/zgwstore/zgw_define.h"
+
+// Room for the codec byte and the compress bound of an encoded block
+static const size_t kEncodedBlockSlack = 64 * 1024;
+
+static const size_t kClassSizes[ZgwBufferPool::kNumSizeClasses] = {
+  64 * 1024,
+  256 * 1024,
+  zgwstore::kZgwBlockSize + kEncodedBlockSlack,
+};
+
+ZgwBuffer::~ZgwBuffer() {
+  if (pool_ != nullptr) {
+    pool_->Release(this);
+  }
+}
+
+ZgwBufferPool::ZgwBufferPool(uint64_t budget_bytes)
+    : budget_bytes_(budget_bytes),
+      charged_bytes_(0),
+      reject_count_(0),
+      overcommit_count_(0) {
+}
+
+ZgwBufferPool::~ZgwBufferPool() {
+  if (charged_bytes_ > 0) {
+    uint64_t idle_bytes = 0;
+    for (int i = 0; i < kNumSizeClasses; i++) {
+      idle_bytes += idle_[i].size() * kClassSizes[i];
+    }
+    if (charged_bytes_ > idle_bytes) {
+      LOG(WARNING) << "BufferPool - " << charged_bytes_ - idle_bytes <<
+        " bytes not released";
+    }
+  }
+}
+
+int ZgwBufferPool::SizeClass(size_t size) {
+  for (int i = 0; i < kNumSizeClasses; i++) {
+    if (size <= kClassSizes[i]) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+size_t ZgwBufferPool::ClassSize(int size_class) {
+  return kClassSizes[size_class];
+}
+
+bool ZgwBufferPool::TryCharge(size_t size) {
+  if (budget_bytes_ == 0 || charged_bytes_ + size <= budget_bytes_) {
+    charged_bytes_ += size;
+    return true;
+  }
+  // Idle buffers of other classes make room for this one
+  for (int i = kNumSizeClasses - 1; i >= 0; i--) {
+    while (!idle_[i].empty() && charged_bytes_ + size > budget_bytes_) {
+      idle_[i].pop_back();
+      charged_bytes_ -= kClassSizes[i];
+    }
+  }
+  if (charged_bytes_ + size <= budget_bytes_) {
+    charged_bytes_ += size;
+    return true;
+  }
+  return false;
+}
+
+void ZgwBufferPool::Uncharge(size_t size) {
+  charged_bytes_ = charged_bytes_ > size ? charged_bytes_ - size : 0;
+}
+
+bool ZgwBufferPool::TryAdmit() {
+  if (budget_bytes_ == 0) {
+    return true;
+  }
+  uint64_t idle_bytes = 0;
+  slash::MutexLock l(&mu_);
+  for (int i = 0; i < kNumSizeClasses; i++) {
+    idle_bytes += idle_[i].size() * kClassSizes[i];
+  }
+  if (charged_bytes_ - std::min(charged_bytes_, idle_bytes) < budget_bytes_) {
+    return true;
+  }
+  reject_count_++;
+  return false;
+}
+
+bool ZgwBufferPool::Get(size_t size, bool overcommit, ZgwBuffer* buf) {
+  int size_class = SizeClass(size);
+  size_t charge = size_class < 0 ? size : kClassSizes[size_class];
+  if (buf->acquired()) {
+    if (charge <= buf->charge_) {
+      buf->str_.clear();
+      return true;
+    }
+    Release(buf);
+  }
+
+  std::string str;
+  {
+    slash::MutexLock l(&mu_);
+    if (size_class >= 0 && !idle_[size_class].empty()) {
+      str.swap(idle_[size_class].back());
+      idle_[size_class].pop_back();
+    } else if (!TryCharge(charge)) {
+      if (!overcommit) {
+        return false;
+      }
+      // Waiting would block the worker thread with the buffers it holds
+      overcommit_count_++;
+      charged_bytes_ += charge;
+      LOG(WARNING) << "BufferPool - Budget exhausted, " << charged_bytes_ <<
+        " bytes charged";
+    }
+  }
+
+  // Allocate out of the lock
+  str.clear();
+  str.reserve(charge);
+  buf->str_.swap(str);
+  buf->pool_ = this;
+  buf->size_class_ = size_class;
+  buf->charge_ = charge;
+  return true;
+}
+
+void ZgwBufferPool::Acquire(size_t size, ZgwBuffer* buf) {
+  Get(size, true, buf);
+}
+
+bool ZgwBufferPool::TryAcquire(size_t size, ZgwBuffer* buf) {
+  return Get(size, false, buf);
+}
+
+void ZgwBufferPool::Release(ZgwBuffer* buf) {
+  if (!buf->acquired()) {
+    return;
+  }
+  std::string str;
+  str.swap(buf->str_);
+  int size_class = buf->size_class_;
+  // Drop the buffer grown beyond its class, its charge is out of date
+  bool reusable = size_class >= 0 &&
+    str.capacity() >= kClassSizes[size_class] &&
+    str.capacity() <= kClassSizes[size_class] + kEncodedBlockSlack;
+  {
+    slash::MutexLock l(&mu_);
+    if (reusable && idle_[size_class].size() < kMaxIdleBuffers &&
+        (budget_bytes_ == 0 || charged_bytes_ <= budget_bytes_)) {
+      str.clear();
+      idle_[size_class].push_back(std::string());
+      idle_[size_class].back().swap(str);
+    } else {
+      Uncharge(buf->charge_);
+    }
+  }
+  buf->pool_ = nullptr;
+  buf->size_class_ = -1;
+  buf->charge_ = 0;
+}
+
+std::string ZgwBufferPool::BufferStatus() {
+  const char* format = "{\
+      \"budget_bytes\": \"%lu\",\
+      \"charged_bytes\": \"%lu\",\
+      \"idle_bytes\": \"%lu\",\
+      \"rejects\": \"%lu\",\
+      \"overcommits\": \"%lu\"}";
+
+  uint64_t charged_bytes, idle_bytes = 0;
+  {
+    slash::MutexLock l(&mu_);
+    charged_bytes = charged_bytes_;
+    for (int i = 0; i < kNumSizeClasses; i++) {
+      idle_bytes += idle_[i].size() * kClassSizes[i];
+    }
+  }
+  char buf[512];
+  snprintf(buf, sizeof(buf), format,
+           budget_bytes_, charged_bytes, idle_bytes, reject_count_.load(),
+           overcommit_count_.load());
+  return std::string(buf);
+}
+
+ZgwBufferCache::~ZgwBufferCache() {
+  for (int i = 0; i < ZgwBufferPool::kNumSizeClasses; i++) {
+    for (auto& str : idle_[i]) {
+      ZgwBuffer buf;
+      buf.str_.swap(str);
+      buf.pool_ = pool_;
+      buf.size_class_ = i;
+      buf.charge_ = kClassSizes[i];
+      pool_->Release(&buf);
+    }
+  }
+}
+
+void ZgwBufferCache::Acquire(size_t size, ZgwBuffer* buf) {
+  int size_class = ZgwBufferPool::SizeClass(size);
+  if (buf->acquired() || size_class < 0 || idle_[size_class].empty()) {
+    pool_->Acquire(size, buf);
+    return;
+  }
+  std::string& str = idle_[size_class].back();
+  str.clear();
+  buf->str_.swap(str);
+  idle_[size_class].pop_back();
+  buf->pool_ = pool_;
+  buf->size_class_ = size_class;
+  buf->charge_ = kClassSizes[size_class];
+}
+
+void ZgwBufferCache::Release(ZgwBuffer* buf) {
+  if (!buf->acquired()) {
+    return;
+  }
+  int size_class = buf->size_class_;
+  if (buf->pool_ != pool_ || size_class < 0 ||
+      idle_[size_class].size() >= kMaxIdleBuffers ||
+      buf->str_.capacity() < kClassSizes[size_class] ||
+      buf->str_.capacity() > kClassSizes[size_class] + kEncodedBlockSlack) {
+    buf->pool_->Release(buf);
+    return;
+  }
+  idle_[size_class].push_back(std::string());
+  idle_[size_class].back().swap(buf->str_);
+  buf->pool_ = nullptr;
+  buf->size_class_ = -1;
+  buf->charge_ = 0;
+}
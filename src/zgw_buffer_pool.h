@@ -0,0 +1,130 @@
+#ifndef ZGW_BUFFER_POOL_H
+#define ZGW_BUFFER_POOL_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "slash/include/slash_mutex.h"
+
+class ZgwBufferPool;
+class ZgwBufferCache;
+
+// Buffer of one block, its memory is charged to the budget of
+// ZgwBufferPool from Acquire until Release. The string may be filled in
+// any way, the charge stays that of the acquired size class
+class ZgwBuffer {
+ public:
+  ZgwBuffer()
+      : pool_(nullptr),
+        size_class_(-1),
+        charge_(0) {
+  }
+  // Give the memory back to the pool if not released
+  ~ZgwBuffer();
+
+  std::string* str() {
+    return &str_;
+  }
+  const std::string* str() const {
+    return &str_;
+  }
+  bool acquired() const {
+    return pool_ != nullptr;
+  }
+
+ private:
+  friend class ZgwBufferPool;
+  friend class ZgwBufferCache;
+
+  std::string str_;
+  ZgwBufferPool* pool_;
+  int size_class_;
+  size_t charge_;
+
+  // No copying allowed
+  ZgwBuffer(const ZgwBuffer&);
+  ZgwBuffer& operator=(const ZgwBuffer&);
+};
+
+// Idle buffers in size classes shared by all threads, and the budget of
+// the bytes held by all buffers, idle or not. Buffers are acquired on
+// pink worker threads, which must not block: a request is turned away by
+// TryAdmit before it holds any buffer while the budget is exhausted, and
+// a request already admitted goes over the budget rather than waiting
+class ZgwBufferPool {
+ public:
+  static const int kNumSizeClasses = 3;
+
+  // No limit if budget_bytes is 0
+  explicit ZgwBufferPool(uint64_t budget_bytes);
+  ~ZgwBufferPool();
+
+  // Size class of size, -1 if larger than any class
+  static int SizeClass(size_t size);
+  static size_t ClassSize(int size_class);
+
+  // False if the buffers in use reach the budget, the caller replies
+  // 503 SlowDown. Counted in rejects
+  bool TryAdmit();
+  // Buffer of at least size bytes capacity, empty. Goes over the budget
+  // if exhausted, counted in overcommits
+  void Acquire(size_t size, ZgwBuffer* buf);
+  // Buffer as Acquire, or false if the budget is exhausted
+  bool TryAcquire(size_t size, ZgwBuffer* buf);
+  void Release(ZgwBuffer* buf);
+
+  // JSON object of budget, usage, rejects and overcommits
+  std::string BufferStatus();
+
+ private:
+  friend class ZgwBufferCache;
+
+  // Idle buffers kept for each size class
+  static const size_t kMaxIdleBuffers = 64;
+
+  // Charge size bytes, free idle buffers of other classes if needed,
+  // false if the budget is still exhausted. Called with mu_ held
+  bool TryCharge(size_t size);
+  void Uncharge(size_t size);
+  // Take an idle buffer or charge a new one, false if the budget is
+  // exhausted unless overcommit
+  bool Get(size_t size, bool overcommit, ZgwBuffer* buf);
+
+  uint64_t budget_bytes_;
+  slash::Mutex mu_;
+  uint64_t charged_bytes_;
+  std::vector<std::string> idle_[kNumSizeClasses];
+
+  // Stats
+  std::atomic<uint64_t> reject_count_;
+  std::atomic<uint64_t> overcommit_count_;
+};
+
+// Idle buffers of one thread, reused without locking, buffers beyond
+// the limit go back to the pool
+class ZgwBufferCache {
+ public:
+  explicit ZgwBufferCache(ZgwBufferPool* pool)
+      : pool_(pool) {
+  }
+  ~ZgwBufferCache();
+
+  bool TryAdmit() {
+    return pool_->TryAdmit();
+  }
+  void Acquire(size_t size, ZgwBuffer* buf);
+  void Release(ZgwBuffer* buf);
+
+ private:
+  static const size_t kMaxIdleBuffers = 1;
+
+  ZgwBufferPool* pool_;
+  std::vector<std::string> idle_[ZgwBufferPool::kNumSizeClasses];
+
+  // No copying allowed
+  ZgwBufferCache(const ZgwBufferCache&);
+  ZgwBufferCache& operator=(const ZgwBufferCache&);
+};
+
+#endif
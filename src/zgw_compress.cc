@@ -0,0 +1,87 @@
+#include "src/zgw_compress.h"
+
+#include <map>
+#include <lz4.h>
+#include <zstd.h>
+
+#include "src/zgw_config.h"
+#include "src/zgwstore/zgw_define.h"
+
+extern ZgwConfig* g_zgw_conf;
+
+static const int kZstdLevel = 3;
+
+BlockCodec BucketBlockCodec(const std::string& bucket_name) {
+  auto iter = g_zgw_conf->compress_buckets.find(bucket_name);
+  if (iter == g_zgw_conf->compress_buckets.end()) {
+    return kCodecNone;
+  }
+  if (iter->second == "lz4") {
+    return kCodecLZ4;
+  } else if (iter->second == "zstd") {
+    return kCodecZstd;
+  }
+  return kCodecNone;
+}
+
+void EncodeBlock(BlockCodec codec, const char* data, size_t size,
+                 std::string* output) {
+  output->clear();
+  size_t compressed_size = 0;
+  if (codec == kCodecLZ4) {
+    output->resize(1 + LZ4_compressBound(size));
+    int ret = LZ4_compress_default(data, &(*output)[1], size,
+                                   output->size() - 1);
+    compressed_size = ret > 0 ? ret : 0;
+  } else if (codec == kCodecZstd) {
+    output->resize(1 + ZSTD_compressBound(size));
+    size_t ret = ZSTD_compress(&(*output)[1], output->size() - 1,
+                               data, size, kZstdLevel);
+    compressed_size = ZSTD_isError(ret) ? 0 : ret;
+  }
+
+  if (compressed_size == 0 || compressed_size >= size) {
+    // Incompressible
+    output->assign(1, static_cast<char>(kCodecNone));
+    output->append(data, size);
+    return;
+  }
+  (*output)[0] = static_cast<char>(codec);
+  output->resize(1 + compressed_size);
+}
+
+Status DecodeBlock(const std::string& input, std::string* output) {
+  if (input.empty()) {
+    return Status::Corruption("Empty block");
+  }
+  const char* data = input.data() + 1;
+  size_t size = input.size() - 1;
+  switch (static_cast<BlockCodec>(input[0])) {
+    case kCodecNone:
+      output->assign(data, size);
+      return Status::OK();
+    case kCodecLZ4: {
+      output->resize(zgwstore::kZgwBlockSize);
+      int ret = LZ4_decompress_safe(data, &(*output)[0], size,
+                                    zgwstore::kZgwBlockSize);
+      if (ret < 0) {
+        return Status::Corruption("LZ4 decompress failed");
+      }
+      output->resize(ret);
+      return Status::OK();
+    }
+    case kCodecZstd: {
+      output->resize(zgwstore::kZgwBlockSize);
+      size_t ret = ZSTD_decompress(&(*output)[0], zgwstore::kZgwBlockSize,
+                                   data, size);
+      if (ZSTD_isError(ret)) {
+        return Status::Corruption(std::string("Zstd decompress failed: ") +
+                                  ZSTD_getErrorName(ret));
+      }
+      output->resize(ret);
+      return Status::OK();
+    }
+    default:
+      return Status::Corruption("Unknown block codec");
+  }
+}
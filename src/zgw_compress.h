@@ -0,0 +1,26 @@
+#ifndef ZGW_COMPRESS_H
+#define ZGW_COMPRESS_H
+
+#include <string>
+
+#include "slash/include/slash_status.h"
+
+using slash::Status;
+
+// The first byte of a block of kObjectBlockFramed object
+enum BlockCodec {
+  kCodecNone = 0,
+  kCodecLZ4 = 1,
+  kCodecZstd = 2,
+};
+
+// Codec configured by compress_buckets, kCodecNone if not compressed
+extern BlockCodec BucketBlockCodec(const std::string& bucket_name);
+
+// Frame one block with its codec, stored uncompressed if compression
+// does not shrink it
+extern void EncodeBlock(BlockCodec codec, const char* data, size_t size,
+                        std::string* output);
+extern Status DecodeBlock(const std::string& input, std::string* output);
+
+#endif
@@ -14,13 +14,24 @@ ZgwConfig::ZgwConfig(std::string path)
         redis_passwd("_"),
         server_ip("0.0.0.0"),
         server_port(8099),
+        gateway_id(0),
         keepalive_timeout(30),
         admin_port(8199),
         daemonize(false),
         minloglevel(0),
         worker_num(2),
         max_clients(5000),
+        credential_refresh_sec(10),
         enable_gc(false),
+        gc_worker_num(2),
+        gc_batch_size(64),
+        gc_max_blocks_per_sec(1000),
+        block_writer_num(0),
+        block_writer_max_pending(64),
+        block_writer_upload_window(4),
+        block_buffer_budget_mb(1024),
+        meta_group_commit(false),
+        meta_commit_max_batch(64),
         public_read(false),
         admin_auth("xxx"),
         log_path("./log"),
@@ -51,13 +62,40 @@ int ZgwConfig::LoadConf() {
   // Server info
   b_conf->GetConfStr("server_ip", &server_ip);
   b_conf->GetConfInt("server_port", &server_port);
+  b_conf->GetConfInt("gateway_id", &gateway_id);
   b_conf->GetConfInt("keepalive_timeout", &keepalive_timeout);
   b_conf->GetConfInt("admin_port", &admin_port);
   b_conf->GetConfBool("daemonize", &daemonize);
   b_conf->GetConfInt("minloglevel", &minloglevel);
   b_conf->GetConfInt("worker_num", &worker_num);
   b_conf->GetConfInt("max_clients", &max_clients);
+  b_conf->GetConfInt("credential_refresh_sec", &credential_refresh_sec);
   b_conf->GetConfBool("enable_gc", &enable_gc);
+  b_conf->GetConfInt("gc_worker_num", &gc_worker_num);
+  b_conf->GetConfInt("gc_batch_size", &gc_batch_size);
+  b_conf->GetConfInt("gc_max_blocks_per_sec", &gc_max_blocks_per_sec);
+  b_conf->GetConfInt("block_writer_num", &block_writer_num);
+  b_conf->GetConfInt("block_writer_max_pending", &block_writer_max_pending);
+  b_conf->GetConfInt("block_writer_upload_window",
+                     &block_writer_upload_window);
+  b_conf->GetConfInt("block_buffer_budget_mb", &block_buffer_budget_mb);
+  b_conf->GetConfBool("meta_group_commit", &meta_group_commit);
+  b_conf->GetConfInt("meta_commit_max_batch", &meta_commit_max_batch);
+  std::string compress_buckets_str;
+  b_conf->GetConfStr("compress_buckets", &compress_buckets_str);
+  std::vector<std::string> items;
+  slash::StringSplit(compress_buckets_str, ',', items);
+  for (auto& item : items) {
+    size_t pos = item.find(':');
+    std::string bucket_name = slash::StringTrim(item.substr(0, pos));
+    std::string codec = pos == std::string::npos ? "" :
+      slash::StringTrim(item.substr(pos + 1));
+    if (bucket_name.empty() || (codec != "lz4" && codec != "zstd")) {
+      std::cerr << "Invalid compress_buckets item: " << item << std::endl;
+      return -1;
+    }
+    compress_buckets[bucket_name] = codec;
+  }
   b_conf->GetConfBool("public_read", &public_read);
   b_conf->GetConfStr("admin_auth", &admin_auth);
 
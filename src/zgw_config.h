@@ -2,6 +2,7 @@
 #define ZGW_CONFIG_H
 
 #include <string>
+#include <map>
 
 #include "slash/include/base_conf.h"
 
@@ -22,6 +23,9 @@ struct ZgwConfig {
 
   std::string server_ip;
   int server_port;
+  // Distinct for each gateway, part of request ids, 0 to derive from
+  // hostname and server_port
+  int gateway_id;
   int keepalive_timeout;
   int admin_port;
   bool daemonize;
@@ -29,7 +33,22 @@ struct ZgwConfig {
   int cron_interval;
   int worker_num;
   int max_clients;
+  int credential_refresh_sec;
   bool enable_gc;
+  int gc_worker_num;
+  int gc_batch_size;
+  int gc_max_blocks_per_sec;
+  int block_writer_num;
+  int block_writer_max_pending;
+  // Blocks of one upload buffered by block writers, the request thread
+  // writes the block itself beyond it
+  int block_writer_upload_window;
+  // Memory of all block buffers, 0 for no limit
+  int block_buffer_budget_mb;
+  bool meta_group_commit;
+  int meta_commit_max_batch;
+  // bucket name -> lz4 or zstd
+  std::map<std::string, std::string> compress_buckets;
   bool public_read;
   std::string admin_auth;
 
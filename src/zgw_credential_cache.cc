@@ -0,0 +1,118 @@
+#include "src/zgw_credential_cache.h"
+
+#include <vector>
+
+#include <glog/logging.h>
+#include "slash/include/env.h"
+
+static const uint32_t kRefreshWaitMs = 100;
+// Refreshes requested by unknown keys or admin are at most one per second
+static const uint64_t kMinRefreshIntervalUs = 1000000;
+static const uint64_t kNegativeKeyTTLUs = 60 * 1000000;
+
+Status ZgwCredentialCache::StartThread(zgwstore::ZgwStore* store) {
+  store_ = store;
+  Status s = Refresh();
+  if (!s.ok()) {
+    return s;
+  }
+  if (Thread::StartThread() != 0) {
+    return Status::Corruption("Launch CredentialCache failed");
+  }
+  return Status::OK();
+}
+
+void ZgwCredentialCache::RequestRefresh() {
+  slash::MutexLock l(&mu_);
+  refresh_requested_ = true;
+  cond_.Signal();
+}
+
+bool ZgwCredentialCache::Lookup(const std::string& access_key,
+                                std::string* user_name,
+                                std::string* secret_key) {
+  // Version is bumped after publishing, load it first
+  uint64_t version = version_.load();
+  std::shared_ptr<const CredentialMap> snapshot = std::atomic_load(&snapshot_);
+  auto iter = snapshot->find(access_key);
+  if (iter == snapshot->end()) {
+    rejected_keys_++;
+    uint64_t now = slash::NowMicros();
+    NegativeKey negative;
+    if (negative_keys_.Lookup(access_key, &negative) &&
+        negative.version == version && negative.expire_time > now) {
+      return false;
+    }
+    negative.version = version;
+    negative.expire_time = now + kNegativeKeyTTLUs;
+    negative_keys_.Insert(access_key, negative);
+    RequestRefresh();
+    return false;
+  }
+  user_name->assign(iter->second.first);
+  secret_key->assign(iter->second.second);
+  return true;
+}
+
+Status ZgwCredentialCache::Refresh() {
+  std::vector<zgwstore::User> all_users;
+  Status s = store_->ListUsers(&all_users);
+  if (!s.ok()) {
+    return s;
+  }
+  std::shared_ptr<CredentialMap> credentials =
+    std::make_shared<CredentialMap>();
+  for (auto& user : all_users) {
+    for (auto& key_pair : user.key_pairs) {
+      credentials->insert(std::make_pair(key_pair.first,
+                          std::make_pair(user.display_name, key_pair.second)));
+    }
+  }
+  latest_refresh_time_ = slash::NowMicros();
+  Publish(credentials);
+  return Status::OK();
+}
+
+void ZgwCredentialCache::Publish(
+    std::shared_ptr<const CredentialMap> credentials) {
+  // Readers keep the old snapshot if nothing changed
+  std::shared_ptr<const CredentialMap> old = std::atomic_load(&snapshot_);
+  if (*old == *credentials) {
+    return;
+  }
+  std::atomic_store(&snapshot_, credentials);
+  version_++;
+  // Some of the unknown keys may be valid now
+  negative_keys_.Clear();
+  LOG(INFO) << "CredentialCache - " << credentials->size() <<
+    " access keys loaded";
+}
+
+void* ZgwCredentialCache::ThreadMain() {
+  while (!should_stop()) {
+    bool refresh;
+    {
+      slash::MutexLock l(&mu_);
+      uint64_t elapsed = slash::NowMicros() - latest_refresh_time_;
+      if (!refresh_requested_ || elapsed < kMinRefreshIntervalUs) {
+        cond_.TimedWait(kRefreshWaitMs);
+        elapsed = slash::NowMicros() - latest_refresh_time_;
+      }
+      refresh = elapsed >= refresh_interval_us_ ||
+        (refresh_requested_ && elapsed >= kMinRefreshIntervalUs);
+      if (refresh) {
+        refresh_requested_ = false;
+      }
+    }
+    if (!refresh) {
+      continue;
+    }
+    Status s = Refresh();
+    if (!s.ok()) {
+      // Serve with the latest snapshot, retry in the next interval
+      latest_refresh_time_ = slash::NowMicros();
+      LOG(ERROR) << "CredentialCache - Refresh error: " << s.ToString();
+    }
+  }
+  return nullptr;
+}
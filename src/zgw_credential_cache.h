@@ -0,0 +1,89 @@
+#ifndef ZGW_CREDENTIAL_CACHE_H
+#define ZGW_CREDENTIAL_CACHE_H
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "pink/include/pink_thread.h"
+#include "slash/include/slash_status.h"
+#include "slash/include/slash_mutex.h"
+
+#include "src/zgwstore/zgw_store.h"
+#include "src/zgw_lru_cache.h"
+
+using slash::Status;
+
+// access_key -> (user_name, secret_key)
+typedef std::map<std::string, std::pair<std::string, std::string>>
+  CredentialMap;
+
+// Credentials of all users published as immutable snapshots, readers
+// take the latest snapshot and never wait for the refresh done by the
+// background thread. Unknown access keys are remembered for a while, so
+// repeated bad keys neither refresh nor wait for anything
+class ZgwCredentialCache : public pink::Thread {
+ public:
+  explicit ZgwCredentialCache(int refresh_interval_s)
+      : store_(nullptr),
+        refresh_interval_us_(
+          static_cast<uint64_t>(refresh_interval_s > 0 ? refresh_interval_s : 1) *
+          1000000),
+        latest_refresh_time_(0),
+        version_(0),
+        snapshot_(std::make_shared<CredentialMap>()),
+        negative_keys_(kNegativeKeyCacheSize),
+        rejected_keys_(0),
+        cond_(&mu_),
+        refresh_requested_(false) {
+    set_thread_name("CredentialCache");
+  }
+
+  // Load the credentials before serving, then refresh them periodically
+  Status StartThread(zgwstore::ZgwStore* store);
+  // Refresh as soon as possible, e.g. credentials were changed
+  void RequestRefresh();
+  // Replace the snapshot if credentials changed, also used by tools
+  // running without store
+  void Publish(std::shared_ptr<const CredentialMap> credentials);
+
+  // Return false if access_key is unknown to the latest snapshot, a key
+  // not seen recently requests a refresh in case it was just added
+  bool Lookup(const std::string& access_key, std::string* user_name,
+              std::string* secret_key);
+  // Changed every time a different snapshot is published
+  uint64_t version() const {
+    return version_.load();
+  }
+  uint64_t rejected_keys() const {
+    return rejected_keys_.load();
+  }
+
+ private:
+  static const size_t kNegativeKeyCacheSize = 10000;
+
+  virtual void* ThreadMain() override;
+  Status Refresh();
+
+  zgwstore::ZgwStore* store_;
+  uint64_t refresh_interval_us_;
+  uint64_t latest_refresh_time_;
+  std::atomic<uint64_t> version_;
+  // Accessed by std::atomic_load/atomic_store
+  std::shared_ptr<const CredentialMap> snapshot_;
+  // Unknown to the snapshot of version until expire_time
+  struct NegativeKey {
+    uint64_t version;
+    uint64_t expire_time;
+  };
+  ZgwLRUCache<NegativeKey> negative_keys_;
+  std::atomic<uint64_t> rejected_keys_;
+
+  slash::Mutex mu_;
+  slash::CondVar cond_;
+  bool refresh_requested_;
+};
+
+#endif
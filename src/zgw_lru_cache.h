@@ -0,0 +1,79 @@
+#ifndef ZGW_LRU_CACHE_H
+#define ZGW_LRU_CACHE_H
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "slash/include/slash_mutex.h"
+
+// Thread safe cache keeping at most capacity least recently used entries
+template <typename Value>
+class ZgwLRUCache {
+ public:
+  explicit ZgwLRUCache(size_t capacity)
+      : capacity_(capacity > 0 ? capacity : 1) {
+  }
+
+  bool Lookup(const std::string& key, Value* value) {
+    slash::MutexLock l(&mu_);
+    auto iter = map_.find(key);
+    if (iter == map_.end()) {
+      return false;
+    }
+    lru_.splice(lru_.begin(), lru_, iter->second);
+    *value = iter->second->second;
+    return true;
+  }
+
+  void Insert(const std::string& key, const Value& value) {
+    slash::MutexLock l(&mu_);
+    auto iter = map_.find(key);
+    if (iter != map_.end()) {
+      iter->second->second = value;
+      lru_.splice(lru_.begin(), lru_, iter->second);
+      return;
+    }
+    lru_.push_front(std::make_pair(key, value));
+    map_[key] = lru_.begin();
+    if (map_.size() > capacity_) {
+      map_.erase(lru_.back().first);
+      lru_.pop_back();
+    }
+  }
+
+  void Erase(const std::string& key) {
+    slash::MutexLock l(&mu_);
+    auto iter = map_.find(key);
+    if (iter != map_.end()) {
+      lru_.erase(iter->second);
+      map_.erase(iter);
+    }
+  }
+
+  void Clear() {
+    slash::MutexLock l(&mu_);
+    map_.clear();
+    lru_.clear();
+  }
+
+  size_t size() {
+    slash::MutexLock l(&mu_);
+    return map_.size();
+  }
+
+ private:
+  typedef std::list<std::pair<std::string, Value>> EntryList;
+
+  size_t capacity_;
+  slash::Mutex mu_;
+  EntryList lru_;
+  std::unordered_map<std::string, typename EntryList::iterator> map_;
+
+  // No copying allowed
+  ZgwLRUCache(const ZgwLRUCache&);
+  ZgwLRUCache& operator=(const ZgwLRUCache&);
+};
+
+#endif
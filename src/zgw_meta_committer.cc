@@ -0,0 +1,79 @@
+#include "src/zgw_meta_committer.h"
+
+#include <vector>
+
+#include <glog/logging.h>
+
+static const uint32_t kCommitterWaitMs = 100;
+
+ZgwMetaCommitter::~ZgwMetaCommitter() {
+  slash::MutexLock l(&mu_);
+  for (auto req : queue_) {
+    req->status = Status::IOError("MetaCommitter stopped");
+    req->done = true;
+  }
+  queue_.clear();
+  done_cond_.SignalAll();
+}
+
+Status ZgwMetaCommitter::AddObject(const zgwstore::Object& object) {
+  CommitRequest req;
+  req.object = &object;
+  req.done = false;
+
+  slash::MutexLock l(&mu_);
+  if (!is_running()) {
+    return Status::IOError("MetaCommitter not running");
+  }
+  queue_.push_back(&req);
+  cond_.Signal();
+  while (!req.done) {
+    done_cond_.Wait();
+  }
+  return req.status;
+}
+
+void* ZgwMetaCommitter::ThreadMain() {
+  std::vector<CommitRequest*> batch;
+  std::vector<zgwstore::Object> objects;
+  std::vector<Status> results;
+  while (!should_stop()) {
+    batch.clear();
+    objects.clear();
+    {
+      slash::MutexLock l(&mu_);
+      if (queue_.empty()) {
+        cond_.TimedWait(kCommitterWaitMs);
+        continue;
+      }
+      while (!queue_.empty() && batch.size() < static_cast<size_t>(max_batch_)) {
+        batch.push_back(queue_.front());
+        objects.push_back(*queue_.front()->object);
+        queue_.pop_front();
+      }
+    }
+
+    Status s = store_->AddObjects(objects, &results);
+    if (!s.ok()) {
+      LOG(ERROR) << "MetaCommitter - AddObjects " << objects.size() <<
+        " objects error: " << s.ToString();
+    }
+
+    slash::MutexLock l(&mu_);
+    for (size_t i = 0; i < batch.size(); i++) {
+      batch[i]->status = s.ok() ? results[i] : s;
+      batch[i]->done = true;
+    }
+    done_cond_.SignalAll();
+  }
+
+  // Fail the requests not committed
+  slash::MutexLock l(&mu_);
+  for (auto req : queue_) {
+    req->status = Status::IOError("MetaCommitter stopped");
+    req->done = true;
+  }
+  queue_.clear();
+  done_cond_.SignalAll();
+  return nullptr;
+}
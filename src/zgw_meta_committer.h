@@ -0,0 +1,57 @@
+#ifndef ZGW_META_COMMITTER_H
+#define ZGW_META_COMMITTER_H
+
+#include <deque>
+
+#include "pink/include/pink_thread.h"
+#include "slash/include/slash_status.h"
+#include "slash/include/slash_mutex.h"
+
+#include "src/zgwstore/zgw_store.h"
+
+using slash::Status;
+
+// Group commit of object meta: AddObject requests queued while the
+// previous batch is being committed are written in one pipelined batch.
+// The caller is a worker blocked until its batch is committed, at most
+// two batches, so a batch holds at most one object per worker and saves
+// Redis round trips rather than latency of one request
+class ZgwMetaCommitter : public pink::Thread {
+ public:
+  explicit ZgwMetaCommitter(int max_batch)
+      : store_(nullptr),
+        max_batch_(max_batch > 0 ? max_batch : 1),
+        cond_(&mu_),
+        done_cond_(&mu_) {
+    set_thread_name("MetaCommitter");
+  }
+  virtual ~ZgwMetaCommitter();
+
+  int StartThread(zgwstore::ZgwStore* store) {
+    store_ = store;
+    return Thread::StartThread();
+  }
+
+  // Block until the batch including object is committed, no longer than
+  // the batch in progress and the one including object
+  Status AddObject(const zgwstore::Object& object);
+
+ private:
+  struct CommitRequest {
+    const zgwstore::Object* object;
+    Status status;
+    bool done;
+  };
+
+  virtual void* ThreadMain() override;
+
+  zgwstore::ZgwStore* store_;
+  int max_batch_;
+
+  slash::Mutex mu_;
+  slash::CondVar cond_;
+  slash::CondVar done_cond_;
+  std::deque<CommitRequest*> queue_;
+};
+
+#endif
@@ -14,14 +14,22 @@ extern ZgwMonitor* g_zgw_monitor;
 bool ZgwHTTPHandles::HandleRequest(const pink::HTTPRequest* req) {
   // req->Dump();
 
+  ReleaseCmd();
   cmd_ = SelectS3CmdBy(req);
+  close_after_reply_ = false;
 
   if (!cmd_->DoInitial()) {
-    // Something wrong happend, need reply right now
+    // Something wrong happend, need reply right now. Replying before the
+    // body also answers Expect: 100-continue, the client never sends the
+    // body. Other clients may be sending it already, close the connection
+    // rather than receive the body only to discard it
+    close_after_reply_ = HasBody() && !req_headers_.ExpectContinue();
     return true;
   }
 
-  // Needn't reply right now
+  // Needn't reply right now, the body is read from here on. All checks
+  // not depending on the body are done in DoInitial, so the client
+  // expecting 100-continue is told to continue only if accepted
   return false;
 }
 
@@ -32,8 +40,20 @@ void ZgwHTTPHandles::HandleBodyData(const char* data, size_t data_size) {
 void ZgwHTTPHandles::PrepareResponse(pink::HTTPResponse* resp) {
   cmd_->DoAndResponse(resp);
   resp->SetHeaders("x-amz-request-id", cmd_->request_id());
-  resp->SetHeaders("Date", http_nowtime(slash::NowMicros()));
+  resp->SetHeaders("Date", http_date(slash::NowMicros()));
   resp->SetHeaders("Server", "Zeppelin gateway 2.0");
+  if (close_after_reply_) {
+    resp->SetHeaders("Connection", "close");
+  }
+}
+
+bool ZgwHTTPHandles::HasBody() const {
+  uint64_t content_length = 0;
+  if (req_headers_.ContentLength(&content_length)) {
+    return content_length > 0;
+  }
+  return req_headers_.Has(kHdrContentLength) ||
+    req_headers_.count("transfer-encoding") > 0;
 }
 
 int ZgwHTTPHandles::WriteResponseBody(char* buf, size_t max_size) {
@@ -42,57 +62,82 @@ int ZgwHTTPHandles::WriteResponseBody(char* buf, size_t max_size) {
 
 void ZgwHTTPHandles::HandleConnClosed() {
   if (cmd_ != nullptr) {
-    return cmd_->DoConnClosed();
+    cmd_->DoConnClosed();
+    ReleaseCmd();
+  }
+}
+
+void ZgwHTTPHandles::ReleaseCmd() {
+  if (cmd_ == nullptr) {
+    return;
   }
+  ZgwWorkerData* worker_data =
+    reinterpret_cast<ZgwWorkerData*>(worker_specific_data_);
+  worker_data->cmd_pool.Put(cmd_type_, cmd_);
+  cmd_ = nullptr;
 }
 
 S3Cmd* ZgwHTTPHandles::SelectS3CmdBy(const pink::HTTPRequest* req) {
   std::string bucket_name, object_name;
   SplitBySecondSlash(req->path(), &bucket_name, &object_name);
 
+  // pink returns copies, take each of them only once
+  header_map_ = req->headers();
+  query_map_ = req->query_params();
+  for (auto& item : query_map_) {
+    if (item.second.find('%') != std::string::npos) {
+      decoded_value_.clear();
+      UrlDecodeTo(item.second.data(), item.second.size(), &decoded_value_);
+      item.second.swap(decoded_value_);
+    }
+  }
+  req_headers_.Reset(&header_map_);
+  query_params_.Reset(&query_map_);
+  const std::string method = req->method();
+
   S3Commands cmd = kUnImplement;
-  if (req->method() == "GET" &&
+  if (method == "GET" &&
       bucket_name.empty() &&
       object_name.empty()) {
     cmd = kListAllBuckets;
   } else if (!bucket_name.empty() && object_name.empty()) {
     // Bucket operation
-    if (req->method() == "GET") {
-      if (req->query_params().count("uploads")) {
+    if (method == "GET") {
+      if (query_map_.count("uploads")) {
         cmd = kListMultiPartUpload;
-      } else if (req->query_params().count("location")) {
+      } else if (query_map_.count("location")) {
         cmd = kGetBucketLocation;
       } else {
         cmd = kListObjects;
       }
-    } else if (req->method() == "PUT") {
+    } else if (method == "PUT") {
       cmd = kPutBucket;
-    } else if (req->method() == "DELETE") {
+    } else if (method == "DELETE") {
       cmd = kDeleteBucket;
-    } else if (req->method() == "HEAD") {
+    } else if (method == "HEAD") {
       if (bucket_name == "_zgwtest") {
         cmd = kZgwTest;
       } else {
         cmd = kHeadBucket;
       }
-    } else if (req->method() == "POST") {
-      if (req->query_params().count("delete")) {
+    } else if (method == "POST") {
+      if (query_map_.count("delete")) {
         cmd = kDeleteMultiObjects;
       }
     }
   } else if (!bucket_name.empty() && !object_name.empty()) {
     // Object operation
-    if (req->method() == "GET") {
-      if (req->query_params().count("uploadId")) {
+    if (method == "GET") {
+      if (query_map_.count("uploadId")) {
         cmd = kListParts;
       } else {
         cmd = kGetObject;
       }
-    } else if (req->method()== "PUT") {
-      if (req->query_params().count("partNumber") &&
-          req->query_params().count("uploadId")) {
-        if (req->headers().count("x-amz-copy-source")) {
-          if (req->headers().count("x-amz-copy-source-range")) {
+    } else if (method == "PUT") {
+      if (query_map_.count("partNumber") &&
+          query_map_.count("uploadId")) {
+        if (req_headers_.Has(kHdrXAmzCopySource)) {
+          if (req_headers_.Has(kHdrXAmzCopySourceRange)) {
             cmd = kUploadPartCopyPartial;
           } else {
             cmd = kUploadPartCopy;
@@ -101,40 +146,42 @@ S3Cmd* ZgwHTTPHandles::SelectS3CmdBy(const pink::HTTPRequest* req) {
           cmd = kUploadPart;
         }
       } else {
-        if (req->headers().count("x-amz-copy-source")) {
+        if (req_headers_.Has(kHdrXAmzCopySource)) {
           cmd = kPutObjectCopy;
         } else {
           cmd = kPutObject;
         }
       }
-    } else if (req->method()== "DELETE") {
-      if (req->query_params().count("uploadId")) {
+    } else if (method == "DELETE") {
+      if (query_map_.count("uploadId")) {
         cmd = kAbortMultiUpload;
       } else {
         cmd = kDeleteObject;
       }
-    } else if (req->method()== "HEAD") {
+    } else if (method == "HEAD") {
       cmd = kHeadObject;
-    } else if (req->method()== "POST") {
-      if (req->query_params().count("uploads")) {
+    } else if (method == "POST") {
+      if (query_map_.count("uploads")) {
         cmd = kInitMultipartUpload;
-      } else if (req->query_params().count("uploadId")) {
+      } else if (query_map_.count("uploadId")) {
         cmd = kCompleteMultiUpload;
       }
     }
   }
 
-  zgwstore::ZgwStore* store =
-    reinterpret_cast<zgwstore::ZgwStore*>(worker_specific_data_);
+  ZgwWorkerData* worker_data =
+    reinterpret_cast<ZgwWorkerData*>(worker_specific_data_);
 
-  assert(cmd_table_->count(cmd) > 0);
-  S3Cmd* cmd_ptr = cmd_table_->at(cmd);
+  S3Cmd* cmd_ptr = worker_data->cmd_pool.Get(cmd);
+  cmd_type_ = cmd;
   cmd_ptr->Clear();
   cmd_ptr->SetBucketName(bucket_name);
   cmd_ptr->SetObjectName(object_name);
-  cmd_ptr->SetReqHeaders(req->headers());
-  cmd_ptr->SetQueryParams(req->query_params());
-  cmd_ptr->SetStorePtr(store);
+  cmd_ptr->SetReqHeaders(req_headers_);
+  cmd_ptr->SetQueryParams(query_params_);
+  cmd_ptr->SetStorePtr(worker_data->store);
+  cmd_ptr->SetBufferCache(&worker_data->buffer_cache);
+  cmd_ptr->NewRequestId(&worker_data->request_id_gen);
   cmd_ptr->InitS3Auth(req);
   g_zgw_monitor->AddQueryNum();
 
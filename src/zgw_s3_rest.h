@@ -3,19 +3,39 @@
 
 #include "pink/include/http_conn.h"
 
+#include "src/zgwstore/zgw_store.h"
 #include "src/s3_cmds/zgw_s3_command.h"
+#include "src/zgw_buffer_pool.h"
 
-// Every HTTP connection has its own handles
+// Created for each worker thread, used only by its own thread
+struct ZgwWorkerData {
+  ZgwWorkerData(zgwstore::ZgwStore* s, ZgwBufferPool* buffer_pool,
+                const RequestIdGenerator& id_gen)
+      : store(s),
+        buffer_cache(buffer_pool),
+        request_id_gen(id_gen) {
+  }
+  ~ZgwWorkerData() {
+    delete store;
+  }
+
+  zgwstore::ZgwStore* store;
+  ZgwBufferCache buffer_cache;
+  S3CmdPool cmd_pool;
+  RequestIdGenerator request_id_gen;
+};
+
+// Every HTTP connection has its own handles, commands are taken from the
+// pool of the worker for each request
 class ZgwHTTPHandles : public pink::HTTPHandles {
  public:
   ZgwHTTPHandles()
-      : cmd_(nullptr) {
-    cmd_table_ = new S3CmdTable;
-    InitCmdTable(cmd_table_);
+      : cmd_(nullptr),
+        cmd_type_(kUnImplement),
+        close_after_reply_(false) {
   }
   virtual ~ZgwHTTPHandles() {
-    DestroyCmdTable(cmd_table_);
-    delete cmd_table_;
+    ReleaseCmd();
   }
 
   virtual bool HandleRequest(const pink::HTTPRequest* req) override;
@@ -26,9 +46,22 @@ class ZgwHTTPHandles : public pink::HTTPHandles {
   void HandleConnClosed();
 
  private:
-  S3CmdTable* cmd_table_;
   S3Cmd* cmd_;
+  S3Commands cmd_type_;
+  // Parsed once for each request, commands borrow them by views, nodes
+  // of the maps are reused by the following requests
+  S3ParamMap header_map_;
+  S3ParamMap query_map_;
+  S3ReqHeaders req_headers_;
+  S3ParamView query_params_;
+  std::string decoded_value_;
+  // Rejected with the body unread
+  bool close_after_reply_;
+
   S3Cmd* SelectS3CmdBy(const pink::HTTPRequest* req);
+  bool HasBody() const;
+  // Put cmd_ of the last request back to the pool
+  void ReleaseCmd();
 };
 
 class ZgwConnFactory : public pink::ConnFactory {
@@ -1,6 +1,7 @@
 #include "src/zgw_server.h"
 
 #include <atomic>
+#include <algorithm>
 
 #include <glog/logging.h>
 #include "slash/include/slash_mutex.h"
@@ -10,6 +11,11 @@
 
 extern ZgwConfig* g_zgw_conf;
 extern ZgwMonitor* g_zgw_monitor;
+extern ZgwBlockWriter* g_zgw_block_writer;
+extern ZgwMetaCommitter* g_zgw_meta_committer;
+extern zgwstore::GCThread* g_zgw_gc_thread;
+extern ZgwCredentialCache* g_zgw_credential_cache;
+extern ZgwBufferPool* g_zgw_buffer_pool;
 
 static std::string LockName() {
   static std::atomic<int> thread_seq_;
@@ -38,24 +44,48 @@ int ZgwServer::ZgwServerHandle::CreateWorkerSpecificData(void** data) const {
     LOG(FATAL) << "Can not open ZgwStore: " << s.ToString();
     return -1;
   }
-  *data = reinterpret_cast<void*>(store);
+  static std::atomic<uint16_t> worker_seq_;
+  *data = reinterpret_cast<void*>(
+      new ZgwWorkerData(store, zgw_server_->buffer_pool_,
+                        RequestIdGenerator(zgw_server_->gateway_id_,
+                                           zgw_server_->start_time_,
+                                           worker_seq_++)));
 
   return 0;
 }
 
 int ZgwServer::ZgwServerHandle::DeleteWorkerSpecificData(void* data) const {
-  delete reinterpret_cast<zgwstore::ZgwStore*>(data);
+  delete reinterpret_cast<ZgwWorkerData*>(data);
   return 0;
 }
 
 ZgwServer::ZgwServer()
     : should_exit_(false),
       worker_num_(g_zgw_conf->worker_num),
-      server_handle_(this) {
+      server_handle_(this),
+      block_writer_(nullptr),
+      meta_committer_(nullptr),
+      store_for_committer_(nullptr),
+      store_gc_thread_(nullptr),
+      store_for_gc_(nullptr),
+      credential_cache_(nullptr),
+      store_for_credential_(nullptr) {
   if (worker_num_ > kMaxWorkerThread) {
     LOG(WARNING) << "Exceed max worker thread num: " << kMaxWorkerThread;
     worker_num_ = kMaxWorkerThread;
   }
+  uint64_t budget_mb = std::max(g_zgw_conf->block_buffer_budget_mb, 0);
+  buffer_pool_ = new ZgwBufferPool(budget_mb << 20);
+  g_zgw_buffer_pool = buffer_pool_;
+
+  gateway_id_ = static_cast<uint32_t>(g_zgw_conf->gateway_id);
+  if (gateway_id_ == 0) {
+    std::string hash = md5(hostname() + ":" +
+                           std::to_string(g_zgw_conf->server_port));
+    gateway_id_ = std::stoul(hash.substr(0, 8), nullptr, 16);
+  }
+  start_time_ = static_cast<uint32_t>(slash::NowMicros() / 1000000);
+  LOG(INFO) << "Gateway id: " << gateway_id_;
 
   zgw_dispatch_thread_ = pink::NewDispatchThread(g_zgw_conf->server_ip,
                                                  g_zgw_conf->server_port,
@@ -74,9 +104,15 @@ ZgwServer::ZgwServer()
 ZgwServer::~ZgwServer() {
   delete zgw_dispatch_thread_;
   delete zgw_admin_thread_;
-  if (g_zgw_conf->enable_gc) {
-    delete store_for_gc_;
-  }
+  delete block_writer_;
+  delete meta_committer_;
+  delete store_for_committer_;
+  delete store_gc_thread_;
+  delete store_for_gc_;
+  delete credential_cache_;
+  delete store_for_credential_;
+  g_zgw_buffer_pool = nullptr;
+  delete buffer_pool_;
 
   LOG(INFO) << "ZgwServerThread exit!!!";
 }
@@ -94,14 +130,34 @@ void ZgwServer::Exit() {
   } else {
     LOG(INFO) << "AdminThread Exit";
   }
-  if (g_zgw_conf->enable_gc) {
-    ret = store_gc_thread_.StopThread();
+  if (block_writer_ != nullptr) {
+    block_writer_->Stop();
+    LOG(INFO) << "BlockWriter Exit";
+  }
+  if (meta_committer_ != nullptr) {
+    ret = meta_committer_->StopThread();
+    if (ret != 0) {
+      LOG(WARNING) << "Stop MetaCommitter failed";
+    } else {
+      LOG(INFO) << "MetaCommitter Exit";
+    }
+  }
+  if (store_gc_thread_ != nullptr) {
+    ret = store_gc_thread_->StopThread();
     if (ret != 0) {
       LOG(WARNING) << "Stop GCThread failed";
     } else {
       LOG(INFO) << "GCThread Exit";
     }
   }
+  if (credential_cache_ != nullptr) {
+    ret = credential_cache_->StopThread();
+    if (ret != 0) {
+      LOG(WARNING) << "Stop CredentialCache failed";
+    } else {
+      LOG(INFO) << "CredentialCache Exit";
+    }
+  }
   should_exit_.store(true);
 }
 
@@ -115,6 +171,66 @@ Status ZgwServer::Start() {
       return Status::Corruption("Enable Security failed, maybe wrong cert or key");
     }
   }
+  // Load credentials before serving, requests never wait for the reload
+  s = zgwstore::ZgwStore::Open(g_zgw_conf->zp_meta_ip_ports,
+                               g_zgw_conf->zp_table_name,
+                               g_zgw_conf->zp_optimeout_ms,
+                               g_zgw_conf->redis_ip_port,
+                               LockName(), kZgwRedisLockTTL,
+                               g_zgw_conf->redis_passwd,
+                               &store_for_credential_);
+  if (!s.ok()) {
+    return s;
+  }
+  credential_cache_ = new ZgwCredentialCache(g_zgw_conf->credential_refresh_sec);
+  s = credential_cache_->StartThread(store_for_credential_);
+  if (!s.ok()) {
+    return s;
+  }
+  g_zgw_credential_cache = credential_cache_;
+  // Open store ptrs for block writers before serving
+  if (g_zgw_conf->block_writer_num > 0) {
+    block_writer_ = new ZgwBlockWriter(g_zgw_conf->block_writer_max_pending,
+                                       g_zgw_conf->block_writer_upload_window,
+                                       buffer_pool_);
+    for (int i = 0; i < g_zgw_conf->block_writer_num; i++) {
+      zgwstore::ZgwStore* store;
+      s = zgwstore::ZgwStore::Open(g_zgw_conf->zp_meta_ip_ports,
+                                   g_zgw_conf->zp_table_name,
+                                   g_zgw_conf->zp_optimeout_ms,
+                                   g_zgw_conf->redis_ip_port,
+                                   LockName(), kZgwRedisLockTTL,
+                                   g_zgw_conf->redis_passwd,
+                                   &store);
+      if (!s.ok()) {
+        return s;
+      }
+      if (block_writer_->StartWriter(store) != 0) {
+        return Status::Corruption("Launch BlockWriter failed");
+      }
+    }
+    g_zgw_block_writer = block_writer_;
+  }
+  if (g_zgw_conf->meta_group_commit) {
+    s = zgwstore::ZgwStore::Open(g_zgw_conf->zp_meta_ip_ports,
+                                 g_zgw_conf->zp_table_name,
+                                 g_zgw_conf->zp_optimeout_ms,
+                                 g_zgw_conf->redis_ip_port,
+                                 LockName(), kZgwRedisLockTTL,
+                                 g_zgw_conf->redis_passwd,
+                                 &store_for_committer_);
+    if (!s.ok()) {
+      return s;
+    }
+    // Every waiting request holds a worker, a batch never has more
+    // objects than workers
+    meta_committer_ = new ZgwMetaCommitter(
+        std::min(g_zgw_conf->meta_commit_max_batch, worker_num_));
+    if (meta_committer_->StartThread(store_for_committer_) != 0) {
+      return Status::Corruption("Launch MetaCommitter failed");
+    }
+    g_zgw_meta_committer = meta_committer_;
+  }
   if (zgw_dispatch_thread_->StartThread() != 0) {
     return Status::Corruption("Launch DispatchThread failed");
   }
@@ -133,9 +249,29 @@ Status ZgwServer::Start() {
     if (!s.ok()) {
       return s;
     }
-    if (store_gc_thread_.StartThread(store_for_gc_) != 0) {
+    store_gc_thread_ = new zgwstore::GCThread(g_zgw_conf->gc_batch_size,
+        g_zgw_conf->gc_max_blocks_per_sec);
+    int worker_num = std::max(g_zgw_conf->gc_worker_num, 1);
+    for (int i = 0; i < worker_num; i++) {
+      zgwstore::ZgwStore* store;
+      s = zgwstore::ZgwStore::Open(g_zgw_conf->zp_meta_ip_ports,
+                                   g_zgw_conf->zp_table_name,
+                                   g_zgw_conf->zp_optimeout_ms,
+                                   g_zgw_conf->redis_ip_port,
+                                   LockName(), kZgwRedisLockTTL,
+                                   g_zgw_conf->redis_passwd,
+                                   &store);
+      if (!s.ok()) {
+        return s;
+      }
+      if (store_gc_thread_->AddWorker(store) != 0) {
+        return Status::Corruption("Launch GCWorker failed");
+      }
+    }
+    if (store_gc_thread_->StartThread(store_for_gc_) != 0) {
       return Status::Corruption("Launch GCThread failed");
     }
+    g_zgw_gc_thread = store_gc_thread_;
   }
 
   LOG(INFO) << "ZgwServerThread Init Success!";
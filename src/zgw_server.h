@@ -17,6 +17,10 @@
 #include "src/zgw_s3_rest.h"
 #include "src/zgw_const.h"
 #include "src/zgw_admin_conn.h"
+#include "src/zgw_block_writer.h"
+#include "src/zgw_meta_committer.h"
+#include "src/zgw_credential_cache.h"
+#include "src/zgw_buffer_pool.h"
 
 #include "src/zgw_config.h"
 
@@ -61,8 +65,22 @@ class ZgwServer {
   ZgwAdminConnFactory admin_conn_factory_;
   pink::ServerThread* zgw_admin_thread_;
 
-  zgwstore::GCThread store_gc_thread_;
+  ZgwBlockWriter* block_writer_;
+  ZgwMetaCommitter* meta_committer_;
+  zgwstore::ZgwStore* store_for_committer_;
+
+  zgwstore::GCThread* store_gc_thread_;
   zgwstore::ZgwStore* store_for_gc_;
+
+  ZgwCredentialCache* credential_cache_;
+  zgwstore::ZgwStore* store_for_credential_;
+
+  // Outlives all the threads using block buffers
+  ZgwBufferPool* buffer_pool_;
+
+  // Request ids of all workers start with these
+  uint32_t gateway_id_;
+  uint32_t start_time_;
 };
 
 #endif
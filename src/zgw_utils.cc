@@ -1,6 +1,8 @@
 #include "src/zgw_utils.h"
 
 #include <sys/time.h>
+#include <stdint.h>
+#include <cstring>
 
 void SplitBySecondSlash(const std::string& req_path,
                         std::string* field1,
@@ -27,21 +29,108 @@ void SplitBySecondSlash(const std::string& req_path,
   }
 }
 
+struct CivilTime {
+  int year, month, day, hour, minute, second, weekday;
+};
+
+// UTC calendar of the seconds since epoch, by integer arithmetic on days
+// instead of gmtime
+static void ToCivilTime(uint64_t sec, CivilTime* t) {
+  uint64_t days = sec / 86400;
+  uint32_t secs = sec % 86400;
+  t->hour = secs / 3600;
+  t->minute = secs / 60 % 60;
+  t->second = secs % 60;
+  // 1970-01-01 is Thursday
+  t->weekday = (days + 4) % 7;
+
+  // Shift to 0000-03-01, so that leap days fall on the end of years
+  days += 719468;
+  uint32_t era = days / 146097;
+  uint32_t doe = days - era * 146097;
+  uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  uint32_t mp = (5 * doy + 2) / 153;
+  t->day = doy - (153 * mp + 2) / 5 + 1;
+  t->month = mp < 10 ? mp + 3 : mp - 9;
+  t->year = yoe + era * 400 + (t->month <= 2 ? 1 : 0);
+}
+
+static inline char* PutDigits(uint32_t value, int width, char* p) {
+  for (int i = width - 1; i >= 0; i--) {
+    p[i] = '0' + value % 10;
+    value /= 10;
+  }
+  return p + width;
+}
+
+static const char* const kWeekdays[] = {
+  "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+};
+static const char* const kMonths[] = {
+  "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+  "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
 std::string http_nowtime(uint64_t nowmicros) {
-  time_t t = static_cast<time_t>(nowmicros * 1e-6);
-  char buf[100];
-  struct tm t_ = *gmtime(&t);
-  strftime(buf, sizeof buf, "%a, %d %b %Y %H:%M:%S %Z", &t_);
-  return std::string(buf);
+  CivilTime t;
+  ToCivilTime(nowmicros / 1000000, &t);
+  // Sun, 06 Nov 1994 08:49:37 GMT
+  char buf[32];
+  char* p = buf;
+  memcpy(p, kWeekdays[t.weekday], 3);
+  p += 3;
+  *p++ = ',';
+  *p++ = ' ';
+  p = PutDigits(t.day, 2, p);
+  *p++ = ' ';
+  memcpy(p, kMonths[t.month - 1], 3);
+  p += 3;
+  *p++ = ' ';
+  p = PutDigits(t.year, 4, p);
+  *p++ = ' ';
+  p = PutDigits(t.hour, 2, p);
+  *p++ = ':';
+  p = PutDigits(t.minute, 2, p);
+  *p++ = ':';
+  p = PutDigits(t.second, 2, p);
+  memcpy(p, " GMT", 4);
+  p += 4;
+  return std::string(buf, p - buf);
+}
+
+const std::string& http_date(uint64_t nowmicros) {
+  static thread_local uint64_t cached_sec = UINT64_MAX;
+  static thread_local std::string cached_date;
+  uint64_t sec = nowmicros / 1000000;
+  if (sec != cached_sec) {
+    cached_date = http_nowtime(nowmicros);
+    cached_sec = sec;
+  }
+  return cached_date;
 }
 
 std::string iso8601_time(uint64_t nowmicros) {
-  int milli = nowmicros % 1000;
-  time_t sec = static_cast<time_t>(nowmicros * 1e-6);
-  char buf[128] = {0};
-  strftime(buf, sizeof buf, "%FT%T", gmtime(&sec));
-  sprintf(buf, "%s.%03dZ", buf, milli);
-  return std::string(buf);
+  CivilTime t;
+  ToCivilTime(nowmicros / 1000000, &t);
+  // 2006-02-03T16:45:09.000Z
+  char buf[32];
+  char* p = buf;
+  p = PutDigits(t.year, 4, p);
+  *p++ = '-';
+  p = PutDigits(t.month, 2, p);
+  *p++ = '-';
+  p = PutDigits(t.day, 2, p);
+  *p++ = 'T';
+  p = PutDigits(t.hour, 2, p);
+  *p++ = ':';
+  p = PutDigits(t.minute, 2, p);
+  *p++ = ':';
+  p = PutDigits(t.second, 2, p);
+  *p++ = '.';
+  p = PutDigits(nowmicros / 1000 % 1000, 3, p);
+  *p++ = 'Z';
+  return std::string(buf, p - buf);
 }
 
 std::string hostname() {
@@ -50,6 +139,30 @@ std::string hostname() {
   return std::string(buf);
 }
 
+static const char kHexDigits[] = "0123456789abcdef";
+
+static void PutHex(uint64_t value, size_t width, char* buf) {
+  for (size_t i = width; i > 0; i--) {
+    buf[i - 1] = kHexDigits[value & 0xf];
+    value >>= 4;
+  }
+}
+
+RequestIdGenerator::RequestIdGenerator(uint32_t gateway_id,
+                                       uint32_t start_time,
+                                       uint16_t worker_id)
+    : seq_(0) {
+  PutHex(gateway_id, 8, id_);
+  PutHex(start_time, 8, id_ + 8);
+  PutHex(worker_id, 4, id_ + 16);
+}
+
+void RequestIdGenerator::Next(std::string* id) {
+  // Wraps after 2^48 requests of a worker
+  PutHex(seq_++, kSeqSize, id_ + kIdSize - kSeqSize);
+  id->assign(id_, kIdSize);
+}
+
 std::string md5(const std::string& content) {
   MD5Ctx md5_ctx;
   md5_ctx.Init();
@@ -64,8 +177,7 @@ static inline void char2hex(unsigned char c, unsigned char &hex1, unsigned char
     hex2 += hex2 <= 9 ? '0' : 'a' - 10;
 }
 
-static inline char hex2char(const std::string& hex) {
-  assert(hex.size() == 2);
+static inline char hex2char(const char* hex) {
   char a = std::tolower(hex[0]);
   char b = std::tolower(hex[1]);
   a = a >= 'a' ? (10 + a - 'a') : (a - '0');
@@ -73,51 +185,56 @@ static inline char hex2char(const std::string& hex) {
   return (a * 16 + b);
 }
 
-std::string UrlDecode(const std::string& url) {
-  std::string v;
+void UrlDecodeTo(const char* url, size_t size, std::string* output) {
   size_t i = 0;
-  while (i < url.size()) {
+  while (i < size) {
     if (url[i] == '%') {
-      if (i + 3 > url.size()) {
+      if (i + 3 > size) {
         break;
       }
-      char c = hex2char(url.substr(i + 1, 2));
-      v.push_back(c);
+      output->push_back(hex2char(url + i + 1));
       i += 3;
     } else {
-      v.push_back(url[i++]);
+      output->push_back(url[i++]);
     }
   }
-  return v;
 }
 
-std::string UrlEncode(const std::string& s, bool encode_slash) {
-  const char *str = s.c_str();
-  std::string v;
-  v.clear();
-  for (size_t i = 0, l = s.size(); i < l; i++) {
+void UrlEncodeTo(const char* str, size_t size, std::string* output,
+                 bool encode_slash) {
+  for (size_t i = 0; i < size; i++) {
     char c = str[i];
     if ((c >= '0' && c <= '9') ||
         (c >= 'a' && c <= 'z') ||
         (c >= 'A' && c <= 'Z') ||
         (c == '_' || c == '-' || c == '~' || c == '.')) {
-      v.push_back(c);
+      output->push_back(c);
     } else if (c == '/') {
       if (encode_slash) {
-        v.append("%2F");
+        output->append("%2F");
       } else {
-        v.push_back(c);
+        output->push_back(c);
       }
     } else if (c == ' ') {
-      v.append("%20");
+      output->append("%20");
     } else {
-      v.push_back('%');
+      output->push_back('%');
       unsigned char d1, d2;
       char2hex(c, d1, d2);
-      v.push_back(std::toupper(d1));
-      v.push_back(std::toupper(d2));
+      output->push_back(std::toupper(d1));
+      output->push_back(std::toupper(d2));
     }
   }
+}
+
+std::string UrlDecode(const std::string& url) {
+  std::string v;
+  UrlDecodeTo(url.data(), url.size(), &v);
+  return v;
+}
 
+std::string UrlEncode(const std::string& s, bool encode_slash) {
+  std::string v;
+  UrlEncodeTo(s.data(), s.size(), &v, encode_slash);
   return v;
 }
@@ -5,18 +5,26 @@
 #include <chrono>
 
 #include <openssl/md5.h>
+#include <openssl/sha.h>
 #include <glog/logging.h>
 #include "pink/include/http_conn.h"
 
 extern void SplitBySecondSlash(const std::string& req_path,
                                std::string* field1, std::string* field2);
 extern std::string http_nowtime(uint64_t nowmicros);
+// http_nowtime formatted once per second for each thread, for the Date
+// header of every response
+extern const std::string& http_date(uint64_t nowmicros);
 extern std::string iso8601_time(uint64_t nowmicros);
 
 extern std::string hostname();
 extern std::string md5(const std::string& content);
 extern std::string UrlEncode(const std::string& s, bool encode_slash = false);
 extern std::string UrlDecode(const std::string& url);
+// Append to output, no temporary string
+extern void UrlEncodeTo(const char* str, size_t size, std::string* output,
+                        bool encode_slash = false);
+extern void UrlDecodeTo(const char* url, size_t size, std::string* output);
 
 class MD5Ctx {
  public:
@@ -44,6 +52,48 @@ class MD5Ctx {
   unsigned char md5_[16];
 };
 
+// OpenSSL picks the SHA extensions of the CPU if there are
+class SHA256Ctx {
+ public:
+  void Init() {
+    SHA256_Init(&sha256_ctx_);
+  }
+  void Update(const char* data, size_t data_size) {
+    SHA256_Update(&sha256_ctx_, data, data_size);
+  }
+  // Lowercase hex digest
+  std::string ToString() {
+    unsigned char sha256[SHA256_DIGEST_LENGTH];
+    char buf[SHA256_DIGEST_LENGTH * 2 + 1];
+    SHA256_Final(sha256, &sha256_ctx_);
+    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
+      sprintf(buf + i * 2, "%02x", sha256[i]);
+    }
+    return std::string(buf, SHA256_DIGEST_LENGTH * 2);
+  }
+ private:
+  SHA256_CTX sha256_ctx_;
+};
+
+// Request ids of one worker thread, 32 hex chars of gateway id, gateway
+// start time, worker id and a counter. Unique across gateways with
+// distinct ids and across restarts, not thread safe
+class RequestIdGenerator {
+ public:
+  RequestIdGenerator(uint32_t gateway_id, uint32_t start_time,
+                     uint16_t worker_id);
+
+  void Next(std::string* id);
+
+ private:
+  static const size_t kIdSize = 32;
+  // Counter digits, the rest is fixed
+  static const size_t kSeqSize = 12;
+
+  char id_[kIdSize];
+  uint64_t seq_;
+};
+
 struct Timer {
   Timer(const char* msg)
       : msg_(msg) {
@@ -1,4 +1,5 @@
 #include "zgw_store.h"
+#include "zgw_store_gc.h"
 #include <iostream>
 
 int main() {
@@ -6,8 +7,8 @@ int main() {
   std::vector<std::string> zp_addrs = {"127.0.0.1:9221", "127.0.0.1:9222"};
   std::string redis_addr = "127.0.0.1:6379";
 
-  slash::Status s = zgwstore::ZgwStore::Open(zp_addrs, redis_addr,
-      "s3_1", "lock_name", 30000, "", &store);
+  slash::Status s = zgwstore::ZgwStore::Open(zp_addrs, "s3_1", 30000,
+      redis_addr, "lock_name", 30000, "", &store);
   std::cout << "Open ret: " << s.ToString() << std::endl;
   
   zgwstore::User user1;
@@ -139,6 +140,58 @@ int main() {
     std::cout << "data_block: " << obj.data_block << std::endl;
   }
 
+  // Commit an empty object next to a larger upload never committed, the
+  // lease of the larger one must be left for GC
+  uint64_t empty_tail = 0, large_tail = 0;
+  s = store->AllocateId("songzhao", "bucket1", "empty", 0, &empty_tail);
+  std::cout << "AllocateId ret: " << s.ToString() << std::endl;
+  s = store->AllocateId("songzhao", "bucket1", "large", 16, &large_tail);
+  std::cout << "AllocateId ret: " << s.ToString() << std::endl;
+  std::cout << "Empty upload has its own id: " <<
+    (empty_tail != large_tail - 16 ? "ok" : "failed") << std::endl;
+  zgwstore::Object empty = object1;
+  empty.object_name = "empty";
+  empty.size = 0;
+  char buf[100];
+  sprintf(buf, "%lu-%lu(0,0)", empty_tail, empty_tail - 1);
+  empty.data_block = buf;
+  s = store->AddObject(empty);
+  std::cout << "AddObject ret: " << s.ToString() << std::endl;
+  struct timeval timeout = { 1, 0 };
+  redisContext* redis = redisConnectWithTimeout("127.0.0.1", 6379, timeout);
+  redisReply* reply = static_cast<redisReply*>(redisCommand(redis,
+        "ZSCORE %s %llu", zgwstore::kZgwAllocLease.c_str(), large_tail - 16));
+  std::cout << "Lease of the large upload kept: " <<
+    (reply != NULL && reply->type == REDIS_REPLY_STRING ? "ok" : "failed") <<
+    std::endl;
+  if (reply != NULL) {
+    freeReplyObject(reply);
+  }
+  redisFree(redis);
+  s = store->DeleteObject("songzhao", "bucket1", "empty");
+  std::cout << "DeleteObject ret: " << s.ToString() << std::endl;
+
+  // Deleted item of two block groups, GC must not take it as multipart
+  zgwstore::Object object2 = object1;
+  object2.object_name = "object2";
+  object2.data_block = "16-17(0,2097152)|32-32(0,100)";
+  s = store->AddObject(object2);
+  std::cout << "AddObject ret: " << s.ToString() << std::endl;
+  s = store->DeleteObject("songzhao", "bucket1", "object2");
+  std::cout << "DeleteObject ret: " << s.ToString() << std::endl;
+  std::string upload_id, bkname, obname;
+  bool multipart = zgwstore::ParseMultipartItem(object2.data_block,
+                                                &upload_id, &bkname, &obname);
+  std::cout << "ParseMultipartItem two groups: " <<
+    (multipart ? "failed" : "ok") << std::endl;
+  multipart = zgwstore::ParseMultipartItem(
+      "84788d7a9282d8c0109a44b6d9c06887bucket1|dir/a|b(1)",
+      &upload_id, &bkname, &obname);
+  std::cout << "ParseMultipartItem multipart: " <<
+    (multipart && upload_id == "84788d7a9282d8c0109a44b6d9c06887" &&
+     bkname == "bucket1" && obname == "dir/a|b(1)" ? "ok" : "failed") <<
+    std::endl;
+
   s = store->DeleteBucket("songzhao", "bucket1");
   std::cout << "DeleteBucket ret: " << s.ToString() << std::endl;
 
@@ -2,11 +2,44 @@
 #define ZGW_DEFINE_H_
 namespace zgwstore {
 
+// Lua scripts get all the keys they touch in KEYS, but the keys of one
+// script are in different hash slots, the meta Redis is a single node
+// with replicas, not a Redis Cluster
+
 const std::string kZpBlockPrefix = "_ZGW_B_";
 const std::string kZpRefPrefix = "_ZGW_R_";
+// Refcount of block ranges, members are start:end:count, score is start
+const std::string kZgwRangeRef = "#ZRR#";
+// Groups of a deleted item unreferenced by GC: #ZUD#op_id, group index ->
+// ranges freed, empty once deleted. Expires in case GC never finishes it
+const std::string kZgwUnrefDonePrefix = "#ZUD#";
+const int kZgwUnrefDoneTTL = 30 * 24 * 60 * 60;
 
+// Deleted items, members are data_block/deleted_time:tag, the tag is
+// unique to the gateway store which deleted it, older versions wrote no
+// :tag. Score is deleted_time in microseconds. Items are spread over
+// kZgwDeletedQueueNum queues #ZDQ#, #ZDQ#1, #ZDQ#2... by deleted_time,
+// GC of each queue is claimed by one gateway
+const std::string kZgwDeletedQueue = "#ZDQ#";
+const int kZgwDeletedQueueNum = 16;
+// Gateways running GC, score is the latest claim time in milliseconds
+const std::string kZgwGCMembers = "#ZGCM#";
+// Claim of a deleted queue: #ZGCC#N -> lock name of the gateway
+const std::string kZgwGCClaimPrefix = "#ZGCC#";
+// List of deleted items written by older versions, drained into
+// kZgwDeletedQueue by GC
 const std::string kZgwDeletedList = "#ZDL#";
 const std::string kZgwIdGen = "#ZID#";
+// Leases of allocated ids not committed yet, members are the first id of
+// the range, score is the lease expire time in microseconds
+const std::string kZgwAllocLease = "#ZAL#";
+// Lease info: first id -> id_count|bucket_name_size|bucket_name object_name
+const std::string kZgwAllocLeaseInfo = "#ZALI#";
+// Number of leases of bucket_name_size|bucket_name object_name, whose
+// temp object name is removed by the reclaimer with the last lease
+const std::string kZgwAllocLeaseCount = "#ZALC#";
+// Uploads not committed in a day are taken as failed
+const uint64_t kZgwAllocLeaseTime = 24ULL * 60 * 60 * 1000000;
 
 const std::string kZgwUserList = "#ZUL#";
 const std::string kZgwUserPrefix = "_ZU_";
@@ -22,6 +55,11 @@ const std::string kZgwMultiBlockSetPrefix = "_ZMBS_";
 
 const size_t kZgwBlockSize = 1048576; // 1MB
 
+// Object::codec
+const int32_t kObjectBlockRaw = 0;
+// Each block begins with one byte of its codec
+const int32_t kObjectBlockFramed = 1;
+
 struct User {
   std::string user_id;
   std::string display_name;
@@ -49,6 +87,7 @@ struct Object {
   std::string acl;
   std::string upload_id;
   std::string data_block;
+  int32_t codec = kObjectBlockRaw;
 };
 
 }
@@ -1,5 +1,6 @@
 #include "zgw_store.h"
 
+#include <algorithm>
 #include <iostream>
 #include <chrono>
 #include <thread>
@@ -20,7 +21,8 @@ ZgwStore::ZgwStore(const std::string& zp_table,const std::string& lock_name,
         lock_name_(lock_name),
         lock_ttl_(lock_ttl),
         redis_passwd_(redis_passwd),
-        redis_error_(false) {
+        redis_error_(false),
+        deleted_seq_(0) {
 };
 
 ZgwStore::~ZgwStore() {
@@ -127,53 +129,379 @@ Status ZgwStore::BlockMGet(const std::vector<std::string>& block_ids,
   return zp_cli_->Mget(zp_table_, ids, block_contents);
 }
 
-Status ZgwStore::BlockRef(const std::string& block_id) {
-  // Lock outside
-  std::string block_ref_s;
-  int ref;
-  Status s = zp_cli_->Get(zp_table_, kZpRefPrefix + block_id, &block_ref_s);
-  if (!s.ok()) {
-    if (s.IsNotFound()) {
-      ref = 0;
-    } else {
-      return s;
-    }
+// Segments of kZgwRangeRef are disjoint, add delta to the count of
+// [s, e], splitting the segments across the boundaries. Blocks in [s, e]
+// not covered by any segment are returned if delta is negative. With
+// KEYS[2], the update is done once for field ARGV[4] of that hash, which
+// keeps the freed blocks for a retry whose first reply was lost
+static const std::string kRangeRefScript =
+  "local key = KEYS[1] "
+  "local done_key = KEYS[2] "
+  "if done_key then "
+  "  local done = redis.call('HGET', done_key, ARGV[4]) "
+  "  if done then "
+  "    local r = {} "
+  "    for f in string.gmatch(done, '[^,]+') do table.insert(r, f) end "
+  "    return r "
+  "  end "
+  "end "
+  "local s = tonumber(ARGV[1]) "
+  "local e = tonumber(ARGV[2]) "
+  "local delta = tonumber(ARGV[3]) "
+  "local function seg(a, b, c) return string.format('%d:%d:%d', a, b, c) end "
+  "local freed = {} "
+  "local function gap(a, b) "
+  "  if delta > 0 then "
+  "    redis.call('ZADD', key, a, seg(a, b, delta)) "
+  "  else "
+  "    table.insert(freed, string.format('%d-%d', a, b)) "
+  "  end "
+  "end "
+  "local segs = redis.call('ZREVRANGEBYSCORE', key, '(' .. ARGV[1], '-inf', "
+  "                       'LIMIT', 0, 1) "
+  "for _, m in ipairs(redis.call('ZRANGEBYSCORE', key, ARGV[1], ARGV[2])) do "
+  "  table.insert(segs, m) "
+  "end "
+  "local cur = s "
+  "for _, m in ipairs(segs) do "
+  "  local ms, me, mc = string.match(m, '(%d+):(%d+):(%d+)') "
+  "  ms = tonumber(ms) me = tonumber(me) mc = tonumber(mc) "
+  "  if me >= s then "
+  "    redis.call('ZREM', key, m) "
+  "    if ms < s then redis.call('ZADD', key, ms, seg(ms, s - 1, mc)) end "
+  "    if me > e then redis.call('ZADD', key, e + 1, seg(e + 1, me, mc)) end "
+  "    local os = math.max(ms, s) "
+  "    local oe = math.min(me, e) "
+  "    if cur < os then gap(cur, os - 1) end "
+  "    if mc + delta > 0 then redis.call('ZADD', key, os, seg(os, oe, mc + delta)) end "
+  "    cur = oe + 1 "
+  "  end "
+  "end "
+  "if cur <= e then gap(cur, e) end "
+  "if done_key then "
+  "  redis.call('HSET', done_key, ARGV[4], table.concat(freed, ',')) "
+  "  redis.call('EXPIRE', done_key, tonumber(ARGV[5])) "
+  "end "
+  "return freed ";
+
+Status ZgwStore::UpdateRangeRef(uint64_t start_block, uint64_t end_block,
+    int delta, std::vector<std::pair<uint64_t, uint64_t>>* freed_ranges,
+    const std::string& done_key, const std::string& done_field) {
+  if (!MaybeHandleRedisError()) {
+    return Status::IOError("Reconnect");
+  }
+  if (!CheckRedis()) {
+    return Status::IOError("CheckRedis Failed");
+  }
+/*
+ *  1. EVAL
+ */
+  redisReply *reply;
+  if (done_key.empty()) {
+    reply = static_cast<redisReply*>(redisCommand(redis_cli_,
+                "EVAL %s 1 %s %llu %llu %d", kRangeRefScript.c_str(),
+                kZgwRangeRef.c_str(), start_block, end_block, delta));
   } else {
-    ref = std::atoi(block_ref_s.c_str());
+    reply = static_cast<redisReply*>(redisCommand(redis_cli_,
+                "EVAL %s 2 %s %s %llu %llu %d %s %d", kRangeRefScript.c_str(),
+                kZgwRangeRef.c_str(), done_key.c_str(), start_block,
+                end_block, delta, done_field.c_str(), kZgwUnrefDoneTTL));
+  }
+  if (reply == NULL) {
+    return HandleIOError("UpdateRangeRef::EVAL");
   }
+  if (reply->type == REDIS_REPLY_ERROR) {
+    return HandleLogicError("UpdateRangeRef::EVAL ret: " + std::string(reply->str), reply, false);
+  }
+  assert(reply->type == REDIS_REPLY_ARRAY);
+/*
+ *  2. Parse freed ranges
+ */
+  if (freed_ranges != nullptr) {
+    freed_ranges->clear();
+    for (size_t i = 0; i < reply->elements; i++) {
+      uint64_t start, end;
+      if (sscanf(reply->element[i]->str, "%lu-%lu", &start, &end) == 2) {
+        freed_ranges->push_back(std::make_pair(start, end));
+      }
+    }
+  }
+  freeReplyObject(reply);
+  return Status::OK();
+}
 
-  ref++;
+Status ZgwStore::BlockRef(uint64_t start_block, uint64_t end_block) {
+  if (start_block > end_block) {
+    return Status::OK();
+  }
+  return UpdateRangeRef(start_block, end_block, 1, nullptr);
+}
 
-  block_ref_s.assign(std::to_string(ref));
-  return zp_cli_->Set(zp_table_, kZpRefPrefix + block_id, block_ref_s);
+Status ZgwStore::UnrefRange(const std::string& op_id, int group,
+    uint64_t start_block, uint64_t end_block,
+    std::vector<std::pair<uint64_t, uint64_t>>* freed_ranges) {
+  return UpdateRangeRef(start_block, end_block, -1, freed_ranges,
+                        kZgwUnrefDonePrefix + op_id, std::to_string(group));
 }
 
-Status ZgwStore::BlockUnref(uint64_t block_id) {
-  // Assert lock held
+Status ZgwStore::FinishUnrefRange(const std::string& op_id, int group) {
+  if (!MaybeHandleRedisError()) {
+    return Status::IOError("Reconnect");
+  }
+  if (!CheckRedis()) {
+    return Status::IOError("CheckRedis Failed");
+  }
+/*
+ *  1. HSET
+ */
+  std::string done_key = kZgwUnrefDonePrefix + op_id;
+  redisReply* reply = static_cast<redisReply*>(redisCommand(redis_cli_,
+              "HSET %s %d %s", done_key.c_str(), group, ""));
+  if (reply == NULL) {
+    return HandleIOError("FinishUnrefRange::HSET");
+  }
+  if (reply->type == REDIS_REPLY_ERROR) {
+    return HandleLogicError("FinishUnrefRange::HSET ret: " +
+                            std::string(reply->str), reply, false);
+  }
+  freeReplyObject(reply);
+  return Status::OK();
+}
+
+Status ZgwStore::ClearUnrefRanges(const std::string& op_id) {
+  if (!MaybeHandleRedisError()) {
+    return Status::IOError("Reconnect");
+  }
+  if (!CheckRedis()) {
+    return Status::IOError("CheckRedis Failed");
+  }
+/*
+ *  1. DEL
+ */
+  std::string done_key = kZgwUnrefDonePrefix + op_id;
+  redisReply* reply = static_cast<redisReply*>(redisCommand(redis_cli_,
+              "DEL %s", done_key.c_str()));
+  if (reply == NULL) {
+    return HandleIOError("ClearUnrefRanges::DEL");
+  }
+  if (reply->type == REDIS_REPLY_ERROR) {
+    return HandleLogicError("ClearUnrefRanges::DEL ret: " +
+                            std::string(reply->str), reply, false);
+  }
+  freeReplyObject(reply);
+  return Status::OK();
+}
+
+Status ZgwStore::DeleteBlock(uint64_t block) {
+  std::string block_id = std::to_string(block);
+  // Per block refcount written by older versions
   std::string block_ref_s;
-  bool should_delete = false;
-  int ref;
-  Status s = zp_cli_->Get(zp_table_, kZpRefPrefix + std::to_string(block_id),
-                          &block_ref_s);
+  Status s = zp_cli_->Get(zp_table_, kZpRefPrefix + block_id, &block_ref_s);
   if (s.ok()) {
-    ref = std::atoi(block_ref_s.c_str());
-    ref -= 1;
+    int ref = std::atoi(block_ref_s.c_str()) - 1;
+    if (ref >= 0) {
+      return zp_cli_->Set(zp_table_, kZpRefPrefix + block_id,
+                          std::to_string(ref));
+    }
+    s = zp_cli_->Delete(zp_table_, kZpRefPrefix + block_id);
   } else if (s.IsNotFound()) {
-    ref = -1;
-  } else {
+    s = Status::OK();
+  }
+  if (!s.ok()) {
     return s;
   }
+  s = zp_cli_->Delete(zp_table_, kZpBlockPrefix + block_id);
+  if (s.IsNotFound()) {
+    // Never written, e.g. ids of a failed upload
+    return Status::OK();
+  }
+  return s;
+}
 
-  if (ref < 0) {
-    s = zp_cli_->Delete(zp_table_, kZpRefPrefix + std::to_string(block_id));
-    if (!s.ok()) {
-      return s;
+static std::string DeletedQueueKey(int queue) {
+  return queue == 0 ? kZgwDeletedQueue :
+    kZgwDeletedQueue + std::to_string(queue);
+}
+
+static std::string DeletedQueueKeyOf(uint64_t deleted_time) {
+  return DeletedQueueKey(deleted_time % kZgwDeletedQueueNum);
+}
+
+static const std::string kAddAllocLeaseScript =
+  "redis.call('ZADD', KEYS[1], ARGV[1], ARGV[2]) "
+  "redis.call('HSET', KEYS[2], ARGV[2], ARGV[3] .. '|' .. ARGV[4]) "
+  "redis.call('HINCRBY', KEYS[3], ARGV[4], 1) ";
+
+// ARGV are the first ids of the committed block groups, ids not leased
+// belong to committed objects and are skipped
+static const std::string kReleaseAllocLeaseScript =
+  "for _, start in ipairs(ARGV) do "
+  "  if redis.call('ZREM', KEYS[1], start) == 1 then "
+  "    local info = redis.call('HGET', KEYS[2], start) "
+  "    redis.call('HDEL', KEYS[2], start) "
+  "    if info then "
+  "      local name = string.match(info, '^%d+|(.*)$') "
+  "      if redis.call('HINCRBY', KEYS[3], name, -1) <= 0 then "
+  "        redis.call('HDEL', KEYS[3], name) "
+  "      end "
+  "    end "
+  "  end "
+  "end ";
+
+// Queue the ids of leases expired before ARGV[1] for GC, return the
+// number of leases followed by the names of objects with no lease left
+static const std::string kReclaimAllocLeaseScript =
+  "local starts = redis.call('ZRANGEBYSCORE', KEYS[1], '-inf', ARGV[1], "
+  "                          'LIMIT', 0, tonumber(ARGV[2])) "
+  "local unleased = {} "
+  "for _, start in ipairs(starts) do "
+  "  redis.call('ZREM', KEYS[1], start) "
+  "  local info = redis.call('HGET', KEYS[2], start) "
+  "  redis.call('HDEL', KEYS[2], start) "
+  "  if info then "
+  "    local c, n, names = string.match(info, '^(%d+)|(%d+)|(.*)$') "
+  "    local s = tonumber(start) "
+  "    c = tonumber(c) "
+  "    if c > 0 then "
+  "      redis.call('ZADD', KEYS[4], ARGV[1], "
+  "                 string.format('%d-%d(0,0)/%s', s, s + c - 1, ARGV[1])) "
+  "    end "
+  "    local name = n .. '|' .. names "
+  "    if redis.call('HINCRBY', KEYS[3], name, -1) <= 0 then "
+  "      redis.call('HDEL', KEYS[3], name) "
+  "      table.insert(unleased, name) "
+  "    end "
+  "  end "
+  "end "
+  "table.insert(unleased, 1, #starts) "
+  "return unleased ";
+
+// Remove temp object name ARGV[2] from object list KEYS[2] unless a new
+// upload of the object ARGV[1] has been leased since
+static const std::string kRemoveTempNameScript =
+  "if redis.call('HEXISTS', KEYS[1], ARGV[1]) == 0 then "
+  "  redis.call('SREM', KEYS[2], ARGV[2]) "
+  "end ";
+
+Status ZgwStore::AddAllocLease(const std::string& bucket_name,
+    const std::string& object_name, uint64_t start_id, int32_t block_nums) {
+/*
+ *  1. EVAL
+ */
+  std::string name = std::to_string(bucket_name.size()) + "|" +
+    bucket_name + object_name;
+  redisReply *reply = static_cast<redisReply*>(redisCommand(redis_cli_,
+              "EVAL %s 3 %s %s %s %llu %llu %d %s",
+              kAddAllocLeaseScript.c_str(), kZgwAllocLease.c_str(),
+              kZgwAllocLeaseInfo.c_str(), kZgwAllocLeaseCount.c_str(),
+              slash::NowMicros() + kZgwAllocLeaseTime, start_id, block_nums,
+              name.c_str()));
+  if (reply == NULL) {
+    return HandleIOError("AddAllocLease::EVAL");
+  }
+  if (reply->type == REDIS_REPLY_ERROR) {
+    return HandleLogicError("AddAllocLease::EVAL ret: " + std::string(reply->str), reply, false);
+  }
+  freeReplyObject(reply);
+  return Status::OK();
+}
+
+// EVAL arguments releasing the leases of the block groups of data_block,
+// false if data_block has no block group
+static bool ReleaseAllocLeaseArgs(const std::string& data_block,
+                                  std::vector<std::string>* args) {
+  std::vector<std::string> groups;
+  slash::StringSplit(data_block, '|', groups);
+  args->clear();
+  args->push_back("EVAL");
+  args->push_back(kReleaseAllocLeaseScript);
+  args->push_back("3");
+  args->push_back(kZgwAllocLease);
+  args->push_back(kZgwAllocLeaseInfo);
+  args->push_back(kZgwAllocLeaseCount);
+  for (auto& group : groups) {
+    uint64_t start_id, end_id, start_byte, size;
+    if (sscanf(group.c_str(), "%lu-%lu(%lu,%lu)",
+               &start_id, &end_id, &start_byte, &size) == 4) {
+      args->push_back(std::to_string(start_id));
     }
-    return zp_cli_->Delete(zp_table_, kZpBlockPrefix + std::to_string(block_id));
   }
+  return args->size() > 6;
+}
 
-  return zp_cli_->Set(zp_table_, kZpRefPrefix + std::to_string(block_id),
-                      std::to_string(ref));
+static void CommandArgv(const std::vector<std::string>& args,
+                        std::vector<const char*>* argv,
+                        std::vector<size_t>* argvlen) {
+  argv->clear();
+  argvlen->clear();
+  for (auto& arg : args) {
+    argv->push_back(arg.c_str());
+    argvlen->push_back(arg.size());
+  }
+}
+
+Status ZgwStore::ReclaimAllocLeases(int32_t max_count, int32_t* reclaimed) {
+  if (!MaybeHandleRedisError()) {
+    return Status::IOError("Reconnect");
+  }
+  if (!CheckRedis()) {
+    return Status::IOError("CheckRedis Failed");
+  }
+/*
+ *  1. EVAL
+ */
+  uint64_t now = slash::NowMicros();
+  redisReply *reply = static_cast<redisReply*>(redisCommand(redis_cli_,
+              "EVAL %s 4 %s %s %s %s %llu %d",
+              kReclaimAllocLeaseScript.c_str(), kZgwAllocLease.c_str(),
+              kZgwAllocLeaseInfo.c_str(), kZgwAllocLeaseCount.c_str(),
+              DeletedQueueKeyOf(now).c_str(), now, max_count));
+  if (reply == NULL) {
+    return HandleIOError("ReclaimAllocLeases::EVAL");
+  }
+  if (reply->type == REDIS_REPLY_ERROR) {
+    return HandleLogicError("ReclaimAllocLeases::EVAL ret: " + std::string(reply->str), reply, false);
+  }
+  assert(reply->type == REDIS_REPLY_ARRAY && reply->elements > 0);
+  *reclaimed = reply->element[0]->integer;
+  // bucket_name_size|bucket_name object_name
+  std::vector<std::string> unleased;
+  for (size_t i = 1; i < reply->elements; i++) {
+    unleased.push_back(std::string(reply->element[i]->str,
+                                   reply->element[i]->len));
+  }
+  freeReplyObject(reply);
+/*
+ *  2. EVAL of each object with no lease left
+ */
+  for (auto& name : unleased) {
+    size_t sep_pos = name.find('|');
+    size_t bucket_size = std::strtoul(name.c_str(), NULL, 10);
+    if (sep_pos == std::string::npos ||
+        sep_pos + 1 + bucket_size > name.size()) {
+      LOG(WARNING) << "Unknow lease name: " << name;
+      continue;
+    }
+    std::string bucket_name = name.substr(sep_pos + 1, bucket_size);
+    std::string object_name = name.substr(sep_pos + 1 + bucket_size);
+    std::vector<std::string> args = {
+      "EVAL", kRemoveTempNameScript, "2", kZgwAllocLeaseCount,
+      kZgwObjectListPrefix + bucket_name, name,
+      kZgwTempObjectNamePrefix + object_name };
+    std::vector<const char*> argv;
+    std::vector<size_t> argvlen;
+    CommandArgv(args, &argv, &argvlen);
+    reply = static_cast<redisReply*>(redisCommandArgv(redis_cli_,
+                argv.size(), &argv[0], &argvlen[0]));
+    if (reply == NULL) {
+      return HandleIOError("ReclaimAllocLeases::EVAL");
+    }
+    if (reply->type == REDIS_REPLY_ERROR) {
+      return HandleLogicError("ReclaimAllocLeases::EVAL ret: " + std::string(reply->str), reply, false);
+    }
+    freeReplyObject(reply);
+  }
+  return Status::OK();
 }
 
 Status ZgwStore::Lock() {
@@ -209,16 +537,16 @@ Status ZgwStore::UnLock() {
     return Status::IOError("CheckRedis Failed");
   }
 
-  std::string del_cmd = "if redis.call(\"get\", \"zgw_lock\") == \"" + lock_name_ + "\" "
+  std::string del_cmd = "if redis.call(\"get\", KEYS[1]) == \"" + lock_name_ + "\" "
                         "then "
-                        "return redis.call(\"del\", \"zgw_lock\") "
+                        "return redis.call(\"del\", KEYS[1]) "
                         "else "
                         "return 0 "
                         "end ";
 
   redisReply *reply;
   reply = static_cast<redisReply*>(redisCommand(redis_cli_,
-              "EVAL %s %d", del_cmd.c_str(), 0));
+              "EVAL %s %d %s", del_cmd.c_str(), 1, "zgw_lock"));
   if (reply == NULL) {
     return HandleIOError("UnLock");
   }
@@ -950,8 +1278,12 @@ Status ZgwStore::AllocateId(const std::string& user_name, const std::string& buc
 /*
  *  5. INCRBY
  */
+  // The empty block group tail_id-(tail_id-1) of an empty upload starts
+  // with an id of its own, not the first id of the next upload, so do
+  // their leases
+  int32_t id_nums = std::max(block_nums, 1);
   reply = static_cast<redisReply*>(redisCommand(redis_cli_,
-              "INCRBY %s %d", kZgwIdGen.c_str(), block_nums));
+              "INCRBY %s %d", kZgwIdGen.c_str(), id_nums));
   if (reply == NULL) {
     return HandleIOError("AllocateId::INCRBY");
   }
@@ -959,15 +1291,58 @@ Status ZgwStore::AllocateId(const std::string& user_name, const std::string& buc
     return HandleLogicError("AllocateId::INCRBY ret: " + std::string(reply->str), reply, true);
   }
   assert(reply->type == REDIS_REPLY_INTEGER);
-  *tail_id = reply->integer;
+  *tail_id = reply->integer - (id_nums - block_nums);
   freeReplyObject(reply);
 /*
- *  6. UnLock
+ *  6. Lease
+ */
+  s = AddAllocLease(bucket_name, object_name, *tail_id - block_nums,
+                    block_nums);
+  if (!s.ok()) {
+    if (!s.IsIOError()) {
+      UnLock();
+    }
+    return s;
+  }
+/*
+ *  7. UnLock
  */
   s = UnLock();
   return s;
 }
 
+Status ZgwStore::AllocateMoreId(const std::string& bucket_name,
+    const std::string& object_name, const int32_t block_nums, uint64_t* tail_id) {
+  if (!MaybeHandleRedisError()) {
+    return Status::IOError("Reconnect");
+  }
+  if (!CheckRedis()) {
+    return Status::IOError("CheckRedis Failed");
+  }
+/*
+ *  1. INCRBY
+ */
+  redisReply *reply;
+  // Same as AllocateId
+  int32_t id_nums = std::max(block_nums, 1);
+  reply = static_cast<redisReply*>(redisCommand(redis_cli_,
+              "INCRBY %s %d", kZgwIdGen.c_str(), id_nums));
+  if (reply == NULL) {
+    return HandleIOError("AllocateMoreId::INCRBY");
+  }
+  if (reply->type == REDIS_REPLY_ERROR) {
+    return HandleLogicError("AllocateMoreId::INCRBY ret: " + std::string(reply->str), reply, false);
+  }
+  assert(reply->type == REDIS_REPLY_INTEGER);
+  *tail_id = reply->integer - (id_nums - block_nums);
+  freeReplyObject(reply);
+/*
+ *  2. Lease
+ */
+  return AddAllocLease(bucket_name, object_name, *tail_id - block_nums,
+                       block_nums);
+}
+
 Status ZgwStore::AddObject(const Object& object, const bool need_lock) {
   if (!MaybeHandleRedisError()) {
     return Status::IOError("Reconnect");
@@ -1003,21 +1378,42 @@ Status ZgwStore::AddObject(const Object& object, const bool need_lock) {
   if (reply->elements != 0) {
     Object t_object = GenObjectFromReply(reply);
     old_size = t_object.size;
+    uint64_t deleted_time = slash::NowMicros();
     redisReply* t_reply = static_cast<redisReply*>(redisCommand(redis_cli_,
-                "LPUSH %s %s", kZgwDeletedList.c_str(), std::string(t_object.data_block +
-                "/" + std::to_string(slash::NowMicros())).c_str()));
+                "ZADD %s %llu %s", DeletedQueueKeyOf(deleted_time).c_str(), deleted_time,
+                DeletedItemMember(t_object.data_block, deleted_time).c_str()));
     if (t_reply == NULL) {
-      return HandleIOError("AddObject::LPUSH");
+      return HandleIOError("AddObject::ZADD");
     }
     if (t_reply->type == REDIS_REPLY_ERROR) {
-      return HandleLogicError("AddObject::LPUSH ret: " + std::string(reply->str), reply, need_lock);
+      return HandleLogicError("AddObject::ZADD ret: " + std::string(reply->str), reply, need_lock);
     }
     assert(t_reply->type == REDIS_REPLY_INTEGER);
     freeReplyObject(t_reply);
   }
   freeReplyObject(reply);
 /*
- *  3. DEL
+ *  3. EVAL
+ */
+  // Release the leases before the blocks are referenced, blocks are
+  // leaked rather than reclaimed if the rest failed
+  std::vector<std::string> lease_args;
+  if (ReleaseAllocLeaseArgs(object.data_block, &lease_args)) {
+    std::vector<const char*> argv;
+    std::vector<size_t> argvlen;
+    CommandArgv(lease_args, &argv, &argvlen);
+    reply = static_cast<redisReply*>(redisCommandArgv(redis_cli_,
+                argv.size(), &argv[0], &argvlen[0]));
+    if (reply == NULL) {
+      return HandleIOError("AddObject::EVAL");
+    }
+    if (reply->type == REDIS_REPLY_ERROR) {
+      return HandleLogicError("AddObject::EVAL ret: " + std::string(reply->str), reply, need_lock);
+    }
+    freeReplyObject(reply);
+  }
+/*
+ *  4. DEL
  */
   reply = static_cast<redisReply*>(redisCommand(redis_cli_,
               "DEL %s%s_%s", kZgwObjectPrefix.c_str(), object.bucket_name.c_str(),
@@ -1028,10 +1424,10 @@ Status ZgwStore::AddObject(const Object& object, const bool need_lock) {
   assert(reply->type == REDIS_REPLY_INTEGER);
   freeReplyObject(reply);
 /*
- *  4. HMSET
+ *  5. HMSET
  */
   const char* hmset_cmd_fmt = "HMSET %s%s_%s bname %s oname %s etag %s "
-    "size %lld owner %s lm %llu class %d acl %s id %s block %s";
+    "size %lld owner %s lm %llu class %d acl %s id %s block %s codec %d";
   reply = static_cast<redisReply*>(redisCommand(redis_cli_, hmset_cmd_fmt,
         kZgwObjectPrefix.c_str(),
         object.bucket_name.c_str(),
@@ -1045,7 +1441,8 @@ Status ZgwStore::AddObject(const Object& object, const bool need_lock) {
         object.storage_class,
         object.acl.c_str(),
         object.upload_id.c_str(),
-        object.data_block.c_str()));
+        object.data_block.c_str(),
+        object.codec));
   if (reply == NULL) {
     return HandleIOError("AddObject::HMSET");
   }
@@ -1055,7 +1452,7 @@ Status ZgwStore::AddObject(const Object& object, const bool need_lock) {
   assert(reply->type == REDIS_REPLY_STATUS);
   freeReplyObject(reply);
 /*
- *  5. SADD
+ *  6. SADD
  */
   reply = static_cast<redisReply*>(redisCommand(redis_cli_,
               "SADD %s%s %s", kZgwObjectListPrefix.c_str(), object.bucket_name.c_str(),
@@ -1072,7 +1469,7 @@ Status ZgwStore::AddObject(const Object& object, const bool need_lock) {
   }
   freeReplyObject(reply);
 /*
- *  6. HINCRBY
+ *  7. HINCRBY
  */
   reply = static_cast<redisReply*>(redisCommand(redis_cli_,
               "HINCRBY %s%s vol %lld", kZgwBucketPrefix.c_str(), object.bucket_name.c_str(),
@@ -1085,7 +1482,7 @@ Status ZgwStore::AddObject(const Object& object, const bool need_lock) {
   }
   assert(reply->type == REDIS_REPLY_INTEGER);
 /*
- *  7. SREM
+ *  8. SREM
  */
   reply = static_cast<redisReply*>(redisCommand(redis_cli_,
               "SREM %s%s %s%s", kZgwObjectListPrefix.c_str(), object.bucket_name.c_str(),
@@ -1096,7 +1493,7 @@ Status ZgwStore::AddObject(const Object& object, const bool need_lock) {
   assert(reply->type == REDIS_REPLY_INTEGER);
   freeReplyObject(reply);
 /*
- *  8. UnLock
+ *  9. UnLock
  */
   if (need_lock) {
     s = UnLock();
@@ -1104,6 +1501,136 @@ Status ZgwStore::AddObject(const Object& object, const bool need_lock) {
   return s;
 }
 
+Status ZgwStore::AddObjects(const std::vector<Object>& objects,
+    std::vector<Status>* results) {
+  results->assign(objects.size(), Status::OK());
+  if (objects.empty()) {
+    return Status::OK();
+  }
+  if (!MaybeHandleRedisError()) {
+    return Status::IOError("Reconnect");
+  }
+  if (!CheckRedis()) {
+    return Status::IOError("CheckRedis Failed");
+  }
+/*
+ *  1. Lock
+ */
+  Status s;
+  s = Lock();
+  if (!s.ok()) {
+    return s;
+  }
+/*
+ *  2. Pipelined HGETALL
+ */
+  redisReply *reply;
+  for (auto& object : objects) {
+    redisAppendCommand(redis_cli_, "HGETALL %s%s_%s", kZgwObjectPrefix.c_str(),
+                       object.bucket_name.c_str(), object.object_name.c_str());
+  }
+  std::vector<Object> old_objects(objects.size());
+  std::vector<bool> has_old(objects.size(), false);
+  for (size_t i = 0; i < objects.size(); i++) {
+    if (redisGetReply(redis_cli_, reinterpret_cast<void**>(&reply)) != REDIS_OK) {
+      return HandleIOError("AddObjects::HGETALL");
+    }
+    if (reply->type == REDIS_REPLY_ERROR) {
+      (*results)[i] = Status::Corruption("AddObjects::HGETALL ret: " +
+                                         std::string(reply->str));
+    } else if (reply->elements != 0) {
+      old_objects[i] = GenObjectFromReply(reply);
+      has_old[i] = true;
+    }
+    freeReplyObject(reply);
+  }
+  // The later one of the same object in this batch replaces the former
+  std::map<std::string, size_t> latest;
+  for (size_t i = 0; i < objects.size(); i++) {
+    if (!(*results)[i].ok()) {
+      continue;
+    }
+    std::string key = objects[i].bucket_name + "_" + objects[i].object_name;
+    auto iter = latest.find(key);
+    if (iter != latest.end()) {
+      old_objects[i] = objects[iter->second];
+      has_old[i] = true;
+    }
+    latest[key] = i;
+  }
+/*
+ *  3. Pipelined ZADD, EVAL, DEL, HMSET, SADD, HINCRBY, SREM of each object
+ */
+  const char* hmset_cmd_fmt = "HMSET %s%s_%s bname %s oname %s etag %s "
+    "size %lld owner %s lm %llu class %d acl %s id %s block %s codec %d";
+  std::vector<int> cmd_nums(objects.size(), 0);
+  std::vector<std::string> lease_args;
+  std::vector<const char*> argv;
+  std::vector<size_t> argvlen;
+  for (size_t i = 0; i < objects.size(); i++) {
+    if (!(*results)[i].ok()) {
+      continue;
+    }
+    const Object& object = objects[i];
+    int64_t old_size = 0;
+    if (has_old[i]) {
+      old_size = old_objects[i].size;
+      uint64_t deleted_time = slash::NowMicros();
+      redisAppendCommand(redis_cli_, "ZADD %s %llu %s",
+                         DeletedQueueKeyOf(deleted_time).c_str(), deleted_time,
+                         DeletedItemMember(old_objects[i].data_block,
+                                           deleted_time).c_str());
+      cmd_nums[i]++;
+    }
+    if (ReleaseAllocLeaseArgs(object.data_block, &lease_args)) {
+      CommandArgv(lease_args, &argv, &argvlen);
+      redisAppendCommandArgv(redis_cli_, argv.size(), &argv[0], &argvlen[0]);
+      cmd_nums[i]++;
+    }
+    redisAppendCommand(redis_cli_, "DEL %s%s_%s", kZgwObjectPrefix.c_str(),
+                       object.bucket_name.c_str(), object.object_name.c_str());
+    redisAppendCommand(redis_cli_, hmset_cmd_fmt,
+                       kZgwObjectPrefix.c_str(),
+                       object.bucket_name.c_str(),
+                       object.object_name.c_str(),
+                       object.bucket_name.c_str(),
+                       object.object_name.c_str(),
+                       object.etag.c_str(),
+                       object.size,
+                       object.owner.c_str(),
+                       object.last_modified,
+                       object.storage_class,
+                       object.acl.c_str(),
+                       object.upload_id.c_str(),
+                       object.data_block.c_str(),
+                       object.codec);
+    redisAppendCommand(redis_cli_, "SADD %s%s %s", kZgwObjectListPrefix.c_str(),
+                       object.bucket_name.c_str(), object.object_name.c_str());
+    redisAppendCommand(redis_cli_, "HINCRBY %s%s vol %lld", kZgwBucketPrefix.c_str(),
+                       object.bucket_name.c_str(), object.size - old_size);
+    redisAppendCommand(redis_cli_, "SREM %s%s %s%s", kZgwObjectListPrefix.c_str(),
+                       object.bucket_name.c_str(), kZgwTempObjectNamePrefix.c_str(),
+                       object.object_name.c_str());
+    cmd_nums[i] += 5;
+  }
+  for (size_t i = 0; i < objects.size(); i++) {
+    for (int j = 0; j < cmd_nums[i]; j++) {
+      if (redisGetReply(redis_cli_, reinterpret_cast<void**>(&reply)) != REDIS_OK) {
+        return HandleIOError("AddObjects::Pipeline");
+      }
+      if (reply->type == REDIS_REPLY_ERROR && (*results)[i].ok()) {
+        (*results)[i] = Status::Corruption("AddObjects ret: " +
+                                           std::string(reply->str));
+      }
+      freeReplyObject(reply);
+    }
+  }
+/*
+ *  4. UnLock
+ */
+  return UnLock();
+}
+
 Status ZgwStore::GetObject(const std::string& user_name, const std::string& bucket_name,
     const std::string& object_name, Object* object) {
   if (!MaybeHandleRedisError()) {
@@ -1193,16 +1720,17 @@ Status ZgwStore::DeleteObject(const std::string& user_name, const std::string& b
     Object t_object = GenObjectFromReply(reply);
     delta_size = t_object.size;
     if (delete_block) {
+      uint64_t deleted_time = slash::NowMicros();
       redisReply* t_reply = static_cast<redisReply*>(redisCommand(redis_cli_,
-          "LPUSH %s %s", kZgwDeletedList.c_str(), std::string(t_object.data_block +
-          "/" + std::to_string(slash::NowMicros())).c_str()));
+          "ZADD %s %llu %s", DeletedQueueKeyOf(deleted_time).c_str(), deleted_time,
+          DeletedItemMember(t_object.data_block, deleted_time).c_str()));
       if (t_reply == NULL) {
         freeReplyObject(reply);
-        return HandleIOError("DeleteObject::LPUSH");
+        return HandleIOError("DeleteObject::ZADD");
       }
       if (t_reply->type == REDIS_REPLY_ERROR) {
         freeReplyObject(reply);
-        return HandleLogicError("DeleteObject::LPUSH ret: " + std::string(reply->str),
+        return HandleLogicError("DeleteObject::ZADD ret: " + std::string(reply->str),
                                 reply, need_lock);
       }
       assert(t_reply->type == REDIS_REPLY_INTEGER);
@@ -1627,6 +2155,8 @@ Bucket ZgwStore::GenBucketFromReply(redisReply* reply) {
 
 Object ZgwStore::GenObjectFromReply(redisReply* reply) {
   Object object;
+  // Objects written before codec was introduced
+  object.codec = kObjectBlockRaw;
   char* end;
   for (unsigned int i = 0; i < reply->elements; i++) {
     if (std::string(reply->element[i]->str) == "bname") {
@@ -1660,65 +2190,252 @@ Object ZgwStore::GenObjectFromReply(redisReply* reply) {
       continue;
     } else if (std::string(reply->element[i]->str) == "block") {
       object.data_block = reply->element[++i]->str;
+      continue;
+    } else if (std::string(reply->element[i]->str) == "codec") {
+      object.codec = std::atoi(reply->element[++i]->str);
     }
   }
   return object;
 }
 
-Status ZgwStore::GetDeletedItem(std::string* item) {
-  Status s;
-  s = Lock();
-  if (!s.ok()) {
-    return s;
+// Move at most ARGV[3] items of the list written by older versions into
+// the queue, then take the items deleted before ARGV[1] off the queue
+static const std::string kGetDeletedItemsScript =
+  "local n = tonumber(ARGV[2]) "
+  "for i = 1, tonumber(ARGV[3]) do "
+  "  local item = redis.call('RPOP', KEYS[2]) "
+  "  if not item then break end "
+  "  redis.call('ZADD', KEYS[1], string.match(item, '/(%d+)$') or 0, item) "
+  "end "
+  "local items = redis.call('ZRANGEBYSCORE', KEYS[1], '-inf', ARGV[1], "
+  "                         'LIMIT', 0, n) "
+  "if #items > 0 then redis.call('ZREM', KEYS[1], unpack(items)) end "
+  "return items ";
+
+Status ZgwStore::GetDeletedItems(int queue, int32_t max_count,
+    uint64_t deleted_before, std::vector<std::string>* items) {
+  if (!MaybeHandleRedisError()) {
+    return Status::IOError("Reconnect");
   }
-
-  redisReply* reply = static_cast<redisReply*>(redisCommand(redis_cli_,
-              "LPOP %s", kZgwDeletedList.c_str()));
+  if (!CheckRedis()) {
+    return Status::IOError("CheckRedis Failed");
+  }
+  items->clear();
+/*
+ *  1. EVAL
+ */
+  redisReply *reply = static_cast<redisReply*>(redisCommand(redis_cli_,
+              "EVAL %s 2 %s %s %llu %d %d", kGetDeletedItemsScript.c_str(),
+              DeletedQueueKey(queue).c_str(), kZgwDeletedList.c_str(),
+              deleted_before, max_count, queue == 0 ? max_count : 0));
   if (reply == NULL) {
-    freeReplyObject(reply);
-    return HandleIOError("GetDeteledItem::LPOP");
+    return HandleIOError("GetDeletedItems::EVAL");
   }
   if (reply->type == REDIS_REPLY_ERROR) {
-    freeReplyObject(reply);
-    return HandleLogicError("PutDeletedItem::LPOP ret: " +
-                            std::string(reply->str), reply, true);
+    return HandleLogicError("GetDeletedItems::EVAL ret: " +
+                            std::string(reply->str), reply, false);
   }
-  bool empty = !(reply->type == REDIS_REPLY_STRING);
-  if (!empty) {
-    item->assign(reply->str);
+  assert(reply->type == REDIS_REPLY_ARRAY);
+  // Oldest first
+  for (size_t i = 0; i < reply->elements; i++) {
+    items->push_back(reply->element[i]->str);
   }
-
   freeReplyObject(reply);
+  return Status::OK();
+}
 
-  s = UnLock();
-  if (!s.ok()) {
-    return s;
+Status ZgwStore::GetDeletedQueueInfo(uint64_t* count,
+    uint64_t* oldest_deleted_time) {
+  if (!MaybeHandleRedisError()) {
+    return Status::IOError("Reconnect");
   }
+  if (!CheckRedis()) {
+    return Status::IOError("CheckRedis Failed");
+  }
+/*
+ *  1. Pipelined ZCARD, ZRANGE, LLEN
+ */
+  redisReply *reply;
+  for (int i = 0; i < kZgwDeletedQueueNum; i++) {
+    redisAppendCommand(redis_cli_, "ZCARD %s", DeletedQueueKey(i).c_str());
+    redisAppendCommand(redis_cli_, "ZRANGE %s 0 0 WITHSCORES",
+                       DeletedQueueKey(i).c_str());
+  }
+  redisAppendCommand(redis_cli_, "LLEN %s", kZgwDeletedList.c_str());
+  *count = 0;
+  *oldest_deleted_time = 0;
+  Status s;
+  for (int i = 0; i < kZgwDeletedQueueNum * 2 + 1; i++) {
+    if (redisGetReply(redis_cli_, reinterpret_cast<void**>(&reply)) != REDIS_OK) {
+      return HandleIOError("GetDeletedQueueInfo::Pipeline");
+    }
+    if (reply->type == REDIS_REPLY_ERROR) {
+      s = Status::Corruption("GetDeletedQueueInfo ret: " +
+                             std::string(reply->str));
+    } else if (reply->type == REDIS_REPLY_INTEGER) {
+      *count += reply->integer;
+    } else if (reply->type == REDIS_REPLY_ARRAY && reply->elements == 2) {
+      uint64_t deleted_time = static_cast<uint64_t>(
+        std::strtod(reply->element[1]->str, NULL));
+      if (*oldest_deleted_time == 0 || deleted_time < *oldest_deleted_time) {
+        *oldest_deleted_time = deleted_time;
+      }
+    }
+    freeReplyObject(reply);
+  }
+  return s;
+}
 
-  return empty ? Status::NotFound("") : Status::OK();
+Status ZgwStore::PutBackDeletedItems(const std::vector<std::string>& items) {
+  if (!MaybeHandleRedisError()) {
+    return Status::IOError("Reconnect");
+  }
+  if (!CheckRedis()) {
+    return Status::IOError("CheckRedis Failed");
+  }
+  if (items.empty()) {
+    return Status::OK();
+  }
+/*
+ *  1. ZADD of each queue
+ */
+  // Scored by the deleted time they carry, deleted_time or
+  // deleted_time:tag after the last '/'
+  std::map<int, std::vector<std::string>> queue_args;
+  for (auto& item : items) {
+    size_t slash_pos = item.rfind('/');
+    uint64_t deleted_time = slash_pos == std::string::npos ? 0 :
+      std::strtoull(item.c_str() + slash_pos + 1, NULL, 10);
+    int queue = deleted_time % kZgwDeletedQueueNum;
+    std::vector<std::string>& args = queue_args[queue];
+    if (args.empty()) {
+      args.push_back("ZADD");
+      args.push_back(DeletedQueueKey(queue));
+    }
+    args.push_back(std::to_string(deleted_time));
+    args.push_back(item);
+  }
+  std::vector<const char*> argv;
+  std::vector<size_t> argvlen;
+  for (auto& qa : queue_args) {
+    CommandArgv(qa.second, &argv, &argvlen);
+    redisReply *reply = static_cast<redisReply*>(redisCommandArgv(redis_cli_,
+                argv.size(), &argv[0], &argvlen[0]));
+    if (reply == NULL) {
+      return HandleIOError("PutBackDeletedItems::ZADD");
+    }
+    if (reply->type == REDIS_REPLY_ERROR) {
+      return HandleLogicError("PutBackDeletedItems::ZADD ret: " +
+                              std::string(reply->str), reply, false);
+    }
+    freeReplyObject(reply);
+  }
+  return Status::OK();
 }
 
-Status ZgwStore::PutDeletedItem(const std::string& item, uint64_t deleted_time) {
-  Status s = Lock();
-  if (!s.ok()) {
-    return s;
+// Register the gateway, renew its claims within the quota of
+// ceil(queue number / gateways), release the claims over the quota, and
+// claim free queues until the quota. KEYS[q + 2] is the claim of queue q
+static const std::string kClaimDeletedQueuesScript =
+  "local owner = ARGV[1] "
+  "local now = tonumber(ARGV[2]) "
+  "local ttl = tonumber(ARGV[3]) "
+  "local n = #KEYS - 1 "
+  "redis.call('ZADD', KEYS[1], now, owner) "
+  "redis.call('ZREMRANGEBYSCORE', KEYS[1], '-inf', now - ttl) "
+  "local quota = math.ceil(n / redis.call('ZCARD', KEYS[1])) "
+  "local owned = {} "
+  "for q = 0, n - 1 do "
+  "  local key = KEYS[q + 2] "
+  "  if redis.call('GET', key) == owner then "
+  "    if #owned < quota then "
+  "      redis.call('PEXPIRE', key, ttl) "
+  "      table.insert(owned, q) "
+  "    else "
+  "      redis.call('DEL', key) "
+  "    end "
+  "  end "
+  "end "
+  "for q = 0, n - 1 do "
+  "  if #owned >= quota then break end "
+  "  if redis.call('SET', KEYS[q + 2], owner, 'NX', 'PX', ttl) then "
+  "    table.insert(owned, q) "
+  "  end "
+  "end "
+  "return owned ";
+
+Status ZgwStore::ClaimDeletedQueues(int32_t claim_ttl_ms, std::vector<int>* queues) {
+  if (!MaybeHandleRedisError()) {
+    return Status::IOError("Reconnect");
   }
+  if (!CheckRedis()) {
+    return Status::IOError("CheckRedis Failed");
+  }
+/*
+ *  1. EVAL
+ */
+  std::vector<std::string> args = {
+    "EVAL", kClaimDeletedQueuesScript,
+    std::to_string(kZgwDeletedQueueNum + 1), kZgwGCMembers };
+  for (int i = 0; i < kZgwDeletedQueueNum; i++) {
+    args.push_back(kZgwGCClaimPrefix + std::to_string(i));
+  }
+  args.push_back(lock_name_);
+  args.push_back(std::to_string(slash::NowMicros() / 1000));
+  args.push_back(std::to_string(claim_ttl_ms));
+  std::vector<const char*> argv;
+  std::vector<size_t> argvlen;
+  CommandArgv(args, &argv, &argvlen);
+  redisReply *reply = static_cast<redisReply*>(redisCommandArgv(redis_cli_,
+              argv.size(), &argv[0], &argvlen[0]));
+  if (reply == NULL) {
+    return HandleIOError("ClaimDeletedQueues::EVAL");
+  }
+  if (reply->type == REDIS_REPLY_ERROR) {
+    return HandleLogicError("ClaimDeletedQueues::EVAL ret: " +
+                            std::string(reply->str), reply, false);
+  }
+  assert(reply->type == REDIS_REPLY_ARRAY);
+  queues->clear();
+  for (size_t i = 0; i < reply->elements; i++) {
+    queues->push_back(reply->element[i]->integer);
+  }
+  freeReplyObject(reply);
+  return Status::OK();
+}
 
+std::string ZgwStore::DeletedItemMember(const std::string& item,
+                                        uint64_t deleted_time) {
+  // Lock name is unique among the stores of all gateways
+  return item + "/" + std::to_string(deleted_time) + ":" + lock_name_ +
+    "." + std::to_string(deleted_seq_++);
+}
+
+Status ZgwStore::PutDeletedItem(const std::string& item, uint64_t deleted_time,
+                                const std::string& suffix) {
+  if (!MaybeHandleRedisError()) {
+    return Status::IOError("Reconnect");
+  }
+  if (!CheckRedis()) {
+    return Status::IOError("CheckRedis Failed");
+  }
+/*
+ *  1. ZADD
+ */
   redisReply* reply = static_cast<redisReply*>(redisCommand(redis_cli_,
-              "LPUSH %s %s", kZgwDeletedList.c_str(),
-              std::string(item + "/" + std::to_string(deleted_time)).c_str()));
+              "ZADD %s %llu %s", DeletedQueueKeyOf(deleted_time).c_str(), deleted_time,
+              (suffix.empty() ? DeletedItemMember(item, deleted_time) :
+               item + "/" + suffix).c_str()));
   if (reply == NULL) {
-    return HandleIOError("PutDeletedItem::LPUSH");
+    return HandleIOError("PutDeletedItem::ZADD");
   }
   if (reply->type == REDIS_REPLY_ERROR) {
-    freeReplyObject(reply);
-    return HandleLogicError("PutDeletedItem::LPUSH ret: " +
-                            std::string(reply->str), reply, true);
+    return HandleLogicError("PutDeletedItem::ZADD ret: " +
+                            std::string(reply->str), reply, false);
   }
   assert(reply->type == REDIS_REPLY_INTEGER);
   freeReplyObject(reply);
-
-  return UnLock();
+  return Status::OK();
 }
 
 }  // namespace zgwstore
@@ -33,7 +33,8 @@ class ZgwStore {
   Status BlockGet(const std::string& block_id, std::string* block_content);
   Status BlockMGet(const std::vector<std::string>& block_ids,
       std::map<std::string, std::string>* block_contents);
-  Status BlockRef(const std::string& block_id);
+  // Refcount of blocks [start_block, end_block], needn't lock
+  Status BlockRef(uint64_t start_block, uint64_t end_block);
 
   Status Lock();
   Status UnLock();
@@ -57,9 +58,18 @@ class ZgwStore {
   Status MGetBuckets(const std::string& user_name, const std::vector<std::string> buckets_name,
       std::vector<Bucket>* buckets);
 
+  // Ids [tail_id - block_nums, tail_id) are leased to the upload, an
+  // empty upload gets an unused id tail_id of its own as lease
   Status AllocateId(const std::string& user_name, const std::string& bucket_name,
       const std::string& object_name, const int32_t block_nums, uint64_t* tail_id);
+  // Allocate more ids for an upload whose bucket is checked by AllocateId
+  Status AllocateMoreId(const std::string& bucket_name, const std::string& object_name,
+      const int32_t block_nums, uint64_t* tail_id);
   Status AddObject(const Object& object, const bool need_lock = true);
+  // Pipelined AddObject of several objects in one lock, return IOError
+  // if redis failed, otherwise result of each object in results
+  Status AddObjects(const std::vector<Object>& objects,
+      std::vector<Status>* results);
   Status GetObject(const std::string& user_name, const std::string& bucket_name,
       const std::string& object_name, Object* object);
   Status DeleteObject(const std::string& user_name, const std::string& bucket_name,
@@ -80,6 +90,7 @@ class ZgwStore {
 
  private:
   friend class GCThread;
+  friend class GCWorker;
 
   bool MaybeHandleRedisError();
   Status HandleIOError(const std::string& func_name);
@@ -91,9 +102,45 @@ class ZgwStore {
   Bucket GenBucketFromReply(redisReply* reply);
   Object GenObjectFromReply(redisReply* reply);
 
-  Status GetDeletedItem(std::string* item);
-  Status PutDeletedItem(const std::string& item, uint64_t deleted_time);
-  Status BlockUnref(uint64_t block_id);
+  // Take at most max_count items deleted before deleted_before (in
+  // microseconds) off the deleted queue numbered queue, oldest first
+  Status GetDeletedItems(int queue, int32_t max_count, uint64_t deleted_before,
+      std::vector<std::string>* items);
+  // Deleted queues whose GC is claimed by this store for claim_ttl_ms
+  Status ClaimDeletedQueues(int32_t claim_ttl_ms, std::vector<int>* queues);
+  // Number of deleted items not reclaimed, and the deleted time of the
+  // oldest one, 0 if none
+  Status GetDeletedQueueInfo(uint64_t* count, uint64_t* oldest_deleted_time);
+  // Return items got by GetDeletedItems but not handled
+  Status PutBackDeletedItems(const std::vector<std::string>& items);
+  // Queue item deleted at deleted_time, suffix is deleted_time:tag of the
+  // item put back for a retry, a new tag is made if empty
+  Status PutDeletedItem(const std::string& item, uint64_t deleted_time,
+      const std::string& suffix = "");
+  // Member of the deleted queue: item/deleted_time:tag, the tag of lock
+  // name and sequence keeps items deleted in the same microsecond apart
+  std::string DeletedItemMember(const std::string& item, uint64_t deleted_time);
+  // Unreference [start_block, end_block] as group of the deleted item
+  // op_id, at most once however often called, a call after the first
+  // returns the ranges freed by the first
+  Status UnrefRange(const std::string& op_id, int group,
+      uint64_t start_block, uint64_t end_block,
+      std::vector<std::pair<uint64_t, uint64_t>>* freed_ranges);
+  // Blocks freed by the group are deleted, UnrefRange returns none of them
+  Status FinishUnrefRange(const std::string& op_id, int group);
+  // All groups of op_id are finished
+  Status ClearUnrefRanges(const std::string& op_id);
+  // Delete a block no longer referenced by UpdateRangeRef
+  Status DeleteBlock(uint64_t block);
+  // Allocated ids are leased until the block group starting with them
+  // is committed by AddObject
+  Status AddAllocLease(const std::string& bucket_name, const std::string& object_name,
+      uint64_t start_id, int32_t block_nums);
+  // Queue the ids of at most max_count expired leases for GC
+  Status ReclaimAllocLeases(int32_t max_count, int32_t* reclaimed);
+  Status UpdateRangeRef(uint64_t start_block, uint64_t end_block, int delta,
+      std::vector<std::pair<uint64_t, uint64_t>>* freed_ranges,
+      const std::string& done_key = "", const std::string& done_field = "");
 
   std::string zp_table_;
   libzp::Cluster* zp_cli_;
@@ -104,6 +151,7 @@ class ZgwStore {
   int32_t lock_ttl_;
   std::string redis_passwd_;
   bool redis_error_;
+  uint64_t deleted_seq_;
 };
 
 }  // namespace zgwstore
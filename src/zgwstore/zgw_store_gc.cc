@@ -1,37 +1,99 @@
 #include "zgw_store_gc.h"
 
+#include <ctype.h>
 #include <unistd.h>
 #include <algorithm>
 
 #include <glog/logging.h>
+#include "slash/include/slash_hash.h"
 
 namespace zgwstore {
 
 static const int kGCIntervalSeconds = 1; // 1 second
 static const int kBlockReservedTime = 1 * 60 * 60 ; // 1 hour
 // static const int kBlockReservedTime = 1 * 60; // 1 minute
+static const uint32_t kGCWaitMs = 100;
+static const int kGCMaxRetries = 5;
+static const int kGCRetryBaseMs = 100;
+static const int kGCRetryMaxMs = 10 * 1000;
+static const int kLeaseReclaimIntervalSeconds = 60;
+static const int kLeaseReclaimBatch = 128;
+// Claims of deleted queues are renewed well before they expire
+static const int kQueueClaimIntervalSeconds = 5;
+static const int32_t kQueueClaimTTLMs = 30 * 1000;
 
-std::string GCThread::GCStatus() {
-  // TODO gdq
-  return "";
+// Retry op with exponential backoff until it succeeds or kGCMaxRetries
+template <typename Op>
+static Status RetryWithBackoff(const std::string& op_name, Op op) {
+  Status s;
+  int backoff_ms = kGCRetryBaseMs;
+  for (int i = 0; i < kGCMaxRetries; i++) {
+    s = op();
+    if (s.ok()) {
+      break;
+    }
+    LOG(WARNING) << op_name << " error: " << s.ToString() << ", retry in " <<
+      backoff_ms << "ms";
+    usleep(backoff_ms * 1000);
+    backoff_ms = std::min(backoff_ms * 2, kGCRetryMaxMs);
+  }
+  return s;
+}
+
+bool ParseMultipartItem(const std::string& deleted_item,
+                        std::string* upload_id, std::string* bucket_name,
+                        std::string* object_name) {
+  static const size_t kUploadIdSize = 32;
+  if (deleted_item.size() <= kUploadIdSize) {
+    return false;
+  }
+  for (size_t i = 0; i < kUploadIdSize; i++) {
+    if (!isxdigit(deleted_item[i])) {
+      return false;
+    }
+  }
+  // Bucket names have no '|', object names may
+  size_t sep_pos = deleted_item.find('|', kUploadIdSize);
+  if (sep_pos == std::string::npos) {
+    return false;
+  }
+  upload_id->assign(deleted_item, 0, kUploadIdSize);
+  bucket_name->assign(deleted_item, kUploadIdSize, sep_pos - kUploadIdSize);
+  object_name->assign(deleted_item, sep_pos + 1, std::string::npos);
+  return true;
 }
 
-Status GCThread::ParseDeletedBlocks(const std::string& deleted_item,
-                                  std::vector<std::string>* block_indexs) {
+void GCRateLimiter::Acquire(int64_t count) {
+  if (blocks_per_sec_ <= 0) {
+    return;
+  }
+  uint64_t wait_micros = 0;
+  {
+    slash::MutexLock l(&mu_);
+    uint64_t now = slash::NowMicros();
+    if (next_micros_ < now) {
+      next_micros_ = now;
+    }
+    wait_micros = next_micros_ - now;
+    next_micros_ += count * 1000000 / blocks_per_sec_;
+  }
+  if (wait_micros > 0) {
+    usleep(wait_micros);
+  }
+}
+
+Status GCWorker::ParseDeletedBlocks(const std::string& deleted_item,
+                                    std::vector<std::string>* block_indexs) {
   Status s;
+  block_indexs->clear();
   // deleted_item: 84788d7a9282d8c0109a44b6d9c06887testbk1|ob1
-  if (deleted_item.size() > 32 &&
-      std::count(deleted_item.begin(), deleted_item.end(), '|') == 1) {
-    std::string upload_id = deleted_item.substr(0, 32);
-    size_t sep_pos = deleted_item.find('|');
-    std::string bkname = deleted_item.substr(32, sep_pos - 32);
-    std::string obname = deleted_item.substr(sep_pos + 1);
+  std::string upload_id, bkname, obname;
+  if (ParseMultipartItem(deleted_item, &upload_id, &bkname, &obname)) {
     std::vector<std::string> tmp;
     s = store_->GetMultiBlockSet(bkname, obname, upload_id, &tmp);
     if (!s.ok()) {
       return s;
     }
-    block_indexs->clear();
     for (auto& b : tmp) {
       // Trim sort sign e.g. 00012(3-9)(0,12) -> (3-9)(0,12)
       b = b.substr(5);
@@ -47,15 +109,14 @@ Status GCThread::ParseDeletedBlocks(const std::string& deleted_item,
         upload_id << " error: " << s.ToString();
       return s;
     }
+    return Status::OK();
   }
-  // deleted_item: 
+  // deleted_item:
   //    1235-1235(0,258)
   //    1235-1235(0,258)|1236-1236(0,258)
   int lbracket = std::count(deleted_item.begin(), deleted_item.end(), '(');
   int rbracket = std::count(deleted_item.begin(), deleted_item.end(), ')');
-  if (block_indexs->empty() &&
-      lbracket != 0 &&
-      lbracket == rbracket) {
+  if (lbracket != 0 && lbracket == rbracket) {
     std::vector<std::string> items;
     slash::StringSplit(deleted_item, '|', items);
     for (auto& i : items) {
@@ -66,79 +127,384 @@ Status GCThread::ParseDeletedBlocks(const std::string& deleted_item,
   return Status::OK();
 }
 
-void* GCThread::ThreadMain() {
-  while (!should_stop()) {
-    uint64_t now = slash::NowMicros();
-    if (now - latest_action_time_ < kGCIntervalSeconds * 1e6) {
-      sleep(kGCIntervalSeconds);
+Status GCWorker::ReclaimItem(const std::string& item) {
+  size_t slash_pos = item.rfind('/');
+  if (slash_pos == std::string::npos) {
+    LOG(WARNING) << "Unknow format: " << item;
+    return Status::OK();
+  }
+  // e.g.       deleted_blocks     deleted_time:tag
+  //      item: 1235-1235(0,258)/1498186110766016:host8080.7
+  //            1235-1235(0,258)|1236-1236(0,258)/1498186110766016:host8080.8
+  //            84788d7a9282d8c0109a44b6d9c06887testbk1|ob1/1498186110766016
+  // Items of older versions have no :tag
+  std::string suffix = item.substr(slash_pos + 1);
+  uint64_t deleted_time = std::strtoull(suffix.c_str(), NULL, 10);
+  std::string deleted_blocks = item.substr(0, slash_pos);
+
+  std::vector<std::string> block_indexs;
+  Status s = RetryWithBackoff("ParseDeletedBlocks " + deleted_blocks, [&]() {
+    return ParseDeletedBlocks(deleted_blocks, &block_indexs);
+  });
+  if (!s.ok()) {
+    gc_->RecordError("ParseDeletedBlocks " + deleted_blocks + ": " +
+                     s.ToString());
+    // Leave it to the next round
+    Status put_s = store_->PutDeletedItem(deleted_blocks, deleted_time,
+                                          suffix);
+    if (!put_s.ok()) {
+      LOG(ERROR) << "PutDeletedItem error: " << item << " " <<
+        put_s.ToString();
+    }
+    return s;
+  }
+
+  // Groups of a retried item are those of the first try, whatever the
+  // format of the item was, so are the marks of UnrefRange. The tag tells
+  // apart items of the same groups deleted at the same time, a copy and
+  // its source
+  std::string groups;
+  for (size_t i = 0; i < block_indexs.size(); i++) {
+    groups += (i == 0 ? "" : "|") + block_indexs[i];
+  }
+  std::string op_id = slash::md5(groups + "/" + suffix);
+
+  // Blocks whose range is unreferenced but DeleteBlock failed
+  std::vector<uint64_t> failed_blocks;
+  for (size_t i = 0; i < block_indexs.size(); i++) {
+    const std::string& index = block_indexs[i];
+    LOG(INFO) << "Delete block: " << index;
+
+    uint64_t start_block, end_block, start_byte, size;
+    if (sscanf(index.c_str(), "%lu-%lu(%lu,%lu)",
+               &start_block, &end_block, &start_byte, &size) != 4) {
+      LOG(WARNING) << "Unknow format: " << index;
+      continue;
+    }
+    if (start_block > end_block) {
+      // Empty object
       continue;
     }
-    latest_action_time_ = now;
 
-    std::string item, deleted_blocks;
-    uint64_t deleted_time;
-    Status s = store_->GetDeletedItem(&item);
+    // Safe to retry, UnrefRange decrements once for each group
+    std::vector<std::pair<uint64_t, uint64_t>> freed_ranges;
+    s = RetryWithBackoff("UnrefRange " + index, [&]() {
+      return store_->UnrefRange(op_id, i, start_block, end_block,
+                                &freed_ranges);
+    });
     if (!s.ok()) {
-      if (s.IsNotFound()) {
-        continue;
+      gc_->RecordError("UnrefRange " + index + ": " + s.ToString());
+      // Finished groups are skipped by the next round
+      RequeueBlocks(failed_blocks, deleted_time);
+      Status put_s = store_->PutDeletedItem(groups, deleted_time, suffix);
+      if (!put_s.ok()) {
+        LOG(ERROR) << "PutDeletedItem error: " << groups << " " <<
+          put_s.ToString();
+      }
+      return s;
+    }
+
+    for (auto& range : freed_ranges) {
+      for (uint64_t b = range.first; b <= range.second; b++) {
+        if (!should_stop()) {
+          gc_->rate_limiter_.Acquire(1);
+        }
+        s = RetryWithBackoff("DeleteBlock " + std::to_string(b), [&]() {
+          return store_->DeleteBlock(b);
+        });
+        if (!s.ok()) {
+          gc_->RecordError("DeleteBlock " + std::to_string(b) + ": " +
+                           s.ToString());
+          failed_blocks.push_back(b);
+          continue;
+        }
+        gc_->reclaimed_blocks_++;
+        // Approximately, blocks of a group share its size
+        gc_->reclaimed_bytes_ += size / (end_block - start_block + 1);
       }
-      LOG(ERROR) << "GetDeteledItem error: " << item << " " <<
-        s.ToString();
-      // TODO (gaodq)
-      return nullptr;
-    }
-    size_t slash_pos = item.find('/');
-    if (slash_pos == std::string::npos) {
-      LOG(WARNING) << "Unknow format: " << item;
-      continue;
     }
-    // e.g.       deleted_blocks     deleted_time
-    //      item: 1235-1235(0,258)/1498186110766016
-    //            1235-1235(0,258)|1236-1236(0,258)/1498186110766016
-    //            84788d7a9282d8c0109a44b6d9c06887testbk1|ob1/1498186110766016
-    deleted_time = std::atol(item.substr(slash_pos + 1).c_str());
-    deleted_blocks = item.substr(0, slash_pos);
-    if (now - deleted_time < kBlockReservedTime * 1e6) {
-      s = store_->PutDeletedItem(deleted_blocks, deleted_time);
+
+    if (!freed_ranges.empty()) {
+      // Or a retry of this item would delete them again
+      s = RetryWithBackoff("FinishUnrefRange " + index, [&]() {
+        return store_->FinishUnrefRange(op_id, i);
+      });
       if (!s.ok()) {
-        LOG(ERROR) << "PutDeletedItem error: " << item << " " <<
-          s.ToString();
-        return nullptr;
+        gc_->RecordError("FinishUnrefRange " + index + ": " + s.ToString());
       }
+    }
+  }
+
+  RequeueBlocks(failed_blocks, deleted_time);
+  s = store_->ClearUnrefRanges(op_id);
+  if (!s.ok()) {
+    // Expires anyway
+    LOG(WARNING) << "ClearUnrefRanges error: " << groups << " " <<
+      s.ToString();
+  }
+  gc_->reclaimed_items_++;
+  return Status::OK();
+}
+
+void GCWorker::RequeueBlocks(const std::vector<uint64_t>& blocks,
+                             uint64_t deleted_time) {
+  if (blocks.empty()) {
+    return;
+  }
+  // No longer in kZgwRangeRef, UnrefRange of the next round frees them
+  // again. Consecutive blocks are merged into one group
+  std::string groups;
+  char buf[100];
+  size_t i = 0;
+  while (i < blocks.size()) {
+    size_t j = i;
+    while (j + 1 < blocks.size() && blocks[j + 1] == blocks[j] + 1) {
+      j++;
+    }
+    sprintf(buf, "%lu-%lu(0,0)", blocks[i], blocks[j]);
+    groups += (groups.empty() ? "" : "|") + std::string(buf);
+    i = j + 1;
+  }
+  Status s = RetryWithBackoff("PutDeletedItem " + groups, [&]() {
+    return store_->PutDeletedItem(groups, deleted_time);
+  });
+  if (!s.ok()) {
+    LOG(ERROR) << "PutDeletedItem error, blocks leaked: " << groups << " " <<
+      s.ToString();
+  }
+}
+
+void* GCWorker::ThreadMain() {
+  std::string item;
+  while (!should_stop()) {
+    if (!gc_->PopItem(&item)) {
       continue;
     }
+    Status s = ReclaimItem(item);
+    if (!s.ok()) {
+      LOG(ERROR) << "ReclaimItem error: " << item << " " << s.ToString();
+    }
+  }
+  return nullptr;
+}
+
+GCThread::~GCThread() {
+  for (auto w : workers_) {
+    delete w;
+  }
+}
 
-    std::vector<std::string> block_indexs;
-    int deleted_count_ = 0;
-    s = ParseDeletedBlocks(deleted_blocks, &block_indexs);
+int GCThread::AddWorker(ZgwStore* store) {
+  GCWorker* worker = new GCWorker(this, store);
+  int ret = worker->StartThread();
+  if (ret != 0) {
+    delete worker;
+    return ret;
+  }
+  workers_.push_back(worker);
+  return 0;
+}
+
+void GCThread::RecordError(const std::string& error) {
+  error_count_++;
+  slash::MutexLock l(&stats_mu_);
+  last_error_ = error;
+}
+
+void GCThread::UpdateStats() {
+  uint64_t now = slash::NowMicros();
+  if (now - last_stats_time_ < kGCIntervalSeconds * 1000000ULL) {
+    return;
+  }
+  uint64_t backlog, oldest_deleted_time;
+  Status s = store_->GetDeletedQueueInfo(&backlog, &oldest_deleted_time);
+  if (!s.ok()) {
+    RecordError("GetDeletedQueueInfo: " + s.ToString());
+  }
+
+  uint64_t blocks = reclaimed_blocks_;
+  uint64_t bytes = reclaimed_bytes_;
+  slash::MutexLock l(&stats_mu_);
+  if (s.ok()) {
+    backlog_ = backlog;
+    oldest_deleted_time_ = oldest_deleted_time;
+  }
+  if (last_stats_time_ != 0) {
+    uint64_t interval = now - last_stats_time_;
+    blocks_per_sec_ = (blocks - last_blocks_) * 1000000 / interval;
+    bytes_per_sec_ = (bytes - last_bytes_) * 1000000 / interval;
+  }
+  last_stats_time_ = now;
+  last_blocks_ = blocks;
+  last_bytes_ = bytes;
+}
+
+static std::string EscapeJson(const std::string& str) {
+  std::string result;
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      result.push_back('\\');
+      result.push_back(c);
+    } else if (static_cast<unsigned char>(c) >= 0x20) {
+      result.push_back(c);
+    }
+  }
+  return result;
+}
+
+std::string GCThread::GCStatus() {
+  const char* format = "{\
+      \"backlog\": \"%lu\",\
+      \"oldest_pending_sec\": \"%lu\",\
+      \"reclaimed_items\": \"%lu\",\
+      \"reclaimed_blocks\": \"%lu\",\
+      \"reclaimed_bytes\": \"%lu\",\
+      \"blocks_per_sec\": \"%lu\",\
+      \"bytes_per_sec\": \"%lu\",\
+      \"errors\": \"%lu\",\
+      \"last_error\": \"%s\"}";
+
+  slash::MutexLock l(&stats_mu_);
+  uint64_t now = slash::NowMicros();
+  uint64_t oldest_pending_sec = 0;
+  if (oldest_deleted_time_ != 0 && now > oldest_deleted_time_) {
+    oldest_pending_sec = (now - oldest_deleted_time_) / 1000000;
+  }
+  char buf[1024];
+  snprintf(buf, sizeof(buf), format,
+           backlog_, oldest_pending_sec,
+           reclaimed_items_.load(), reclaimed_blocks_.load(),
+           reclaimed_bytes_.load(), blocks_per_sec_, bytes_per_sec_,
+           error_count_.load(), EscapeJson(last_error_.substr(0, 256)).c_str());
+  return std::string(buf);
+}
+
+bool GCThread::PopItem(std::string* item) {
+  slash::MutexLock l(&mu_);
+  if (items_.empty()) {
+    cond_.TimedWait(kGCWaitMs);
+    if (items_.empty()) {
+      return false;
+    }
+  }
+  item->swap(items_.front());
+  items_.pop_front();
+  return true;
+}
+
+void GCThread::ClaimQueues() {
+  std::vector<int> queues;
+  Status s = store_->ClaimDeletedQueues(kQueueClaimTTLMs, &queues);
+  if (!s.ok()) {
+    LOG(ERROR) << "ClaimDeletedQueues error: " << s.ToString();
+    RecordError("ClaimDeletedQueues: " + s.ToString());
+    // Claims expire soon, leave the queues to the other gateways
+    queues_.clear();
+    return;
+  }
+  if (queues != queues_) {
+    std::string queues_str;
+    for (auto q : queues) {
+      queues_str += " " + std::to_string(q);
+    }
+    LOG(INFO) << "GC claims deleted queues:" << queues_str;
+  }
+  queues_.swap(queues);
+  next_queue_ = 0;
+  idle_queues_ = 0;
+}
+
+void GCThread::ReclaimLeases() {
+  int32_t reclaimed = kLeaseReclaimBatch;
+  while (reclaimed == kLeaseReclaimBatch && !should_stop()) {
+    Status s = store_->ReclaimAllocLeases(kLeaseReclaimBatch, &reclaimed);
     if (!s.ok()) {
-      LOG(ERROR) << "ParseDeletedBlocks error: " << deleted_blocks << " " <<
-        s.ToString();
-      return nullptr;
+      LOG(ERROR) << "ReclaimAllocLeases error: " << s.ToString();
+      RecordError("ReclaimAllocLeases: " + s.ToString());
+      return;
+    }
+    if (reclaimed > 0) {
+      LOG(INFO) << "Reclaimed " << reclaimed << " expired allocation leases";
     }
+  }
+}
 
-    for (auto& index : block_indexs) {
-      LOG(INFO) << "Delete block: " << index;
+void* GCThread::ThreadMain() {
+  std::vector<std::string> items;
+  int backoff_ms = kGCRetryBaseMs;
+  while (!should_stop()) {
+    UpdateStats();
+    bool busy;
+    {
+      slash::MutexLock l(&mu_);
+      busy = items_.size() >= static_cast<size_t>(batch_size_);
+    }
+    if (busy) {
+      usleep(kGCWaitMs * 1000);
+      continue;
+    }
 
-      uint64_t start_block, end_block, dummy1, dummy2;
-      sscanf(index.c_str(), "%lu-%lu(%lu,%lu)",
-             &start_block, &end_block, &dummy1, &dummy2);
+    uint64_t now = slash::NowMicros();
+    if (now - latest_claim_time_ >= kQueueClaimIntervalSeconds * 1000000ULL) {
+      latest_claim_time_ = now;
+      ClaimQueues();
+    }
+    if (queues_.empty()) {
+      sleep(kGCIntervalSeconds);
+      continue;
+    }
+    // Leases are reclaimed by the gateway claiming the first queue
+    if (queues_[0] == 0 &&
+        now - latest_reclaim_time_ >= kLeaseReclaimIntervalSeconds * 1000000ULL) {
+      latest_reclaim_time_ = now;
+      ReclaimLeases();
+    }
 
-      s = store_->Lock();
-      if (!s.ok()) {
-        LOG(ERROR) << "GCThread Lock error: " << s.ToString();
-      }
-      for (uint64_t b = start_block; b <= end_block; b++) {
-        s = store_->BlockUnref(b);
-        if (!s.ok()) {
-          LOG(ERROR) << "BlockUnref Block " << b << " error: " << s.ToString();
-        }
-      }
-      s = store_->UnLock();
-      if (!s.ok()) {
-        LOG(ERROR) << "GCThread UnLock error: " << s.ToString();
+    // Claimed queues in turn
+    next_queue_ = (next_queue_ + 1) % queues_.size();
+    uint64_t deleted_before = now - kBlockReservedTime * 1000000ULL;
+    Status s = store_->GetDeletedItems(queues_[next_queue_], batch_size_,
+                                       deleted_before, &items);
+    if (!s.ok()) {
+      LOG(ERROR) << "GetDeletedItems error: " << s.ToString();
+      RecordError("GetDeletedItems: " + s.ToString());
+      usleep(backoff_ms * 1000);
+      backoff_ms = std::min(backoff_ms * 2, kGCRetryMaxMs);
+      continue;
+    }
+    backoff_ms = kGCRetryBaseMs;
+
+    {
+      slash::MutexLock l(&mu_);
+      for (auto& item : items) {
+        items_.push_back(item);
       }
+      cond_.SignalAll();
     }
+    if (items.size() < static_cast<size_t>(batch_size_)) {
+      idle_queues_++;
+    } else {
+      idle_queues_ = 0;
+    }
+    if (idle_queues_ >= queues_.size()) {
+      // No more expired items in any claimed queue
+      idle_queues_ = 0;
+      sleep(kGCIntervalSeconds);
+    }
+  }
+
+  // Workers finish the items in hand, return the ones not dispatched
+  for (auto w : workers_) {
+    if (w->is_running()) {
+      w->StopThread();
+    }
+  }
+  std::vector<std::string> rest(items_.begin(), items_.end());
+  items_.clear();
+  Status s = store_->PutBackDeletedItems(rest);
+  if (!s.ok()) {
+    LOG(ERROR) << "PutBackDeletedItems " << rest.size() <<
+      " items error, blocks leaked: " << s.ToString();
   }
   return nullptr;
 }
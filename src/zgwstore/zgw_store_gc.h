@@ -1,38 +1,151 @@
 #ifndef ZGW_STORE_GC_H_
 #define ZGW_STORE_GC_H_
 
+#include <atomic>
 #include <iostream>
 #include <string>
+#include <vector>
+#include <deque>
 
 #include "zgw_store.h"
 #include "pink/include/pink_thread.h"
 #include "slash/include/env.h"
+#include "slash/include/slash_mutex.h"
 
 
 namespace zgwstore {
 
+class GCThread;
+
+// Deleted item of a multipart object: 32 hex upload_id, bucket|object.
+// Items of block groups never qualify, the first group has '-' in its
+// first 21 bytes
+extern bool ParseMultipartItem(const std::string& deleted_item,
+                               std::string* upload_id,
+                               std::string* bucket_name,
+                               std::string* object_name);
+
+// Blocks deleted per second by all GC workers, unlimited if not positive
+class GCRateLimiter {
+ public:
+  explicit GCRateLimiter(int64_t blocks_per_sec)
+      : blocks_per_sec_(blocks_per_sec),
+        next_micros_(0) {
+  }
+
+  // Sleep until count more blocks may be deleted
+  void Acquire(int64_t count);
+
+ private:
+  int64_t blocks_per_sec_;
+  uint64_t next_micros_;
+  slash::Mutex mu_;
+};
+
+// Reclaim the blocks of deleted items dispatched by GCThread
+class GCWorker : public pink::Thread {
+ public:
+  GCWorker(GCThread* gc, ZgwStore* store)
+      : gc_(gc),
+        store_(store) {
+    set_thread_name("GCWorker");
+  }
+  virtual ~GCWorker() {
+    delete store_;
+  }
+
+ private:
+  virtual void* ThreadMain() override;
+  Status ReclaimItem(const std::string& item);
+  Status ParseDeletedBlocks(const std::string& deleted_item,
+                            std::vector<std::string>* block_indexs);
+  // Queue blocks DeleteBlock failed on for the next round
+  void RequeueBlocks(const std::vector<uint64_t>& blocks,
+                     uint64_t deleted_time);
+
+  GCThread* gc_;
+  ZgwStore* store_;
+};
+
+// Take expired items off the claimed deleted queues in batches and
+// dispatch them to the GC workers
 class GCThread : public pink::Thread {
  public:
-  GCThread()
-      : latest_action_time_(slash::NowMicros()) {
+  GCThread(int batch_size, int64_t max_blocks_per_sec)
+      : batch_size_(batch_size > 0 ? batch_size : 1),
+        rate_limiter_(max_blocks_per_sec),
+        store_(nullptr),
+        latest_reclaim_time_(0),
+        latest_claim_time_(0),
+        next_queue_(0),
+        idle_queues_(0),
+        cond_(&mu_),
+        reclaimed_items_(0),
+        reclaimed_blocks_(0),
+        reclaimed_bytes_(0),
+        error_count_(0),
+        backlog_(0),
+        oldest_deleted_time_(0),
+        blocks_per_sec_(0),
+        bytes_per_sec_(0),
+        last_stats_time_(0),
+        last_blocks_(0),
+        last_bytes_(0) {
     set_thread_name("GCThread");
   }
-  ~GCThread() {}
+  virtual ~GCThread();
 
+  // Workers are stopped after the GCThread, take the ownership of store
+  int AddWorker(ZgwStore* store);
   int StartThread(ZgwStore* store) {
     store_ = store;
     return Thread::StartThread();
   }
 
+  // JSON object of backlog, reclaim rate and errors
   std::string GCStatus();
 
  private:
+  friend class GCWorker;
+
   virtual void* ThreadMain() override;
-  Status ParseDeletedBlocks(const std::string& deleted_item,
-                          std::vector<std::string>* block_indexs);
+  // Block until an item is dispatched, false if nothing to do
+  bool PopItem(std::string* item);
+  // Deleted queues are partitioned among the gateways running GC
+  void ClaimQueues();
+  // Queue the ids of failed uploads, whose leases expired
+  void ReclaimLeases();
+  void RecordError(const std::string& error);
+  void UpdateStats();
 
-  uint64_t latest_action_time_;
+  int batch_size_;
+  GCRateLimiter rate_limiter_;
   ZgwStore* store_;
+  uint64_t latest_reclaim_time_;
+  uint64_t latest_claim_time_;
+  std::vector<int> queues_;
+  size_t next_queue_;
+  size_t idle_queues_;
+  std::vector<GCWorker*> workers_;
+
+  slash::Mutex mu_;
+  slash::CondVar cond_;
+  std::deque<std::string> items_;
+
+  // Stats
+  std::atomic<uint64_t> reclaimed_items_;
+  std::atomic<uint64_t> reclaimed_blocks_;
+  std::atomic<uint64_t> reclaimed_bytes_;
+  std::atomic<uint64_t> error_count_;
+  slash::Mutex stats_mu_;
+  std::string last_error_;
+  uint64_t backlog_;
+  uint64_t oldest_deleted_time_;
+  uint64_t blocks_per_sec_;
+  uint64_t bytes_per_sec_;
+  uint64_t last_stats_time_;
+  uint64_t last_blocks_;
+  uint64_t last_bytes_;
 };
 
 }  // namespace zgwstore